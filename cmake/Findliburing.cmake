@@ -0,0 +1,12 @@
+include(FindPackageHandleStandardArgs)
+
+find_library(LIBURING_LIB uring)
+find_path(LIBURING_INCLUDE liburing.h)
+
+find_package_handle_standard_args(liburing REQUIRED_VARS LIBURING_LIB LIBURING_INCLUDE)
+
+if(liburing_FOUND AND NOT TARGET liburing)
+    add_library(liburing UNKNOWN IMPORTED)
+    target_include_directories(liburing INTERFACE ${LIBURING_INCLUDE})
+    set_target_properties(liburing PROPERTIES IMPORTED_LOCATION ${LIBURING_LIB})
+endif()
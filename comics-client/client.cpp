@@ -1,13 +1,13 @@
-#include <add_ons/asio/io.hpp>
+#include <add_ons/asio/cancellable_io.hpp>
 #include <boost/beast.hpp>
 #include <promise-cpp/promise.hpp>
 
 #include <comicsdb.h>
 #include <json.h>
 
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
-#include <map>
 
 namespace asio = boost::asio;
 namespace beast = boost::beast;
@@ -20,52 +20,62 @@ namespace Comics = comicsdb::v2;
 namespace comicsClient
 {
 
+// Deadline for a whole request: resolve, connect, write and read.
+constexpr std::uint64_t REQUEST_TIMEOUT_MS = 10000;
+
+// Attempts at an edit before giving up on a comic that keeps changing.
+constexpr int MAX_EDIT_ATTEMPTS = 3;
+
 struct Session : std::enable_shared_from_this<Session>
 {
     explicit Session(const std::string &server, asio::io_context &ioc, Comics::ComicDb &db) :
         m_server(server),
+        m_ioc(ioc),
         m_resolver(ioc),
         m_socket(ioc),
         m_db(db)
     {
     }
 
-    promise::Promise readRemoteComic(int id);
-    promise::Promise updateRemoteComic(int localId);
+    promise::Promise sync();
+    promise::Promise editRemoteComic(int id, Comics::ComicEdit edit, int attempts = MAX_EDIT_ATTEMPTS);
 
     std::string                       m_server;
+    asio::io_context                 &m_ioc;
     tcp::resolver                     m_resolver;
     tcp::socket                       m_socket;
     beast::flat_buffer                m_buffer;
     http::request<http::string_body>  m_req;
     http::response<http::string_body> m_res;
-    Comics::ComicDb                  &m_db;
-    int                               m_id{-1};
-    std::map<int, int>                m_remoteIds;
+    Comics::ComicDb                  &m_db; // mirror of the server's comics, with their ids and versions
 };
 
 promise::Promise sendRequest(std::shared_ptr<Session> session, const std::string &host, const std::string &port)
 {
+    // Reaching the deadline cancels whichever step is in flight
+    promise::cancel_token deadline;
+    deadline.expires_after(session->m_ioc, REQUEST_TIMEOUT_MS);
+
     //<1> Resolve the host
-    return promise::async_resolve(session->m_resolver, host, port)
+    return promise::async_resolve(session->m_resolver, host, port, deadline)
         .then(
             [=](tcp::resolver::results_type &results)
             {
                 //<2> Connect to the host
-                return promise::async_connect(session->m_socket, results);
+                return promise::async_connect(session->m_socket, results, deadline);
             })
         .then(
             [=]()
             {
                 //<3> Write the request
-                return promise::async_write(session->m_socket, session->m_req);
+                return promise::async_write(session->m_socket, session->m_req, deadline);
             })
         .then(
             [=](size_t bytes_transferred)
             {
                 boost::ignore_unused(bytes_transferred);
                 //<4> Read the response
-                return promise::async_read(session->m_socket, session->m_buffer, session->m_res);
+                return promise::async_read(session->m_socket, session->m_buffer, session->m_res, deadline);
             })
         .then(
             [=](size_t bytes_transferred)
@@ -87,8 +97,10 @@ promise::Promise sendRequest(std::shared_ptr<Session> session, const std::string
         .then(
             [=](boost::system::error_code &err)
             {
-                //<7> Gracefully close the socket
+                //<7> Gracefully close the socket, releasing it after a failure too
+                deadline.release();
                 session->m_socket.shutdown(tcp::socket::shutdown_both, err);
+                session->m_socket.close(err);
             });
 }
 
@@ -102,18 +114,37 @@ promise::Promise getRequest(std::shared_ptr<Session> session, std::string const
     session->m_req.target(target);
     session->m_req.set(http::field::host, host);
     session->m_req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    session->m_res = {};
     return sendRequest(session, host, port);
 }
 
-promise::Promise Session::readRemoteComic(int id)
+// Brings the mirror up to date, transferring only the comics changed
+// since the version it has.
+promise::Promise Session::sync()
 {
-    return getRequest(shared_from_this(), m_server, "8000", "/comic/" + std::to_string(id), 10);
+    auto                session = shared_from_this();
+    const std::uint64_t since = Comics::lastSequence(m_db);
+    return getRequest(session, m_server, "8000", "/comics?since=" + std::to_string(since), 10)
+        .then(
+            [session, since]
+            {
+                if (session->m_res.result() != http::status::ok || session->m_res.body().empty())
+                {
+                    std::cerr << "Sync failed: " << session->m_res.result_int() << '\n';
+                    return;
+                }
+                const Comics::Delta delta = Comics::deltaFromJson(session->m_res.body());
+                applyDelta(session->m_db, delta);
+                std::cout << "Synced " << delta.comics.size() << " changed comics from version " << since
+                          << " to " << delta.version << '\n';
+            });
 }
 
 promise::Promise putRequest(std::shared_ptr<Session> session, std::string const &host, std::string const &port,
-                            std::string const &target, int version, int localId)
+                            std::string const &target, int version, const Comics::Comic &comic,
+                            std::uint64_t ifVersion)
 {
-    // Set up an HTTP PUT request message
+    // Set up a conditional HTTP PUT request message
     session->m_req = {};
     session->m_req.version(version);
     session->m_req.method(http::verb::put);
@@ -121,15 +152,39 @@ promise::Promise putRequest(std::shared_ptr<Session> session, std::string const
     session->m_req.set(http::field::host, host);
     session->m_req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
     session->m_req.set(http::field::content_type, "application/json");
-    session->m_req.body() = toJson(session->m_db[localId]);
+    session->m_req.set(http::field::if_match, '"' + std::to_string(ifVersion) + '"');
+    session->m_req.body() = toJson(comic);
     session->m_req.prepare_payload();
+    session->m_res = {};
     return sendRequest(session, host, port);
 }
 
-promise::Promise Session::updateRemoteComic(int localId)
+// Edits the mirrored comic and writes it back, unless it changed on the
+// server since the mirror's version; then the mirror is synced and the
+// edit applied again to the newer version, so no update is lost.
+promise::Promise Session::editRemoteComic(int id, Comics::ComicEdit edit, int attempts)
 {
-    int remoteId = m_remoteIds[localId];
-    return putRequest(shared_from_this(), m_server, "8000", "/comic/" + std::to_string(remoteId), 10, localId);
+    auto                         session = shared_from_this();
+    const Comics::VersionedComic current = readVersionedComic(m_db, id);
+    Comics::Comic                comic = current.comic;
+    edit(comic);
+    return putRequest(session, m_server, "8000", "/comic/" + std::to_string(id), 10, comic, current.version)
+        .then(
+            [session, id, edit, attempts]
+            {
+                const http::status status = session->m_res.result();
+                if (status == http::status::precondition_failed && attempts > 1)
+                {
+                    std::cout << "Comic " << id << " changed on the server, editing it again\n";
+                    return session->sync().then([session, id, edit, attempts]
+                                                { return session->editRemoteComic(id, edit, attempts - 1); });
+                }
+                if (status != http::status::ok)
+                {
+                    std::cerr << "Update of comic " << id << " failed: " << session->m_res.result_int() << '\n';
+                }
+                return promise::resolve();
+            });
 }
 
 static int run(int argc, char *argv[])
@@ -145,23 +200,21 @@ static int run(int argc, char *argv[])
     Comics::ComicDb   db;
     auto              session = std::make_shared<Session>(server, ioc, db);
 
-    session->readRemoteComic(0)
+    session->sync()
         .then(
             [=]
             {
-                session->m_id = createComic(session->m_db, Comics::fromJson(session->m_res.body()));
-                session->m_remoteIds.emplace(session->m_id, 0);
-                Comics::Comic comic = readComic(session->m_db, session->m_id);
-                comic.pencils = Comics::findPerson("Steve Ditko");
-                updateComic(session->m_db, session->m_id, comic);
+                std::cout << "Mirrored comic: " << toJson(readComic(session->m_db, 0)) << '\n';
+                return session->editRemoteComic(0, [](Comics::Comic &comic)
+                                                { comic.pencils = Comics::findPerson("Steve Ditko"); });
             })
         .then(
             [=]
             {
-                std::cout << "Updated local comic: " << toJson(session->m_db[session->m_id]) << '\n';
-                return session->updateRemoteComic(session->m_id);
+                // Picks up just the edited comic, along with anything else changed meanwhile
+                return session->sync();
             })
-        .then([] { std::cout << "Remote comic updated\n"; });
+        .then([=] { std::cout << "Remote comic updated: " << toJson(readComic(session->m_db, 0)) << '\n'; });
 
     ioc.run();
 
@@ -0,0 +1,273 @@
+#include "replication.h"
+
+#include <json.h>
+
+#include <add_ons/asio/cancellable_io.hpp>
+#include <add_ons/asio/timer.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <utility>
+
+namespace Comics = comicsdb::v2;
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+using error_code = boost::system::error_code;
+using tcp = asio::ip::tcp;
+
+namespace comicsServer
+{
+namespace
+{
+
+// Longer than the primary holds a change feed request open.
+constexpr std::uint64_t REQUEST_TIMEOUT_MS = 30000;
+// Pause before reconnecting to the primary after a failure.
+constexpr std::uint64_t RETRY_DELAY_MS = 1000;
+
+std::int64_t nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+struct ChangeFeed::Waiter
+{
+    explicit Waiter(const asio::any_io_executor &executor) :
+        m_timer(executor)
+    {
+    }
+
+    asio::steady_timer m_timer;
+};
+
+promise::Promise ChangeFeed::wait(const asio::any_io_executor &executor, std::uint64_t since,
+                                  std::chrono::milliseconds timeout)
+{
+    auto waiter = std::make_shared<Waiter>(executor);
+    waiter->m_timer.expires_after(timeout);
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_sequence > since)
+        {
+            return promise::resolve();
+        }
+        m_waiters.push_back(waiter);
+    }
+    // notify() cancels the timer through the executor, so not before the wait has started
+    return promise::newPromise(
+        [=](promise::Defer &defer)
+        {
+            waiter->m_timer.async_wait(
+                [this, waiter, defer](const error_code &)
+                {
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        auto it = std::find(m_waiters.begin(), m_waiters.end(), waiter);
+                        if (it != m_waiters.end())
+                        {
+                            m_waiters.erase(it);
+                        }
+                    }
+                    defer.resolve();
+                });
+        });
+}
+
+void ChangeFeed::notify(std::uint64_t sequence)
+{
+    std::vector<std::shared_ptr<Waiter>> waiters;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_sequence = std::max(m_sequence, sequence);
+        waiters.swap(m_waiters);
+    }
+    for (std::shared_ptr<Waiter> &waiter : waiters)
+    {
+        asio::post(waiter->m_timer.get_executor(), [waiter] { waiter->m_timer.cancel(); });
+    }
+}
+
+struct Replica::Connection
+{
+    explicit Connection(asio::io_context &ioc) :
+        m_resolver(ioc),
+        m_socket(ioc)
+    {
+    }
+
+    tcp::resolver                     m_resolver;
+    tcp::socket                       m_socket;
+    beast::flat_buffer                m_buffer;
+    http::request<http::empty_body>   m_req;
+    http::response<http::string_body> m_res;
+};
+
+Replica::Replica(Comics::ComicDb &db, std::string host, std::string port) :
+    m_db(db),
+    m_host(std::move(host)),
+    m_port(std::move(port)),
+    m_primary(m_host + ':' + m_port)
+{
+    m_thread = std::thread([this] { run(); });
+}
+
+Replica::~Replica()
+{
+    m_ioc.stop();
+    m_thread.join();
+}
+
+Replica::Status Replica::status() const
+{
+    Status result;
+    result.connected = m_connected;
+    result.primarySequence = m_primarySequence;
+    result.appliedSequence = m_appliedSequence;
+    result.applyDelayMs = m_applyDelayMs;
+    result.resyncs = m_resyncs;
+    return result;
+}
+
+void Replica::run()
+{
+    promise::doWhile(
+        [this](promise::DeferLoop &loop)
+        {
+            step().then([loop]() { loop.doContinue(); },
+                        [this, loop]()
+                        {
+                            //<4> Start over with a new connection after a pause,
+                            // whatever the step was rejected with
+                            disconnect();
+                            promise::delay(m_ioc, RETRY_DELAY_MS).then([loop]() { loop.doContinue(); });
+                        });
+        });
+    m_ioc.run();
+}
+
+promise::Promise Replica::step()
+{
+    //<1> Connect to the primary
+    if (!m_connection)
+    {
+        return connect();
+    }
+
+    //<2> Restore a snapshot, when starting or after falling too far behind
+    if (m_needSnapshot)
+    {
+        return get("/replication/snapshot")
+            .then(
+                [this]()
+                {
+                    Comics::Snapshot    snapshot = Comics::snapshotFromJson(m_connection->m_res.body());
+                    const std::uint64_t sequence = snapshot.sequence;
+                    Comics::restore(m_db, std::move(snapshot));
+                    m_needSnapshot = false;
+                    m_primarySequence = std::max<std::uint64_t>(m_primarySequence, sequence);
+                    m_appliedSequence = sequence;
+                    ++m_resyncs;
+                });
+    }
+
+    //<3> Apply the changes committed since the last one applied;
+    // the primary holds the request open until there are some
+    const std::uint64_t since = Comics::lastSequence(m_db);
+    return get("/replication/changes?since=" + std::to_string(since))
+        .then(
+            [this, since]()
+            {
+                Comics::ChangeBatch batch = Comics::changeBatchFromJson(m_connection->m_res.body());
+                m_primarySequence = batch.sequence;
+                // A primary behind the replica has been restarted with other data
+                if (batch.resync || batch.sequence < since)
+                {
+                    m_needSnapshot = true;
+                    return;
+                }
+                try
+                {
+                    for (const Comics::Change &change : batch.changes)
+                    {
+                        Comics::applyChange(m_db, change);
+                        m_appliedSequence = change.sequence;
+                        m_applyDelayMs = nowMs() - change.timeMs;
+                    }
+                }
+                catch (const std::runtime_error &bang)
+                {
+                    std::cerr << "replica: " << bang.what() << '\n';
+                    m_needSnapshot = true;
+                }
+            });
+}
+
+promise::Promise Replica::connect()
+{
+    auto                  connection = std::make_shared<Connection>(m_ioc);
+    promise::cancel_token deadline;
+    deadline.expires_after(m_ioc, REQUEST_TIMEOUT_MS);
+    return promise::async_resolve(connection->m_resolver, m_host, m_port, deadline)
+        .then([connection, deadline](tcp::resolver::results_type &results)
+              { return promise::async_connect(connection->m_socket, results, deadline); })
+        .then(
+            [this, connection]()
+            {
+                m_connection = connection;
+                m_connected = true;
+            })
+        .finally([deadline]() { deadline.release(); });
+}
+
+promise::Promise Replica::get(const std::string &target)
+{
+    auto connection = m_connection;
+    connection->m_req = {};
+    connection->m_req.version(11);
+    connection->m_req.method(http::verb::get);
+    connection->m_req.target(target);
+    connection->m_req.set(http::field::host, m_host);
+    connection->m_req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+    connection->m_res = {};
+
+    promise::cancel_token deadline;
+    deadline.expires_after(m_ioc, REQUEST_TIMEOUT_MS);
+    return promise::async_write(connection->m_socket, connection->m_req, deadline)
+        .then([connection, deadline]()
+              { return promise::async_read(connection->m_socket, connection->m_buffer, connection->m_res, deadline); })
+        .then(
+            [connection]()
+            {
+                if (connection->m_res.result() != http::status::ok)
+                {
+                    std::cerr << "replica: " << connection->m_res.result_int() << " from primary\n";
+                    return promise::reject(error_code{boost::system::errc::protocol_error, boost::system::generic_category()});
+                }
+                return promise::resolve();
+            })
+        .finally([deadline]() { deadline.release(); });
+}
+
+void Replica::disconnect()
+{
+    if (m_connection)
+    {
+        error_code ignored;
+        m_connection->m_socket.close(ignored);
+        m_connection.reset();
+    }
+    m_connected = false;
+}
+
+} // namespace comicsServer
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <comicsdb.h>
+
+#include <promise-cpp/promise.hpp>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace comicsServer
+{
+
+// Wakes the long-polling change feed requests of a primary when its
+// database commits a change.
+class ChangeFeed
+{
+public:
+    // Returns a promise resolved on the executor once a change after since
+    // has been committed, or once the timeout has passed without one.
+    promise::Promise wait(const boost::asio::any_io_executor &executor, std::uint64_t since,
+                          std::chrono::milliseconds timeout);
+
+    // Called by the database after each committed change.
+    void notify(std::uint64_t sequence);
+
+private:
+    struct Waiter;
+
+    std::mutex                           m_mutex;
+    std::uint64_t                        m_sequence{};
+    std::vector<std::shared_ptr<Waiter>> m_waiters;
+};
+
+// Keeps a database in sync with a primary server: restores a snapshot
+// of the primary, then tails its change feed and applies the changes in
+// order, on a thread and io_context of its own. After a failure it
+// reconnects and carries on from the last change applied.
+class Replica
+{
+public:
+    struct Status
+    {
+        bool          connected{};
+        std::uint64_t primarySequence{};
+        std::uint64_t appliedSequence{};
+        std::int64_t  applyDelayMs{}; // from the primary's commit of the last applied change
+        std::uint64_t resyncs{};
+    };
+
+    Replica(comicsdb::v2::ComicDb &db, std::string host, std::string port);
+    Replica(const Replica &rhs) = delete;
+    Replica &operator=(const Replica &rhs) = delete;
+    ~Replica();
+
+    const std::string &primary() const
+    {
+        return m_primary;
+    }
+    Status status() const;
+
+private:
+    struct Connection;
+
+    void             run();
+    promise::Promise step();
+    promise::Promise connect();
+    promise::Promise get(const std::string &target);
+    void             disconnect();
+
+    comicsdb::v2::ComicDb      &m_db;
+    std::string                 m_host;
+    std::string                 m_port;
+    std::string                 m_primary;
+    boost::asio::io_context     m_ioc;
+    std::shared_ptr<Connection> m_connection;
+    bool                        m_needSnapshot{true};
+    std::atomic<bool>           m_connected{};
+    std::atomic<std::uint64_t>  m_primarySequence{};
+    std::atomic<std::uint64_t>  m_appliedSequence{};
+    std::atomic<std::int64_t>   m_applyDelayMs{};
+    std::atomic<std::uint64_t>  m_resyncs{};
+    std::thread                 m_thread;
+};
+
+} // namespace comicsServer
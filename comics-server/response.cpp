@@ -0,0 +1,220 @@
+#include "response.h"
+
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+namespace comicsServer
+{
+namespace
+{
+
+namespace http = boost::beast::http;
+
+constexpr std::size_t NUM_CONTENT_TYPES = 2;
+constexpr std::size_t NUM_ERRORS = 8;
+constexpr std::size_t NUM_VERSIONS = 2;
+
+// HTTP/1.0 requests get HTTP/1.0 responses, everything else HTTP/1.1.
+std::size_t versionIndex(unsigned version)
+{
+    return version == 10 ? 0 : 1;
+}
+
+unsigned indexVersion(std::size_t index)
+{
+    return index == 0 ? 10 : 11;
+}
+
+const char *contentTypeName(ContentType type)
+{
+    switch (type)
+    {
+    case ContentType::Json:
+        return "application/json";
+    case ContentType::Text:
+        return "text/plain";
+    }
+    return "application/octet-stream";
+}
+
+// Serialized with beast so that the bytes match what it would have written.
+template <class Message>
+std::string toWire(const Message &message)
+{
+    std::ostringstream wire;
+    wire << message;
+    return wire.str();
+}
+
+// Returns the header block up to, but not including, the terminating empty line.
+std::string headerBlock(ContentType type, unsigned version)
+{
+    http::response<http::empty_body> res{http::status::ok, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, contentTypeName(type));
+    std::string wire = toWire(res.base());
+    wire.resize(wire.size() - 2);
+    return wire;
+}
+
+std::string errorWire(Error error, unsigned version, bool keepAlive)
+{
+    http::status status{};
+    const char  *body{};
+    switch (error)
+    {
+    case Error::UnknownMethod:
+        status = http::status::bad_request;
+        body = "Unknown HTTP-method";
+        break;
+    case Error::MalformedUri:
+        status = http::status::bad_request;
+        body = "Malformed URI";
+        break;
+    case Error::NotFound:
+        status = http::status::not_found;
+        body = "The resource was not found.";
+        break;
+    case Error::InternalError:
+        status = http::status::internal_server_error;
+        body = "An error occurred: 'Internal error'";
+        break;
+    case Error::PayloadTooLarge:
+        status = http::status::payload_too_large;
+        body = "The request body is too large.";
+        break;
+    case Error::ReadOnly:
+        status = http::status::method_not_allowed;
+        body = "This server is a read-only replica.";
+        break;
+    case Error::PreconditionFailed:
+        status = http::status::precondition_failed;
+        body = "A comic has changed since the version the write was conditional on.";
+        break;
+    case Error::Conflict:
+        status = http::status::conflict;
+        body = "Another person already has that name; merge the two instead.";
+        break;
+    }
+    http::response<http::string_body> res{status, version};
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/html");
+    res.keep_alive(keepAlive);
+    res.body() = body;
+    res.prepare_payload();
+    return toWire(res);
+}
+
+struct Templates
+{
+    Templates()
+    {
+        for (std::size_t v = 0; v < NUM_VERSIONS; ++v)
+        {
+            for (std::size_t t = 0; t < NUM_CONTENT_TYPES; ++t)
+            {
+                headers[t][v] = headerBlock(static_cast<ContentType>(t), indexVersion(v));
+            }
+            for (std::size_t e = 0; e < NUM_ERRORS; ++e)
+            {
+                errors[e][v][0] = errorWire(static_cast<Error>(e), indexVersion(v), false);
+                errors[e][v][1] = errorWire(static_cast<Error>(e), indexVersion(v), true);
+            }
+        }
+    }
+
+    std::array<std::array<std::string, NUM_VERSIONS>, NUM_CONTENT_TYPES>             headers;
+    std::array<std::array<std::array<std::string, 2>, NUM_VERSIONS>, NUM_ERRORS> errors;
+};
+
+const Templates &templates()
+{
+    static const Templates result;
+    return result;
+}
+
+} // namespace
+
+Response::Response() :
+    Response(error(Error::InternalError, 11, false))
+{
+}
+
+Response::Response(ContentType type, unsigned version, bool keepAlive) :
+    m_head(&templates().headers[static_cast<std::size_t>(type)][versionIndex(version)]),
+    m_version(version == 10 ? 10 : 11),
+    m_keepAlive(keepAlive)
+{
+}
+
+Response Response::error(Error error, unsigned version, bool keepAlive)
+{
+    Response result(ContentType::Text, version, keepAlive);
+    result.m_head = &templates().errors[static_cast<std::size_t>(error)][versionIndex(version)][keepAlive ? 1 : 0];
+    result.m_complete = true;
+    return result;
+}
+
+std::array<boost::asio::const_buffer, 3> Response::buffers()
+{
+    if (m_complete)
+    {
+        return {boost::asio::buffer(*m_head), boost::asio::const_buffer{}, boost::asio::const_buffer{}};
+    }
+
+    m_fieldsSize = 0;
+    auto append = [this](const char *text, std::size_t size)
+    {
+        const std::size_t count = std::min(size, m_fields.size() - m_fieldsSize);
+        std::memcpy(m_fields.data() + m_fieldsSize, text, count);
+        m_fieldsSize += count;
+    };
+    auto appendLiteral = [&](const char *text) { append(text, std::strlen(text)); };
+
+    if (m_varyEncoding)
+    {
+        appendLiteral("Vary: Accept-Encoding\r\n");
+    }
+    if (m_contentEncoding != nullptr)
+    {
+        appendLiteral("Content-Encoding: ");
+        appendLiteral(m_contentEncoding);
+        appendLiteral("\r\n");
+    }
+    if (m_hasEtag)
+    {
+        appendLiteral("ETag: \"");
+        char etag[24];
+        const std::to_chars_result result = std::to_chars(std::begin(etag), std::end(etag), m_etag);
+        append(etag, static_cast<std::size_t>(result.ptr - etag));
+        appendLiteral("\"\r\n");
+    }
+    // Only the non-default persistence of each version needs a Connection field
+    if (m_version == 11 && !m_keepAlive)
+    {
+        appendLiteral("Connection: close\r\n");
+    }
+    else if (m_version == 10 && m_keepAlive)
+    {
+        appendLiteral("Connection: keep-alive\r\n");
+    }
+    appendLiteral("Content-Length: ");
+    char length[24];
+    const std::to_chars_result result = std::to_chars(std::begin(length), std::end(length), content().size());
+    append(length, static_cast<std::size_t>(result.ptr - length));
+    appendLiteral("\r\n\r\n");
+
+    return {boost::asio::buffer(*m_head), boost::asio::buffer(m_fields.data(), m_fieldsSize),
+            boost::asio::buffer(content())};
+}
+
+} // namespace comicsServer
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <boost/asio/buffer.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace comicsServer
+{
+
+// Content types of the successful responses.
+enum class ContentType
+{
+    Json,
+    Text,
+};
+
+// Error responses; their bodies never depend on the request.
+enum class Error
+{
+    UnknownMethod,
+    MalformedUri,
+    NotFound,
+    InternalError,
+    PayloadTooLarge,
+    ReadOnly,
+    PreconditionFailed,
+    Conflict,
+};
+
+// An HTTP response kept in wire format. The status line, Server and
+// Content-Type fields come from a header block serialized once per
+// content type and version; only the fields that vary per response
+// are formatted, into storage inside the response. The header block,
+// those fields and the body are written as one gathered write.
+class Response
+{
+public:
+    // An Internal Server Error that closes the connection, so that a
+    // response that is never assigned a real one still has a header block.
+    Response();
+    Response(ContentType type, unsigned version, bool keepAlive);
+
+    // Returns one of the fully serialized error responses.
+    static Response error(Error error, unsigned version, bool keepAlive);
+
+    std::string &body()
+    {
+        return m_body;
+    }
+    // Returns the body that will be written, which may be a shared one.
+    const std::string &content() const
+    {
+        return m_sharedBody ? *m_sharedBody : m_body;
+    }
+    // Writes a body owned elsewhere, such as a cache, instead of body().
+    void sharedBody(std::shared_ptr<const std::string> body)
+    {
+        m_sharedBody = std::move(body);
+    }
+    bool keepAlive() const
+    {
+        return m_keepAlive;
+    }
+
+    // Adds "Vary: Accept-Encoding".
+    void varyEncoding()
+    {
+        m_varyEncoding = true;
+    }
+    // Adds a Content-Encoding field; the coding must be a string literal.
+    void contentEncoding(const char *coding)
+    {
+        m_contentEncoding = coding;
+    }
+    // Adds an ETag field with the version of the resource.
+    void etag(std::uint64_t version)
+    {
+        m_etag = version;
+        m_hasEtag = true;
+    }
+
+    // Returns the header block, the varying fields and the body as one
+    // buffer sequence; the response has to outlive the write.
+    std::array<boost::asio::const_buffer, 3> buffers();
+
+private:
+    static constexpr std::size_t FIELDS_CAPACITY = 192;
+
+    const std::string                 *m_head{};
+    bool                               m_complete{};
+    unsigned                           m_version{11};
+    bool                               m_keepAlive{true};
+    bool                               m_varyEncoding{};
+    const char                        *m_contentEncoding{};
+    bool                               m_hasEtag{};
+    std::uint64_t                      m_etag{};
+    std::string                        m_body;
+    std::shared_ptr<const std::string> m_sharedBody;
+    std::array<char, FIELDS_CAPACITY>  m_fields;
+    std::size_t                        m_fieldsSize{};
+};
+
+} // namespace comicsServer
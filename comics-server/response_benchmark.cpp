@@ -0,0 +1,124 @@
+//
+// Compares building a comics-server response as a beast message and
+// running beast's serializer over it, as the server did before, with
+// building a Response from its prebuilt header block, and with sending
+// one of the fully serialized error responses. A Response is written
+// as gathered buffers; copying them into one string, as serialize()
+// did, is measured for comparison.
+//
+// Usage: response-benchmark [<iterations> [<body bytes>]]
+//
+#include "response.h"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace http = boost::beast::http;
+
+using comicsServer::ContentType;
+using comicsServer::Error;
+using comicsServer::Response;
+
+namespace
+{
+
+// Returns the nanoseconds per response; respond returns the size of
+// the response, summed up so that the work is not optimized away.
+template <typename Respond>
+double measure(int iterations, Respond respond)
+{
+    std::size_t total{};
+    const auto  begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        total += respond();
+    }
+    const auto end = std::chrono::steady_clock::now();
+    if (total == 0)
+    {
+        std::printf("no responses\n");
+    }
+    return std::chrono::duration<double, std::nano>(end - begin).count() / iterations;
+}
+
+std::size_t bufferSize(const std::array<boost::asio::const_buffer, 3> &buffers)
+{
+    return boost::asio::buffer_size(buffers);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const int         iterations = argc > 1 ? std::atoi(argv[1]) : 2000000;
+    const std::size_t bodySize = argc > 2 ? static_cast<std::size_t>(std::atoi(argv[2])) : 200;
+    const std::string body(bodySize, 'x');
+
+    const double beast = measure(iterations,
+                                 [&body]
+                                 {
+                                     http::response<http::string_body> res{http::status::ok, 11};
+                                     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+                                     res.set(http::field::content_type, "application/json");
+                                     res.keep_alive(true);
+                                     res.body() = body;
+                                     res.prepare_payload();
+                                     http::serializer<false, http::string_body> serializer{res};
+                                     boost::beast::error_code                   ec;
+                                     std::size_t                                size{};
+                                     do
+                                     {
+                                         serializer.next(ec,
+                                                         [&](boost::beast::error_code &, const auto &buffers)
+                                                         {
+                                                             const std::size_t n = boost::asio::buffer_size(buffers);
+                                                             size += n;
+                                                             serializer.consume(n);
+                                                         });
+                                     } while (!ec && !serializer.is_done());
+                                     return size;
+                                 });
+    const double prebuilt = measure(iterations,
+                                    [&body]
+                                    {
+                                        Response res{ContentType::Json, 11, true};
+                                        res.body() = body;
+                                        return bufferSize(res.buffers());
+                                    });
+    const double copied = measure(iterations,
+                                  [&body]
+                                  {
+                                      Response    res{ContentType::Json, 11, true};
+                                      std::string wire;
+                                      res.body() = body;
+                                      const auto buffers = res.buffers();
+                                      wire.reserve(bufferSize(buffers));
+                                      for (const boost::asio::const_buffer &buffer : buffers)
+                                      {
+                                          wire.append(static_cast<const char *>(buffer.data()), buffer.size());
+                                      }
+                                      return wire.size();
+                                  });
+    const double error = measure(iterations,
+                                 []
+                                 {
+                                     Response res = Response::error(Error::NotFound, 11, true);
+                                     return bufferSize(res.buffers());
+                                 });
+
+    std::printf("%d responses, %zu byte body\n", iterations, bodySize);
+    std::printf("%-20s %10s\n", "response", "ns");
+    std::printf("%-20s %10.1f\n", "beast serializer", beast);
+    std::printf("%-20s %10.1f\n", "prebuilt header", prebuilt);
+    std::printf("%-20s %10.1f\n", "  copied to a string", copied);
+    std::printf("%-20s %10.1f\n", "static error", error);
+    return 0;
+}
@@ -1,14 +1,41 @@
 #include <boost/asio.hpp>
 #include <boost/beast.hpp>
 
+#include "replication.h"
+#include "response.h"
+#include "trace.h"
+
 #include <comicsdb.h>
 #include <json.h>
 
 #include <add_ons/asio/io.hpp>
+#if defined(COMICS_SERVER_COROUTINES)
+#include <add_ons/asio/coroutine.hpp>
+#endif
+#include <add_ons/http/encoding.hpp>
+#include <add_ons/memory/pool_allocator.hpp>
+#include <add_ons/thread/work_stealing_pool.hpp>
 #include <promise-cpp/promise.hpp>
 
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <regex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 namespace Comics = comicsdb::v2;
 namespace asio = boost::asio;
@@ -22,144 +49,603 @@ using tcp = ip::tcp;
 
 template <class Body, class Allocator>
 using Request = http::request<Body, http::basic_fields<Allocator>>;
-using Response = http::response<http::string_body>;
 
 namespace comicsServer
 {
 
+// Largest request body accepted for create and update; a comic is a small JSON document.
+constexpr std::uint64_t MAX_COMIC_BODY_SIZE = 16 * 1024;
+// Largest transaction body accepted; room for a few thousand comics.
+constexpr std::uint64_t MAX_TRANSACTION_BODY_SIZE = 4 * 1024 * 1024;
+
+// Deadlines that keep slow or idle clients from pinning sessions.
+// The idle timeout covers waiting for, and reading, the next request header.
+constexpr std::chrono::seconds IDLE_TIMEOUT{30};
+constexpr std::chrono::seconds READ_TIMEOUT{10};
+constexpr std::chrono::seconds WRITE_TIMEOUT{10};
+
+// Connections beyond this are closed as soon as they are accepted.
+constexpr std::size_t MAX_CONNECTIONS = 10000;
+
+// Smaller bodies gain too little from gzip to pay for its CPU cost.
+constexpr std::size_t MIN_COMPRESS_SIZE = 256;
+// Bound on the number of compressed bodies kept for reuse.
+constexpr std::size_t MAX_COMPRESSED_BODIES = 1024;
+
+// Longest time a change feed request is held open waiting for a change,
+// and the most changes returned by one.
+constexpr std::chrono::milliseconds CHANGE_POLL_TIMEOUT{10000};
+constexpr std::size_t               CHANGE_BATCH_LIMIT = 1000;
+
+// Requests with bodies at least this large are parsed and stored on the CPU pool,
+// so that they do not stall the other connections of the I/O thread.
+constexpr std::size_t OFFLOAD_BODY_SIZE = 2048;
+
+// What the sessions of a server share.
+struct Services
+{
+    Comics::ComicDb             &db;
+    promise::work_stealing_pool &cpu;
+    ChangeFeed                  &changes;
+    const Replica               *replica; // null on a primary
+};
+
 struct Session
 {
-    explicit Session(tcp::socket &socket, Comics::ComicDb &db) :
-        m_socket(std::move(socket)),
-        m_db(db)
+    explicit Session(tcp::socket &socket, Services &services) :
+        m_stream(std::move(socket)),
+        m_db(services.db),
+        m_cpu(services.cpu),
+        m_changes(services.changes),
+        m_replica(services.replica)
     {
+        ++s_active;
     }
 
     ~Session()
     {
+        --s_active;
     }
 
-    bool                             m_close{};
-    tcp::socket                      m_socket;
-    beast::flat_buffer               m_buffer;
-    Comics::ComicDb                 &m_db;
-    http::request<http::string_body> m_req;
+    static std::atomic<std::size_t> s_active;
+
+    bool                                                   m_close{};
+    beast::tcp_stream                                      m_stream;
+    beast::basic_flat_buffer<pool_memory::pool_allocator<char>> m_buffer;
+    Comics::ComicDb                                       &m_db;
+    promise::work_stealing_pool                           &m_cpu;
+    ChangeFeed                                            &m_changes;
+    const Replica                                         *m_replica;
+    std::optional<http::request_parser<http::string_body>> m_parser;
+    http::request<http::string_body>                       m_req;
 };
 
+std::atomic<std::size_t> Session::s_active{};
+
 // Promisified functions
 static promise::Promise asyncAccept(tcp::acceptor &acceptor)
 {
     return promise::newPromise(
         [&](promise::Defer &defer)
         {
-            // Look up the domain name
-            auto socket =
-                std::make_shared<tcp::socket>(static_cast<asio::io_context &>(acceptor.get_executor().context()));
+            // Each session gets its own strand, as the io_context may be run by several threads
+            // Sockets, sessions and messages come from per thread pools so steady state
+            // connections reuse the blocks of earlier ones instead of the heap
+            auto socket = std::allocate_shared<tcp::socket>(pool_memory::pool_allocator<tcp::socket>{},
+                                                            asio::make_strand(acceptor.get_executor()));
             acceptor.async_accept(*socket, [=](error_code err) { setPromise(defer, err, "resolve", socket); });
         });
 }
 
 // Returns a bad request response
-Response badRequest(std::shared_ptr<Session> session, beast::string_view why)
-{
-    http::response<http::string_body> res{http::status::bad_request, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/html");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = why;
-    res.prepare_payload();
-    return res;
+Response badRequest(std::shared_ptr<Session> session, Error why)
+{
+    return Response::error(why, session->m_req.version(), session->m_req.keep_alive());
 };
 
 // Returns a not found response
 Response notFound(std::shared_ptr<Session> session)
 {
-    http::response<http::string_body> res{http::status::not_found, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/html");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = "The resource '" + std::string{session->m_req.target()} + "' was not found.";
-    res.prepare_payload();
-    return res;
+    return Response::error(Error::NotFound, session->m_req.version(), session->m_req.keep_alive());
 };
 
 // Returns a server error response
-Response serverError(std::shared_ptr<Session> session, beast::string_view what)
-{
-    http::response<http::string_body> res{http::status::internal_server_error, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/html");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = "An error occurred: '" + std::string{what} + "'";
-    res.prepare_payload();
-    return res;
+Response serverError(std::shared_ptr<Session> session)
+{
+    return Response::error(Error::InternalError, session->m_req.version(), session->m_req.keep_alive());
+};
+
+// Returns a payload too large response
+Response payloadTooLarge(std::shared_ptr<Session> session)
+{
+    return Response::error(Error::PayloadTooLarge, session->m_req.version(), session->m_req.keep_alive());
 };
 
+// Returns the response to writes sent to a replica
+Response readOnly(std::shared_ptr<Session> session)
+{
+    return Response::error(Error::ReadOnly, session->m_req.version(), session->m_req.keep_alive());
+};
+
+// Returns the response to conditional writes of a comic that has changed
+Response preconditionFailed(std::shared_ptr<Session> session)
+{
+    return Response::error(Error::PreconditionFailed, session->m_req.version(), session->m_req.keep_alive());
+};
+
+// Returns the response to renaming a person to the name of another
+Response conflict(std::shared_ptr<Session> session)
+{
+    return Response::error(Error::Conflict, session->m_req.version(), session->m_req.keep_alive());
+};
+
+// Returns true if text is a decimal number that fits in value, setting
+// value to it
+template <typename Number>
+static bool parseDecimal(const std::string &text, Number &value)
+{
+    const char *const end = text.data() + text.size();
+    auto [last, err] = std::from_chars(text.data(), end, value);
+    return err == std::errc{} && last == end;
+}
+
+// Returns true if the request is conditional on the version of the comic,
+// setting version to the one in its If-Match field. "*" matches any
+// version; a field that names no version of ours, or one too large to
+// be one, never matches.
+static bool ifMatch(const http::request<http::string_body> &req, std::uint64_t &version)
+{
+    auto it = req.find(http::field::if_match);
+    if (it == req.end() || it->value() == "*")
+    {
+        return false;
+    }
+    static const std::regex matchesEtag("^\\s*(W/)?\"([0-9]+)\"\\s*$");
+    const std::string       etag{it->value()};
+    std::smatch             parts;
+    if (!std::regex_match(etag, parts, matchesEtag) || !parseDecimal(parts[2].str(), version))
+    {
+        version = Comics::NO_VERSION;
+    }
+    return true;
+}
+
 Response deleteComicResponse(std::shared_ptr<Session> session, int id)
 {
     std::cout << "Delete comic " << id << '\n';
-    deleteComic(session->m_db, id);
-    Response res{http::status::ok, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "text/plain");
-    res.keep_alive(session->m_req.keep_alive());
+    std::uint64_t version{};
+    if (ifMatch(session->m_req, version))
+    {
+        COMICS_TRACE_SCOPE("db");
+        if (deleteComicIfVersion(session->m_db, id, version) == Comics::NO_VERSION)
+        {
+            return preconditionFailed(session);
+        }
+    }
+    else
+    {
+        COMICS_TRACE_SCOPE("db");
+        deleteComic(session->m_db, id);
+    }
+    Response res{ContentType::Text, session->m_req.version(), session->m_req.keep_alive()};
     res.body() = "Comic " + std::to_string(id) + " deleted.";
-    res.prepare_payload();
     return res;
 }
 
 Response readComicResponse(std::shared_ptr<Session> session, int id)
 {
     std::cout << "Read comic " << id << '\n';
-    Comics::Comic comic = Comics::readComic(session->m_db, id);
-    Response      res{http::status::ok, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "application/json");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = toJson(comic);
-    res.prepare_payload();
+    Comics::VersionedComic comic;
+    {
+        COMICS_TRACE_SCOPE("db");
+        comic = Comics::readVersionedComic(session->m_db, id);
+    }
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    {
+        COMICS_TRACE_SCOPE("toJson");
+        res.body() = toJson(comic.comic);
+    }
+    res.etag(comic.version);
     return res;
 }
 
 Response createComicResponse(std::shared_ptr<Session> session)
 {
-    const std::string json = session->m_req.body();
+    const std::string &json = session->m_req.body();
     std::cout << "Create comic: " << json << '\n';
-    Comics::Comic comic = Comics::fromJson(json);
-    Response      res{http::status::ok, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "application/json");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = toJson(comic);
-    res.prepare_payload();
+    Comics::Comic comic;
+    {
+        COMICS_TRACE_SCOPE("fromJson");
+        comic = Comics::fromJson(json);
+    }
+    {
+        COMICS_TRACE_SCOPE("db");
+        createComic(session->m_db, Comics::Comic{comic});
+    }
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    {
+        COMICS_TRACE_SCOPE("toJson");
+        res.body() = toJson(comic);
+    }
     return res;
 }
 
 Response updateComicResponse(std::shared_ptr<Session> session, int id)
 {
-    const std::string json = session->m_req.body();
+    const std::string &json = session->m_req.body();
     std::cout << "Update comic " << id << " to " << json << '\n';
-    Comics::Comic comic = Comics::fromJson(json);
-    updateComic(session->m_db, id, comic);
-    Response res{http::status::ok, session->m_req.version()};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "application/json");
-    res.keep_alive(session->m_req.keep_alive());
-    res.body() = toJson(comic);
-    res.prepare_payload();
+    Comics::Comic comic;
+    {
+        COMICS_TRACE_SCOPE("fromJson");
+        comic = Comics::fromJson(json);
+    }
+    std::uint64_t version{};
+    if (ifMatch(session->m_req, version))
+    {
+        COMICS_TRACE_SCOPE("db");
+        version = updateComicIfVersion(session->m_db, id, comic, version);
+        if (version == Comics::NO_VERSION)
+        {
+            return preconditionFailed(session);
+        }
+    }
+    else
+    {
+        COMICS_TRACE_SCOPE("db");
+        updateComic(session->m_db, id, comic);
+    }
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    {
+        COMICS_TRACE_SCOPE("toJson");
+        res.body() = toJson(comic);
+    }
+    if (version != Comics::NO_VERSION)
+    {
+        res.etag(version);
+    }
     return res;
 }
 
-// This function produces an HTTP response for the given
-// request. The type of the response object depends on the
-// contents of the request, so the interface requires the
-// caller to pass a generic lambda for receiving the response.
-template <class Send>
-promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
+// Applies the mutations in the body all together, or answers 412 without
+// applying any when one of their versions no longer matches
+Response transactionResponse(std::shared_ptr<Session> session)
+{
+    const std::string &json = session->m_req.body();
+    std::cout << "Transaction: " << json << '\n';
+    Comics::Transaction transaction;
+    {
+        COMICS_TRACE_SCOPE("fromJson");
+        transaction = Comics::transactionFromJson(json);
+    }
+    Comics::TransactionResult result;
+    {
+        COMICS_TRACE_SCOPE("db");
+        result = commitTransaction(session->m_db, transaction);
+    }
+    if (result.version == Comics::NO_VERSION)
+    {
+        return preconditionFailed(session);
+    }
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    {
+        COMICS_TRACE_SCOPE("toJson");
+        res.body() = toJson(result);
+    }
+    res.etag(result.version);
+    return res;
+}
+
+Response personCreditsResponse(std::shared_ptr<Session> session, const Comics::PersonCredits &credits)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    COMICS_TRACE_SCOPE("toJson");
+    res.body() = toJson(credits);
+    return res;
+}
+
+Response personResponse(std::shared_ptr<Session> session, const std::string &name)
+{
+    Comics::PersonCredits credits;
+    try
+    {
+        COMICS_TRACE_SCOPE("db");
+        credits = Comics::personCredits(session->m_db, name);
+    }
+    catch (const std::runtime_error &)
+    {
+        return notFound(session);
+    }
+    return personCreditsResponse(session, credits);
+}
+
+// Renames the person named in the body's name member to its newName
+Response renamePersonResponse(std::shared_ptr<Session> session)
+{
+    const std::string &json = session->m_req.body();
+    std::cout << "Rename person: " << json << '\n';
+    std::map<std::string, std::string> names;
+    {
+        COMICS_TRACE_SCOPE("fromJson");
+        names = Comics::stringsFromJson(json);
+    }
+    const Comics::PersonPtr person = Comics::lookupPerson(names["name"]);
+    const Comics::PersonPtr other = Comics::lookupPerson(names["newName"]);
+    if (person && other && &person->canonical() != &other->canonical())
+    {
+        return conflict(session);
+    }
+    Comics::PersonCredits credits;
+    {
+        COMICS_TRACE_SCOPE("db");
+        Comics::renamePerson(session->m_db, names["name"], names["newName"]);
+        credits = Comics::personCredits(session->m_db, names["newName"]);
+    }
+    return personCreditsResponse(session, credits);
+}
+
+// Merges the person named in the body's from member into the one named in its into member
+Response mergePersonsResponse(std::shared_ptr<Session> session)
+{
+    const std::string &json = session->m_req.body();
+    std::cout << "Merge persons: " << json << '\n';
+    std::map<std::string, std::string> names;
+    {
+        COMICS_TRACE_SCOPE("fromJson");
+        names = Comics::stringsFromJson(json);
+    }
+    Comics::PersonCredits credits;
+    {
+        COMICS_TRACE_SCOPE("db");
+        Comics::mergePersons(session->m_db, names["from"], names["into"]);
+        credits = Comics::personCredits(session->m_db, names["into"]);
+    }
+    return personCreditsResponse(session, credits);
+}
+
+Response cpuPoolMetricsResponse(std::shared_ptr<Session> session)
+{
+    const promise::work_stealing_pool::stats stats = session->m_cpu.statistics();
+    std::string                              depths;
+    for (std::size_t depth : stats.queue_depths)
+    {
+        depths += (depths.empty() ? "" : ",") + std::to_string(depth);
+    }
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    res.body() = "{\"threads\":" + std::to_string(stats.threads) + ",\"queued\":" + std::to_string(stats.queued) +
+                 ",\"highWater\":" + std::to_string(stats.high_water) + ",\"executed\":" +
+                 std::to_string(stats.executed) + ",\"stolen\":" + std::to_string(stats.stolen) +
+                 ",\"queueDepths\":[" + depths + "]}";
+    return res;
+}
+
+Response snapshotResponse(std::shared_ptr<Session> session)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    res.body() = toJson(Comics::snapshot(session->m_db));
+    return res;
+}
+
+Response changesResponse(std::shared_ptr<Session> session, std::uint64_t since)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    res.body() = toJson(Comics::changesSince(session->m_db, since, CHANGE_BATCH_LIMIT));
+    return res;
+}
+
+Response deltaResponse(std::shared_ptr<Session> session, std::uint64_t since)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    Comics::Delta delta;
+    {
+        COMICS_TRACE_SCOPE("db");
+        delta = Comics::changedSince(session->m_db, since);
+    }
+    {
+        COMICS_TRACE_SCOPE("toJson");
+        res.body() = toJson(delta);
+    }
+    res.etag(delta.version);
+    return res;
+}
+
+Response replicationMetricsResponse(std::shared_ptr<Session> session)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    if (session->m_replica == nullptr)
+    {
+        res.body() = "{\"role\":\"primary\",\"sequence\":" + std::to_string(Comics::lastSequence(session->m_db)) + "}";
+        return res;
+    }
+    const Replica::Status status = session->m_replica->status();
+    res.body() = "{\"role\":\"replica\",\"primary\":\"" + session->m_replica->primary() +
+                 "\",\"connected\":" + (status.connected ? "true" : "false") +
+                 ",\"primarySequence\":" + std::to_string(status.primarySequence) +
+                 ",\"appliedSequence\":" + std::to_string(status.appliedSequence) +
+                 ",\"lagSequences\":" + std::to_string(status.primarySequence > status.appliedSequence
+                                                              ? status.primarySequence - status.appliedSequence
+                                                              : 0) +
+                 ",\"applyDelayMs\":" + std::to_string(status.applyDelayMs) +
+                 ",\"resyncs\":" + std::to_string(status.resyncs) + "}";
+    return res;
+}
+
+#if defined(COMICS_SERVER_TRACING)
+Response traceResponse(std::shared_ptr<Session> session)
+{
+    Response res{ContentType::Json, session->m_req.version(), session->m_req.keep_alive()};
+    res.body() = trace::dumpChromeTrace();
+    return res;
+}
+#endif
+
+// Returns the gzip encoding of the body, compressing each distinct body only once,
+// or null if it could not be compressed. Cached encodings are shared with the
+// responses that write them; the least recently used go once the cache is full.
+static std::shared_ptr<const std::string> compressedBody(const std::string &body)
+{
+    struct Cached
+    {
+        std::shared_ptr<const std::string>       encoding;
+        std::list<const std::string *>::iterator use;
+    };
+    static std::mutex                              mutex;
+    static std::unordered_map<std::string, Cached> compressed;
+    static std::list<const std::string *>          uses; // bodies in compressed, most recently used first
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto                         it = compressed.find(body);
+        if (it != compressed.end())
+        {
+            uses.splice(uses.begin(), uses, it->second.use);
+            return it->second.encoding;
+        }
+    }
+
+    boost::beast::error_code ec;
+    std::string              encoding = http_encoding::gzip(body, ec);
+    if (ec)
+    {
+        return nullptr;
+    }
+    auto                         result = std::make_shared<const std::string>(std::move(encoding));
+    std::unique_lock<std::mutex> lock(mutex);
+    auto [it, inserted] = compressed.emplace(body, Cached{result, {}});
+    if (!inserted)
+    {
+        return it->second.encoding;
+    }
+    uses.push_front(&it->first);
+    it->second.use = uses.begin();
+    if (compressed.size() > MAX_COMPRESSED_BODIES)
+    {
+        compressed.erase(compressed.find(*uses.back()));
+        uses.pop_back();
+    }
+    return result;
+}
+
+// Compresses the body when the client accepts gzip and the body is large enough.
+// Whether it does depends on Accept-Encoding, so the response says so either way.
+static void encodeResponse(const http::request<http::string_body> &req, Response &res)
+{
+    res.varyEncoding();
+    if (res.body().size() < MIN_COMPRESS_SIZE ||
+        http_encoding::accepts_encoding(req[http::field::accept_encoding], "gzip") <= 0)
+    {
+        return;
+    }
+    if (auto encoding = compressedBody(res.body()))
+    {
+        res.sharedBody(std::move(encoding));
+        res.contentEncoding("gzip");
+    }
+}
+
+// Returns true for a delta sync request, setting since to the version
+// the reader has; a reader without one asks for every comic. A since too
+// large for a version leaves the request to the rest of buildResponse,
+// which answers it as a malformed URI.
+static bool isDeltaRequest(const http::request<http::string_body> &req, std::uint64_t &since)
 {
+    static const std::regex matchesDelta("^/comics(\\?since=([0-9]+))?$");
+    if (req.method() != http::verb::get)
+    {
+        return false;
+    }
+    const std::string path{req.target()};
+    std::smatch       parts;
+    if (!std::regex_match(path, parts, matchesDelta))
+    {
+        return false;
+    }
+    since = 0;
+    return !parts[2].matched || parseDecimal(parts[2].str(), since);
+}
+
+// Returns the percent-decoding of a query parameter value, in which a
+// plus also stands for a space
+static std::string percentDecode(const std::string &value)
+{
+    std::string decoded;
+    for (std::size_t i = 0; i < value.size(); ++i)
+    {
+        if (value[i] == '%' && i + 2 < value.size() && std::isxdigit(static_cast<unsigned char>(value[i + 1])) &&
+            std::isxdigit(static_cast<unsigned char>(value[i + 2])))
+        {
+            decoded += static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        }
+        else
+        {
+            decoded += value[i] == '+' ? ' ' : value[i];
+        }
+    }
+    return decoded;
+}
+
+// Returns true for a request for the comics crediting a person, setting
+// name to the person's name
+static bool isPersonRequest(const http::request<http::string_body> &req, std::string &name)
+{
+    static const std::regex matchesPerson("^/person\\?name=([^&]+)$");
+    if (req.method() != http::verb::get)
+    {
+        return false;
+    }
+    const std::string path{req.target()};
+    std::smatch       parts;
+    if (!std::regex_match(path, parts, matchesPerson))
+    {
+        return false;
+    }
+    name = percentDecode(parts[1]);
+    return true;
+}
+
+// Returns the HTTP response for the session's request
+static Response buildResponse(std::shared_ptr<Session> session)
+{
+    COMICS_TRACE_SCOPE("handleRequest");
+
     // Make sure we can handle the method
     bool             requiresId{};
     const http::verb method = session->m_req.method();
+    if (method == http::verb::get && session->m_req.target() == "/metrics/cpu-pool")
+    {
+        return cpuPoolMetricsResponse(session);
+    }
+    if (method == http::verb::get && session->m_req.target() == "/metrics/replication")
+    {
+        return replicationMetricsResponse(session);
+    }
+    if (method == http::verb::get && session->m_req.target() == "/replication/snapshot")
+    {
+        return snapshotResponse(session);
+    }
+    std::uint64_t since{};
+    if (isDeltaRequest(session->m_req, since))
+    {
+        Response res = deltaResponse(session, since);
+        encodeResponse(session->m_req, res);
+        return res;
+    }
+    std::string person;
+    if (isPersonRequest(session->m_req, person))
+    {
+        Response res = personResponse(session, person);
+        encodeResponse(session->m_req, res);
+        return res;
+    }
+    if (session->m_replica != nullptr && method != http::verb::get)
+    {
+        return readOnly(session);
+    }
+#if defined(COMICS_SERVER_TRACING)
+    if (method == http::verb::get && session->m_req.target() == "/trace")
+    {
+        return traceResponse(session);
+    }
+#endif
     switch (method)
     {
     case http::verb::delete_:
@@ -171,7 +657,7 @@ promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
         break;
 
     default:
-        return send(badRequest(session, "Unknown HTTP-method"));
+        return badRequest(session, Error::UnknownMethod);
     }
 
     int id{-1};
@@ -180,11 +666,10 @@ promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
         static const std::regex matchesId("^/comic/([0-9]+)$");
         const std::string       path{session->m_req.target()};
         std::smatch             parts;
-        if (!std::regex_match(path, parts, matchesId))
+        if (!std::regex_match(path, parts, matchesId) || !parseDecimal(parts[1].str(), id))
         {
-            return send(badRequest(session, "Malformed URI"));
+            return badRequest(session, Error::MalformedUri);
         }
-        id = std::stoi(parts[1]);
     }
 
     Response res;
@@ -208,7 +693,14 @@ promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
             break;
 
         case http::verb::post:
-            res = createComicResponse(session);
+            if (session->m_req.target() == "/transaction")
+                res = transactionResponse(session);
+            else if (session->m_req.target() == "/person/rename")
+                res = renamePersonResponse(session);
+            else if (session->m_req.target() == "/person/merge")
+                res = mergePersonsResponse(session);
+            else
+                res = createComicResponse(session);
             break;
 
         default:
@@ -217,14 +709,100 @@ promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
     }
     catch (const std::runtime_error &bang)
     {
-        return send(notFound(session));
+        return notFound(session);
     }
     catch (...)
     {
-        return send(serverError(session, "Internal error"));
+        return serverError(session);
     }
 
-    return send(std::move(res));
+    encodeResponse(session->m_req, res);
+    return res;
+}
+
+// Returns true if building the response is worth moving off the I/O thread
+static bool shouldOffload(const http::request<http::string_body> &req)
+{
+    return req.body().size() >= OFFLOAD_BODY_SIZE;
+}
+
+// Returns true for a change feed request, setting since to the sequence
+// number of the last change the reader has. A since too large for a
+// sequence number leaves the request to buildResponse, which answers it
+// as a malformed URI.
+static bool isChangesRequest(const http::request<http::string_body> &req, std::uint64_t &since)
+{
+    static const std::regex matchesChanges("^/replication/changes\\?since=([0-9]+)$");
+    if (req.method() != http::verb::get)
+    {
+        return false;
+    }
+    const std::string path{req.target()};
+    std::smatch       parts;
+    return std::regex_match(path, parts, matchesChanges) && parseDecimal(parts[1].str(), since);
+}
+
+// Returns true if the response is built by asyncResponse()
+static bool isAsync(const http::request<http::string_body> &req)
+{
+    std::uint64_t since{};
+    return isChangesRequest(req, since) || shouldOffload(req);
+}
+
+// Builds the response on the CPU pool; the returned promise resolves
+// with it on the session's strand. An exception thrown while building
+// it is answered with a server error, as the session only handles
+// responses.
+static promise::Promise offloadResponse(std::shared_ptr<Session> session)
+{
+    return promise::offload(session->m_cpu, session->m_stream.get_executor(),
+                            [session]
+                            {
+                                try
+                                {
+                                    return buildResponse(session);
+                                }
+                                catch (...)
+                                {
+                                    return serverError(session);
+                                }
+                            });
+}
+
+// Returns changes after since once there are some, or none after
+// CHANGE_POLL_TIMEOUT; the promise resolves on the session's strand.
+static promise::Promise longPollChanges(std::shared_ptr<Session> session, std::uint64_t since)
+{
+    if (Comics::lastSequence(session->m_db) > since)
+    {
+        return promise::resolve(changesResponse(session, since));
+    }
+    return session->m_changes.wait(session->m_stream.get_executor(), since, CHANGE_POLL_TIMEOUT)
+        .then([session, since]() { return changesResponse(session, since); });
+}
+
+// Returns a promise resolved with the response for requests
+// that cannot, or should not, be answered right away.
+static promise::Promise asyncResponse(std::shared_ptr<Session> session)
+{
+    std::uint64_t since{};
+    if (isChangesRequest(session->m_req, since))
+    {
+        return longPollChanges(session, since);
+    }
+    return offloadResponse(session);
+}
+
+// This function sends the HTTP response for the given
+// request through the caller's send function object.
+template <class Send>
+promise::Promise handleRequest(std::shared_ptr<Session> session, Send &&send)
+{
+    if (!isAsync(session->m_req))
+    {
+        return send(buildResponse(session));
+    }
+    return asyncResponse(session).then([session, send](Response &res) { return send(std::move(res)); });
 }
 
 // Report a failure
@@ -234,8 +812,7 @@ static int fail(error_code ec, char const *what)
     return EXIT_FAILURE;
 }
 
-// This is the C++11 equivalent of a generic lambda.
-// The function object is used to send an HTTP message.
+// The function object is used to send an HTTP response.
 template <class Stream>
 struct SendLambda
 {
@@ -245,19 +822,22 @@ struct SendLambda
     {
     }
 
-    template <bool isRequest, class Body, class Fields>
-    promise::Promise operator()(http::message<isRequest, Body, Fields> &&msg) const
+    promise::Promise operator()(Response &&res) const
     {
         // Determine if we should close the connection after
-        m_close = msg.need_eof();
-        // The lifetime of the message has to extend
+        m_close = !res.keepAlive();
+        // The lifetime of the response has to extend
         // for the duration of the async operation so
         // we use a shared_ptr to manage it.
-        auto sp = std::make_shared<http::message<isRequest, Body, Fields>>(std::move(msg));
-        return promise::async_write(m_stream, *sp)
+        auto sp = std::allocate_shared<Response>(pool_memory::pool_allocator<Response>{}, std::move(res));
+        m_stream.expires_after(WRITE_TIMEOUT);
+        COMICS_TRACE_BEGIN(writeBegin);
+        // Header block, fields and body go out in one gathered write, without being copied together
+        return promise::async_write_buffers(m_stream, sp->buffers())
             .finally(
-                [sp]()
+                [sp COMICS_TRACE_CAPTURE(writeBegin)]()
                 {
+                    COMICS_TRACE_END("async_write", writeBegin);
                     // sp will not be deleted util finally() called
                 });
     }
@@ -267,6 +847,124 @@ private:
     bool   &m_close;
 };
 
+// Returns the largest body the route for this request accepts
+static std::uint64_t bodyLimit(const http::request_header<> &header)
+{
+    switch (header.method())
+    {
+    case http::verb::post:
+        return header.target() == "/transaction" ? MAX_TRANSACTION_BODY_SIZE : MAX_COMIC_BODY_SIZE;
+    case http::verb::put:
+        return MAX_COMIC_BODY_SIZE;
+
+    default:
+        return 0;
+    }
+}
+
+// Reads the request header first so that the body limit for the route
+// is enforced before any of the body is buffered.
+promise::Promise readRequest(std::shared_ptr<Session> session)
+{
+    session->m_parser.emplace();
+    session->m_stream.expires_after(IDLE_TIMEOUT);
+    return promise::async_read_header(session->m_stream, session->m_buffer, *session->m_parser)
+        .then(
+            [=]()
+            {
+                const std::uint64_t                  limit = bodyLimit(session->m_parser->get());
+                const boost::optional<std::uint64_t> length = session->m_parser->content_length();
+                if (length && *length > limit)
+                {
+                    return promise::reject(error_code{http::error::body_limit});
+                }
+                // Chunked bodies are cut off by the parser once they exceed the limit
+                session->m_parser->body_limit(limit);
+                session->m_stream.expires_after(READ_TIMEOUT);
+                return promise::async_read(session->m_stream, session->m_buffer, *session->m_parser);
+            })
+        .then([=]() { session->m_req = session->m_parser->release(); });
+}
+
+#if defined(COMICS_SERVER_COROUTINES)
+// Handles an HTTP server connection as one coroutine, whose frame
+// holds the state the promise-based version keeps in promise nodes
+promise::Promise handleSession(std::shared_ptr<Session> session)
+{
+    for (;;)
+    {
+        //<1> Read a request, the header first so that the body limit
+        // for the route is enforced before any of the body is buffered
+        session->m_req = {};
+        session->m_parser.emplace();
+        session->m_stream.expires_after(IDLE_TIMEOUT);
+        COMICS_TRACE_BEGIN(readBegin);
+        auto [err, headerBytes] =
+            co_await promise::typed::async_read_header(session->m_stream, session->m_buffer, *session->m_parser);
+        if (!err)
+        {
+            const std::uint64_t                  limit = bodyLimit(session->m_parser->get());
+            const boost::optional<std::uint64_t> length = session->m_parser->content_length();
+            if (length && *length > limit)
+            {
+                err = http::error::body_limit;
+            }
+            else
+            {
+                // Chunked bodies are cut off by the parser once they exceed the limit
+                session->m_parser->body_limit(limit);
+                session->m_stream.expires_after(READ_TIMEOUT);
+                auto [bodyErr, bodyBytes] =
+                    co_await promise::typed::async_read(session->m_stream, session->m_buffer, *session->m_parser);
+                err = bodyErr;
+            }
+        }
+
+        //<2> Build the response
+        Response res;
+        if (!err)
+        {
+            COMICS_TRACE_END("async_read", readBegin);
+            session->m_req = session->m_parser->release();
+            if (isAsync(session->m_req))
+            {
+                res = co_await promise::as_awaitable<Response>(asyncResponse(session));
+            }
+            else
+            {
+                res = buildResponse(session);
+            }
+        }
+        else if (err == http::error::body_limit)
+        {
+            // Reject the oversized body; the unread remainder
+            // of it means the connection has to be closed.
+            session->m_req.base() = session->m_parser->get().base();
+            session->m_req.keep_alive(false);
+            res = payloadTooLarge(session);
+        }
+        else
+        {
+            break;
+        }
+
+        //<3> Send the response
+        session->m_close = !res.keepAlive();
+        session->m_stream.expires_after(WRITE_TIMEOUT);
+        COMICS_TRACE_BEGIN(writeBegin);
+        auto [writeErr, writeBytes] = co_await promise::typed::async_write_buffers(session->m_stream, res.buffers());
+        COMICS_TRACE_END("async_write", writeBegin);
+
+        //<4> Keep-alive or close the connection.
+        if (writeErr || session->m_close)
+        {
+            break;
+        }
+    }
+    error_code err;
+    session->m_stream.socket().shutdown(tcp::socket::shutdown_send, err);
+}
+#else
 // Handles an HTTP server connection
 void handleSession(std::shared_ptr<Session> session)
 {
@@ -275,14 +973,29 @@ void handleSession(std::shared_ptr<Session> session)
         {
             //<1> Read a request
             session->m_req = {};
-            promise::async_read(session->m_socket, session->m_buffer, session->m_req)
+            COMICS_TRACE_BEGIN(readBegin);
+            readRequest(session)
                 .then(
                     [=]()
                     {
+                        COMICS_TRACE_END("async_read", readBegin);
                         //<2> Send the response
                         // This lambda is used to send messages
-                        SendLambda<tcp::socket> lambda{session->m_socket, session->m_close};
+                        SendLambda<beast::tcp_stream> lambda{session->m_stream, session->m_close};
                         return handleRequest(session, lambda);
+                    },
+                    [=](const boost::system::error_code err)
+                    {
+                        if (err != http::error::body_limit)
+                        {
+                            return promise::reject(err);
+                        }
+                        //<2> Reject the oversized body; the unread remainder
+                        // of it means the connection has to be closed.
+                        session->m_req.base() = session->m_parser->get().base();
+                        session->m_req.keep_alive(false);
+                        SendLambda<beast::tcp_stream> lambda{session->m_stream, session->m_close};
+                        return lambda(payloadTooLarge(session));
                     })
                 .then(
                     []()
@@ -305,15 +1018,18 @@ void handleSession(std::shared_ptr<Session> session)
                         }
                         else
                         {
-                            session->m_socket.shutdown(tcp::socket::shutdown_send, err);
+                            session->m_stream.socket().shutdown(tcp::socket::shutdown_send, err);
                             loop.doBreak(); // break from doWhile
                         }
                     });
         });
 }
+#endif
 
-// Accepts incoming connections and launches the sessions
-static int listenForConnections(asio::io_context &ioc, tcp::endpoint endpoint, Comics::ComicDb &db)
+// Opens an acceptor listening on the endpoint; returns null on failure.
+// With reusePort several acceptors may listen on the same port and the
+// kernel load balances new connections between them.
+static std::shared_ptr<tcp::acceptor> openAcceptor(asio::io_context &ioc, tcp::endpoint endpoint, bool reusePort)
 {
     error_code ec;
 
@@ -321,63 +1037,213 @@ static int listenForConnections(asio::io_context &ioc, tcp::endpoint endpoint, C
     auto acceptor = std::make_shared<tcp::acceptor>(ioc);
     acceptor->open(endpoint.protocol(), ec);
     if (ec)
-        return fail(ec, "open");
+    {
+        fail(ec, "open");
+        return nullptr;
+    }
 
     // Allow address reuse
-    acceptor->set_option(socket_base::reuse_address(true));
+    acceptor->set_option(socket_base::reuse_address(true), ec);
     if (ec)
-        return fail(ec, "set_option");
+    {
+        fail(ec, "set_option");
+        return nullptr;
+    }
+
+    // Allow other acceptors on the same port
+    if (reusePort)
+    {
+#if defined(SO_REUSEPORT)
+        acceptor->set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true), ec);
+#else
+        ec = asio::error::operation_not_supported;
+#endif
+        if (ec)
+        {
+            fail(ec, "set_option SO_REUSEPORT");
+            return nullptr;
+        }
+    }
 
     // Bind to the server address
     acceptor->bind(endpoint, ec);
     if (ec)
-        return fail(ec, "bind");
+    {
+        fail(ec, "bind");
+        return nullptr;
+    }
 
     // Start listening for connections
     acceptor->listen(socket_base::max_listen_connections, ec);
     if (ec)
-        return fail(ec, "listen");
+    {
+        fail(ec, "listen");
+        return nullptr;
+    }
 
-    std::cout << "Listening for connections on " << endpoint << '\n';
+    return acceptor;
+}
 
+// Accepts incoming connections and launches the sessions
+// on the acceptor's io_context.
+static void acceptConnections(std::shared_ptr<tcp::acceptor> acceptor, Services &services)
+{
     promise::doWhile(
-        [acceptor, &db](promise::DeferLoop &loop)
+        [acceptor, &services](promise::DeferLoop &loop)
         {
             asyncAccept(*acceptor)
                 .then(
                     [&](std::shared_ptr<tcp::socket> socket)
                     {
-                        auto session = std::make_shared<Session>(*socket, db);
+                        if (Session::s_active >= MAX_CONNECTIONS)
+                        {
+                            error_code ec;
+                            socket->close(ec);
+                            return;
+                        }
+                        auto session = std::allocate_shared<Session>(pool_memory::pool_allocator<Session>{}, *socket, services);
                         handleSession(session);
                     })
                 .fail([](const error_code err) {})
                 .then(loop);
         });
+}
 
+// Runs one acceptor on an io_context shared by all threads
+static int listenForConnections(tcp::endpoint endpoint, Services &services, int threads)
+{
+    asio::io_context ioc{threads};
+
+    auto acceptor = openAcceptor(ioc, endpoint, false);
+    if (!acceptor)
+        return EXIT_FAILURE;
+
+    std::cout << "Listening for connections on " << endpoint << '\n';
+    acceptConnections(acceptor, services);
+
+    std::vector<std::thread> v;
+    v.reserve(threads - 1);
+    for (int i = threads - 1; i > 0; --i)
+        v.emplace_back([&ioc] { ioc.run(); });
     ioc.run();
+    for (std::thread &t : v)
+        t.join();
 
     return EXIT_SUCCESS;
 }
 
+// Restricts the calling thread to a single core
+static void pinToCore(int core)
+{
+#if defined(__linux__)
+    const unsigned cores = std::max(1U, std::thread::hardware_concurrency());
+    cpu_set_t      cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(core % cores, &cpus);
+    if (const int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus))
+        fail(error_code{err, boost::system::system_category()}, "pthread_setaffinity_np");
+#else
+    boost::ignore_unused(core);
+#endif
+}
+
+// Runs an io_context, acceptor and thread per core.  A session stays on the
+// thread that accepted it, so completions are never handed across cores.
+static int listenPerCore(tcp::endpoint endpoint, Services &services, int threads, bool pinThreads)
+{
+    std::vector<std::unique_ptr<asio::io_context>> contexts;
+    for (int i = 0; i < threads; ++i)
+    {
+        contexts.push_back(std::make_unique<asio::io_context>(1));
+        auto acceptor = openAcceptor(*contexts.back(), endpoint, true);
+        if (!acceptor)
+            return EXIT_FAILURE;
+        acceptConnections(acceptor, services);
+    }
+
+    std::cout << "Listening for connections on " << endpoint << " with " << threads << " acceptors\n";
+
+    std::vector<std::thread> v;
+    v.reserve(threads);
+    for (int i = 0; i < threads; ++i)
+        v.emplace_back(
+            [&contexts, i, pinThreads]
+            {
+                if (pinThreads)
+                    pinToCore(i);
+                contexts[i]->run();
+            });
+    for (std::thread &t : v)
+        t.join();
+
+    return EXIT_SUCCESS;
+}
+
+static int usage(const char *program)
+{
+    std::cerr << "Usage: " << program
+              << " <address> <port> <threads> [--per-core [--pin]] [--cpu-threads <n>] [--replica-of <host>:<port>]\n"
+              << "Example:\n"
+              << "    " << program << " 0.0.0.0 8080 1\n"
+              << "    --per-core     run an SO_REUSEPORT acceptor and io_context per thread\n"
+              << "    --pin          pin each per-core thread to its own CPU\n"
+              << "    --cpu-threads  threads offloaded request handling runs on, default one per core\n"
+              << "    --replica-of   serve reads from a copy of the primary at <host>:<port>, kept current\n"
+              << "                   from its change feed\n";
+    return EXIT_FAILURE;
+}
+
 static int run(int argc, char *argv[])
 {
     // Check command line arguments.
-    if (argc != 4)
+    if (argc < 4)
     {
-        std::cerr << "Usage: " << argv[0] << " <address> <port> <threads>\n"
-                  << "Example:\n"
-                  << "    " << argv[0] << " 0.0.0.0 8080 1\n";
-        return EXIT_FAILURE;
+        return usage(argv[0]);
     }
     auto const address = ip::make_address(argv[1]);
     auto const port = static_cast<unsigned short>(std::atoi(argv[2]));
     auto const threads = std::max<int>(1, std::atoi(argv[3]));
+    bool       perCore{};
+    bool       pinThreads{};
+    int        cpuThreads = static_cast<int>(std::thread::hardware_concurrency());
+    std::string primary;
+    for (int i = 4; i < argc; ++i)
+    {
+        const std::string arg{argv[i]};
+        if (arg == "--per-core")
+            perCore = true;
+        else if (arg == "--pin")
+            pinThreads = true;
+        else if (arg == "--cpu-threads" && i + 1 < argc)
+            cpuThreads = std::atoi(argv[++i]);
+        else if (arg == "--replica-of" && i + 1 < argc)
+            primary = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+    const std::string::size_type colon = primary.rfind(':');
+    if ((pinThreads && !perCore) || (!primary.empty() && (colon == std::string::npos || colon == 0)))
+    {
+        return usage(argv[0]);
+    }
 
-    asio::io_context ioc{threads};
-
-    Comics::ComicDb db = Comics::load();
+    // A replica starts out empty and restores the primary's snapshot
+    Comics::ComicDb             db = primary.empty() ? Comics::load() : Comics::ComicDb{};
+    promise::work_stealing_pool cpu{static_cast<std::size_t>(std::max(1, cpuThreads))};
+    ChangeFeed                  changes;
+    // Replicas have a change feed too, so that they can be tailed in turn
+    Comics::setChangeListener(db, [&changes](std::uint64_t sequence) { changes.notify(sequence); });
+    std::optional<Replica> replica;
+    if (!primary.empty())
+    {
+        replica.emplace(db, primary.substr(0, colon), primary.substr(colon + 1));
+        std::cout << "Replicating " << replica->primary() << '\n';
+    }
+    Services services{db, cpu, changes, replica ? &*replica : nullptr};
 
-    return listenForConnections(ioc, tcp::endpoint{address, port}, db);
+    const tcp::endpoint endpoint{address, port};
+    return perCore ? listenPerCore(endpoint, services, threads, pinThreads)
+                   : listenForConnections(endpoint, services, threads);
 }
 
 } // namespace comicsServer
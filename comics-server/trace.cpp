@@ -0,0 +1,107 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace comicsServer
+{
+namespace trace
+{
+namespace
+{
+
+constexpr std::size_t SPAN_CAPACITY = 4096;
+
+struct Span
+{
+    const char       *name;
+    Clock::time_point begin;
+    Clock::time_point end;
+};
+
+// Each thread owns one buffer; the mutex is only contended while dumping.
+struct ThreadBuffer
+{
+    explicit ThreadBuffer(unsigned tid) :
+        m_tid(tid)
+    {
+    }
+
+    std::mutex                      m_mutex;
+    unsigned                        m_tid;
+    std::size_t                     m_count{};
+    std::array<Span, SPAN_CAPACITY> m_spans{};
+};
+
+std::mutex                                 g_buffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+
+ThreadBuffer &threadBuffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer = []
+    {
+        std::unique_lock<std::mutex> lock(g_buffersMutex);
+        auto                         result = std::make_shared<ThreadBuffer>(static_cast<unsigned>(g_buffers.size() + 1));
+        g_buffers.push_back(result);
+        return result;
+    }();
+    return *buffer;
+}
+
+double microseconds(Clock::duration duration)
+{
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+} // namespace
+
+void record(const char *name, Clock::time_point begin, Clock::time_point end)
+{
+    ThreadBuffer                &buffer = threadBuffer();
+    std::unique_lock<std::mutex> lock(buffer.m_mutex);
+    buffer.m_spans[buffer.m_count % SPAN_CAPACITY] = Span{name, begin, end};
+    ++buffer.m_count;
+}
+
+std::string dumpChromeTrace()
+{
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::unique_lock<std::mutex> lock(g_buffersMutex);
+        buffers = g_buffers;
+    }
+
+    std::ostringstream json;
+    json.setf(std::ios::fixed);
+    json.precision(3);
+    json << R"({"displayTimeUnit":"ns","traceEvents":[)";
+    bool first = true;
+    for (const std::shared_ptr<ThreadBuffer> &buffer : buffers)
+    {
+        std::unique_lock<std::mutex> lock(buffer->m_mutex);
+        // Oldest span first once the ring has wrapped.
+        const std::size_t count = std::min(buffer->m_count, SPAN_CAPACITY);
+        for (std::size_t i = buffer->m_count - count; i < buffer->m_count; ++i)
+        {
+            const Span &span = buffer->m_spans[i % SPAN_CAPACITY];
+            if (!first)
+            {
+                json << ',';
+            }
+            first = false;
+            json << R"({"name":")" << span.name << R"(","ph":"X","pid":1,"tid":)" << buffer->m_tid
+                 << R"(,"ts":)" << microseconds(span.begin.time_since_epoch())
+                 << R"(,"dur":)" << microseconds(span.end - span.begin) << '}';
+        }
+    }
+    json << "]}";
+    return json.str();
+}
+
+} // namespace trace
+} // namespace comicsServer
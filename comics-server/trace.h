@@ -0,0 +1,59 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+namespace comicsServer
+{
+namespace trace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Records a completed span into the calling thread's ring buffer.
+void record(const char *name, Clock::time_point begin, Clock::time_point end);
+
+// Returns the spans of all threads as Chrome trace-event JSON,
+// suitable for loading into chrome://tracing or Perfetto.
+std::string dumpChromeTrace();
+
+// Records a span covering the lifetime of the object.
+class ScopedSpan
+{
+public:
+    explicit ScopedSpan(const char *name) :
+        m_name(name),
+        m_begin(Clock::now())
+    {
+    }
+    ScopedSpan(const ScopedSpan &rhs) = delete;
+    ScopedSpan &operator=(const ScopedSpan &rhs) = delete;
+    ~ScopedSpan()
+    {
+        record(m_name, m_begin, Clock::now());
+    }
+
+private:
+    const char       *m_name;
+    Clock::time_point m_begin;
+};
+
+} // namespace trace
+} // namespace comicsServer
+
+// Tracing is compiled out entirely unless COMICS_SERVER_TRACING is defined;
+// span names must be string literals.
+#if defined(COMICS_SERVER_TRACING)
+#define COMICS_TRACE_CAT_(a, b) a##b
+#define COMICS_TRACE_CAT(a, b) COMICS_TRACE_CAT_(a, b)
+#define COMICS_TRACE_SCOPE(name) ::comicsServer::trace::ScopedSpan COMICS_TRACE_CAT(traceSpan_, __LINE__)(name)
+#define COMICS_TRACE_BEGIN(var) const ::comicsServer::trace::Clock::time_point var = ::comicsServer::trace::Clock::now()
+#define COMICS_TRACE_END(name, var) ::comicsServer::trace::record(name, var, ::comicsServer::trace::Clock::now())
+// Adds a COMICS_TRACE_BEGIN variable to a lambda's capture list
+#define COMICS_TRACE_CAPTURE(var) , var
+#else
+#define COMICS_TRACE_SCOPE(name) ((void) 0)
+#define COMICS_TRACE_BEGIN(var) ((void) 0)
+#define COMICS_TRACE_END(name, var) ((void) 0)
+#define COMICS_TRACE_CAPTURE(var)
+#endif
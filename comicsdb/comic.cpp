@@ -1,6 +1,8 @@
 #include "comic.h"
 
 #include <map>
+#include <mutex>
+#include <stdexcept>
 
 namespace comicsdb
 {
@@ -9,12 +11,57 @@ namespace v2
 namespace
 {
 
-std::map<std::string, PersonPtr> s_persons;
+std::mutex                       s_personsMutex;
+std::map<std::string, PersonPtr> s_persons; // current names, and those of persons merged away
 
+// Returns the person with the name, or null; called with the lock held.
+PersonPtr find(const std::string &name)
+{
+    auto it = s_persons.find(name);
+    return it != s_persons.end() ? it->second : nullptr;
+}
+
+std::runtime_error unknownPerson(const std::string &name)
+{
+    return std::runtime_error("Unknown person " + name);
+}
+
+}
+
+Person::Person(const std::string &name) :
+    m_names{name},
+    m_name(&m_names.back())
+{
+}
+
+const std::string &Person::name() const
+{
+    return *canonical().m_name.load();
 }
+
+PersonPtr Person::root(PersonPtr person)
+{
+    while (person->m_mergedInto)
+    {
+        person = person->m_mergedInto;
+    }
+    return person;
+}
+
+const Person &Person::canonical() const
+{
+    const Person *person = this;
+    while (const Person *next = person->m_next.load())
+    {
+        person = next;
+    }
+    return *person;
+}
+
 PersonPtr findPerson(const std::string &name)
 {
-    auto it = s_persons.find(name);
+    std::unique_lock<std::mutex> lock(s_personsMutex);
+    auto                         it = s_persons.find(name);
     if (it == s_persons.end())
     {
         it = s_persons.emplace(name, std::make_shared<Person>(name)).first;
@@ -22,11 +69,87 @@ PersonPtr findPerson(const std::string &name)
     return it->second;
 }
 
+PersonPtr lookupPerson(const std::string &name)
+{
+    std::unique_lock<std::mutex> lock(s_personsMutex);
+    return find(name);
+}
+
 void forgetAllPersons()
 {
+    std::unique_lock<std::mutex> lock(s_personsMutex);
     s_persons.clear();
 }
 
+PersonPtr renamePerson(const std::string &name, const std::string &newName)
+{
+    std::unique_lock<std::mutex> lock(s_personsMutex);
+    PersonPtr                    person = find(name);
+    if (!person)
+    {
+        throw unknownPerson(name);
+    }
+    person = Person::root(person);
+    const PersonPtr other = find(newName);
+    if (newName.empty())
+    {
+        throw std::runtime_error("Persons need a name");
+    }
+    if (other && Person::root(other) != person)
+    {
+        throw std::runtime_error("Another person is named " + newName);
+    }
+    // Names of persons merged into this one keep finding it
+    s_persons.erase(person->m_names.back());
+    s_persons[newName] = person;
+    person->m_names.push_back(newName);
+    person->m_name.store(&person->m_names.back());
+    return person;
+}
+
+PersonPtr mergePersons(const std::string &from, const std::string &into)
+{
+    std::unique_lock<std::mutex> lock(s_personsMutex);
+    PersonPtr                    merged = find(from);
+    PersonPtr                    person = find(into);
+    if (!merged || !person)
+    {
+        throw unknownPerson(merged ? into : from);
+    }
+    merged = Person::root(merged);
+    person = Person::root(person);
+    if (merged == person)
+    {
+        return person;
+    }
+    s_persons[merged->m_names.back()] = person;
+    person->m_merged.push_back(merged);
+    person->m_merged.splice(person->m_merged.end(), merged->m_merged);
+    merged->m_mergedInto = person;
+    merged->m_next.store(person.get());
+    return person;
+}
+
+std::vector<PersonPtr> personIdentities(const std::string &name)
+{
+    std::unique_lock<std::mutex> lock(s_personsMutex);
+    std::vector<PersonPtr>       identities;
+    if (PersonPtr person = find(name))
+    {
+        person = Person::root(person);
+        identities.push_back(person);
+        for (const std::weak_ptr<Person> &merged : person->m_merged)
+        {
+            // Persons no comic credits any more are gone
+            if (PersonPtr identity = merged.lock())
+            {
+                identities.push_back(std::move(identity));
+            }
+        }
+    }
+    return identities;
+}
+
 Comic upgrade(const v1::Comic &comic)
 {
     Comic upgraded;
@@ -1,7 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <deque>
+#include <list>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace comicsdb
 {
@@ -29,19 +33,60 @@ struct Comic
 namespace v2
 {
 
-struct Person
+class Person;
+using PersonPtr = std::shared_ptr<Person>;
+
+// A creator, interned by name so that every comic crediting them shares
+// one identity. Renames and merges change the identity rather than the
+// comics, so they take constant time and show at once in every comic,
+// every version of it and every view.
+class Person
 {
-    Person() = default;
-    Person(const std::string &name_) : name(name_) {}
+public:
+    explicit Person(const std::string &name);
+    Person(const Person &rhs) = delete;
+    Person &operator=(const Person &rhs) = delete;
 
-    std::string name;
-};
+    // Returns the current name of the person this one was merged into, if
+    // any, or else of this one; it stays valid while this person lives.
+    const std::string &name() const;
+    // Returns the person this one was merged into, if any, or else this one.
+    const Person &canonical() const;
 
-using PersonPtr = std::shared_ptr<Person>;
+private:
+    // Returns the person, or the one it was merged into; called with the
+    // registry locked.
+    static PersonPtr root(PersonPtr person);
 
+    friend PersonPtr renamePerson(const std::string &name, const std::string &newName);
+    friend PersonPtr mergePersons(const std::string &from, const std::string &into);
+    friend std::vector<PersonPtr> personIdentities(const std::string &name);
+
+    // Written under the lock of the person registry
+    std::deque<std::string>          m_names; // every name the person had, the current one last
+    PersonPtr                        m_mergedInto;
+    std::list<std::weak_ptr<Person>> m_merged; // the persons merged into this one, directly or not
+    // Published for readers, who take no lock
+    std::atomic<const std::string *> m_name;
+    std::atomic<const Person *>      m_next{}; // m_mergedInto
+};
+
+// Returns the person with the name, creating them if there is none.
 PersonPtr findPerson(const std::string &name);
+// Returns the person with the name, or null if there is none.
+PersonPtr lookupPerson(const std::string &name);
 void forgetAllPersons();
 
+// Renames the person; the old name finds nobody afterwards. Throws if
+// there is no person with the name, or if another person has the new one.
+PersonPtr renamePerson(const std::string &name, const std::string &newName);
+// Merges the person from into the person into, whose name from then on
+// also finds. Throws if there is no person with either name.
+PersonPtr mergePersons(const std::string &from, const std::string &into);
+// Returns the person with the name, first, and the persons merged into
+// them; empty if there is no person with the name.
+std::vector<PersonPtr> personIdentities(const std::string &name);
+
 struct Comic
 {
     enum
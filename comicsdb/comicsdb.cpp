@@ -1,9 +1,20 @@
 #include "comicsdb.h"
 #include "json.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <limits>
 #include <mutex>
+#include <set>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 namespace comicsdb
@@ -81,6 +92,11 @@ void updateComic(ComicDb &db, std::size_t id, const Comic &comic)
     }
 
     std::unique_lock<std::mutex> lock(g_dbMutex);
+    if (!validId(db, id))
+    {
+        throw std::runtime_error("Invalid id " + std::to_string(id));
+    }
+
     db[id] = comic;
 }
 
@@ -106,69 +122,985 @@ namespace v2
 namespace
 {
 
-std::mutex g_dbMutex;
+// Comics are stored in segments that never move, so that readers can
+// reach them without a lock while createComic adds more.
+constexpr std::size_t SEGMENT_SIZE = 1024;
+constexpr std::size_t MAX_SEGMENTS = 4096;
 
-bool validId(const ComicDb &db, std::size_t &id)
+// Readers announce themselves in one of these slots for the length of a
+// call that holds pointers to versions, pinned views included; while all
+// of them are taken, further readers wait for one to come free.
+constexpr std::size_t MAX_READERS = 128;
+
+// Retired versions are reclaimed in batches of about this many.
+constexpr std::size_t RECLAIM_BATCH = 64;
+
+// Comics are pruned, and what they retire is kept until it can be freed,
+// under the lock of one of this many stripes, so that writers of
+// different comics seldom wait for one another.
+constexpr std::size_t NUM_STRIPES = 64;
+
+struct Version;
+
+// A change in the log. A change committing a single version is logged
+// by the version itself, which the change is read from; any other is
+// held in full.
+struct LoggedChange
 {
-    return id < db.size() && db[id].issue != Comic::DELETED_ISSUE;
-}
+    std::uint64_t                 sequence{};
+    Version                      *version{}; // the version logging the change
+    std::unique_ptr<const Change> change;    // when no version does
+};
 
-} // namespace
+// One version of a comic. Only the sequence number, stamped on commit,
+// the link to the older versions and the count of its owners change once
+// it is published; the change that commits it is filled in before it is
+// logged.
+struct Version
+{
+    Version(std::size_t id_, Change::Kind kind_, Comic comic_, Version *previous_, std::uint64_t sequence_ = 0) :
+        id(id_),
+        kind(kind_),
+        comic(std::move(comic_)),
+        sequence(sequence_),
+        previous(previous_)
+    {
+    }
 
-ComicDb load()
+    const std::size_t          id;
+    const Change::Kind         kind;
+    const Comic                comic;
+    std::atomic<std::uint64_t> sequence; // 0 until committed
+    // The committed version this one replaces, kept until this one is
+    // committed and after that while a pinned view can see it, or the
+    // next older one a pinned view can see.
+    std::atomic<Version *> previous;
+    // The comic's versions until it is retired from them, and the log
+    // while its change is in it; the last to let go frees it
+    std::atomic<int> owners{1};
+    std::int64_t     timeMs{};
+    LoggedChange     logged;
+};
+
+// A version unlinked from its comic, or a change pushed out of the log,
+// freed once no reader can reach it.
+struct Retired
 {
-    v1::ComicDb old = v1::load();
-    ComicDb result;
-    for (const v1::Comic &oldComic : old)
+    Version      *version;
+    LoggedChange *logged;
+    std::uint64_t epoch; // the reclamation epoch it was unlinked in
+};
+
+struct alignas(64) ReaderSlot
+{
+    std::atomic<std::uint64_t> epoch{}; // announced by the reader, 0 when free
+};
+
+struct alignas(64) Stripe
+{
+    std::mutex          mutex;
+    std::deque<Retired> retired; // in epoch order; guarded by the mutex
+};
+
+// Lets go of the version on behalf of one of its owners.
+void releaseVersion(Version *version)
+{
+    if (version->owners.fetch_sub(1) == 1)
     {
-        result.push_back(upgrade(oldComic));
+        delete version;
     }
+}
 
-    return result;
+void releaseLogged(LoggedChange *logged)
+{
+    if (logged->version != nullptr)
+    {
+        releaseVersion(logged->version);
+    }
+    else
+    {
+        delete logged;
+    }
 }
 
-Comic readComic(const ComicDb &db, std::size_t id)
+void freeRetired(const Retired &retired)
 {
-    std::unique_lock<std::mutex> lock(g_dbMutex);
-    if (!validId(db, id))
+    if (retired.version != nullptr)
     {
-        throw std::runtime_error("Invalid id " + std::to_string(id));
+        releaseVersion(retired.version);
+    }
+    if (retired.logged != nullptr)
+    {
+        releaseLogged(retired.logged);
     }
+}
 
-    return db[id];
+void releaseChain(Version *version)
+{
+    while (version != nullptr)
+    {
+        Version *previous = version->previous.load();
+        releaseVersion(version);
+        version = previous;
+    }
 }
 
-void deleteComic(ComicDb &db, std::size_t id)
+} // namespace
+
+struct ComicDb::Storage
 {
-    std::unique_lock<std::mutex> lock(g_dbMutex);
-    if (!validId(db, id))
+    ~Storage()
     {
-        throw std::runtime_error("Invalid id " + std::to_string(id));
+        for (std::atomic<LoggedChange *> &logged : changes)
+        {
+            if (LoggedChange *change = logged.load())
+            {
+                releaseLogged(change);
+            }
+        }
+        for (std::atomic<std::atomic<Version *> *> &segment : segments)
+        {
+            std::atomic<Version *> *slots = segment.load();
+            if (slots == nullptr)
+            {
+                continue;
+            }
+            for (std::size_t i = 0; i < SEGMENT_SIZE; ++i)
+            {
+                releaseChain(slots[i].load());
+            }
+            delete[] slots;
+        }
+        for (Stripe &stripe : stripes)
+        {
+            for (const Retired &retired : stripe.retired)
+            {
+                freeRetired(retired);
+            }
+        }
     }
 
-    db[id] = Comic{};
-}
+    std::array<std::atomic<std::atomic<Version *> *>, MAX_SEGMENTS> segments{};
+    std::atomic<std::size_t>                                        size{}; // ids handed out
+    // Held by the writers that commit more than one comic at once, or
+    // that copy another database: transactions, person changes, replicas
+    // and mirrors. Writes of a single comic do without it.
+    std::mutex commitMutex;
+    // The most recent changes, at their sequence number modulo the capacity
+    std::array<std::atomic<LoggedChange *>, CHANGE_LOG_CAPACITY> changes{};
+    std::atomic<std::uint64_t> claimed{};  // the last sequence number handed out
+    std::atomic<std::uint64_t> sequence{}; // the last published; the changes up to it are in the log
+    std::atomic<std::uint64_t> commits{};
+    std::atomic<std::uint64_t> retries{};
+    ChangeListener             listener; // set before the database is shared
+    std::atomic<std::uint64_t> epoch{1};
+    std::array<ReaderSlot, MAX_READERS> readers;
+    std::array<Stripe, NUM_STRIPES>     stripes;
+    std::atomic<std::uint64_t>          collected{};
+    // Taken by writers to prune only while views are pinned
+    std::mutex                      pinMutex;
+    std::atomic<std::size_t>        pinned{};
+    std::multiset<std::uint64_t>    pins;    // sequence numbers of the pinned views; guarded by the pin mutex
+    std::unordered_set<std::size_t> keptIds; // comics with older versions kept for them; guarded by the pin mutex
+    // The comics crediting each person; keyed by the identity the comics
+    // hold, so that merges leave it as it is
+    std::mutex                                                creditsMutex;
+    std::unordered_map<const Person *, std::set<std::size_t>> credits; // guarded by the credits mutex
+};
+
+namespace
+{
+
+using Storage = ComicDb::Storage;
+using Slot = std::atomic<Version *>;
+using Pins = std::multiset<std::uint64_t>;
+
+// Announces a reader for as long as it lives, so that the versions it
+// can reach are not freed under it.
+class ReadGuard
+{
+public:
+    explicit ReadGuard(const Storage &storage) :
+        m_slot(enter(const_cast<Storage &>(storage)))
+    {
+    }
+    ReadGuard(const ReadGuard &rhs) = delete;
+    ReadGuard &operator=(const ReadGuard &rhs) = delete;
+    ~ReadGuard()
+    {
+        m_slot.store(0);
+    }
+
+    static std::atomic<std::uint64_t> &enter(Storage &storage)
+    {
+        const std::size_t start = std::hash<std::thread::id>()(std::this_thread::get_id());
+        for (;;)
+        {
+            for (std::size_t i = 0; i < MAX_READERS; ++i)
+            {
+                std::atomic<std::uint64_t> &slot = storage.readers[(start + i) % MAX_READERS].epoch;
+                std::uint64_t               free = 0;
+                if (slot.load(std::memory_order_relaxed) == 0 &&
+                    slot.compare_exchange_strong(free, storage.epoch.load()))
+                {
+                    return slot;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<std::uint64_t> &m_slot;
+};
 
 bool validComic(const Comic &comic)
 {
     return !(comic.title.empty() || comic.issue < 1 ||
              comic.issue == Comic::DELETED_ISSUE || !comic.script ||
-             comic.script->name.empty() || !comic.pencils ||
-             comic.pencils->name.empty() || !comic.inks ||
-             comic.inks->name.empty() || !comic.letters ||
-             comic.letters->name.empty() || !comic.colors ||
-             comic.colors->name.empty());
+             comic.script->name().empty() || !comic.pencils ||
+             comic.pencils->name().empty() || !comic.inks ||
+             comic.inks->name().empty() || !comic.letters ||
+             comic.letters->name().empty() || !comic.colors ||
+             comic.colors->name().empty());
 }
 
-void updateComic(ComicDb &db, std::size_t id, const Comic &comic)
+bool live(const Version *version)
+{
+    return version != nullptr && version->comic.issue != Comic::DELETED_ISSUE;
+}
+
+std::runtime_error invalidId(std::size_t id)
+{
+    return std::runtime_error("Invalid id " + std::to_string(id));
+}
+
+std::int64_t nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// Returns the slot of the id, or null if its segment has not been
+// allocated and create is false.
+Slot *findSlot(Storage &storage, std::size_t id, bool create)
+{
+    const std::size_t index = id / SEGMENT_SIZE;
+    if (index >= MAX_SEGMENTS)
+    {
+        return nullptr;
+    }
+    Slot *segment = storage.segments[index].load();
+    if (segment == nullptr && create)
+    {
+        auto *fresh = new Slot[SEGMENT_SIZE]{};
+        if (storage.segments[index].compare_exchange_strong(segment, fresh))
+        {
+            segment = fresh;
+        }
+        else
+        {
+            delete[] fresh;
+        }
+    }
+    return segment != nullptr ? &segment[id % SEGMENT_SIZE] : nullptr;
+}
+
+Slot *findSlot(const Storage &storage, std::size_t id)
+{
+    return id < storage.size.load() ? findSlot(const_cast<Storage &>(storage), id, false) : nullptr;
+}
+
+Version *loadSlot(const Storage &storage, std::size_t id)
+{
+    Slot *slot = findSlot(storage, id);
+    return slot != nullptr ? slot->load() : nullptr;
+}
+
+Stripe &stripeOf(Storage &storage, std::size_t id)
+{
+    return storage.stripes[id % NUM_STRIPES];
+}
+
+// Grows the number of ids handed out to cover id.
+void coverId(Storage &storage, std::size_t id)
+{
+    std::size_t size = storage.size.load();
+    while (size <= id && !storage.size.compare_exchange_weak(size, id + 1))
+    {
+    }
+}
+
+// Returns the committed version of the comic: the one in the slot, unless
+// its writer has yet to commit it, in which case the one it replaces.
+Version *committed(Version *head)
+{
+    if (head == nullptr || head->sequence.load() != 0)
+    {
+        return head;
+    }
+    Version *previous = head->previous.load();
+    // Once committed, the link may have been pruned to an older version
+    if (head->sequence.load() != 0)
+    {
+        return head;
+    }
+    // Null for a comic still being created
+    return previous;
+}
+
+// Returns the newest version of the comic committed by the sequence number.
+Version *versionAt(const Storage &storage, std::size_t id, std::uint64_t sequence)
+{
+    Version *version = loadSlot(storage, id);
+    while (version != nullptr)
+    {
+        const std::uint64_t committedAt = version->sequence.load();
+        if (committedAt != 0 && committedAt <= sequence)
+        {
+            break;
+        }
+        version = version->previous.load();
+    }
+    return version;
+}
+
+// Frees what the stripe retired that no reader announced before it was
+// unlinked can reach; called with the stripe's lock held.
+void reclaim(Storage &storage, Stripe &stripe)
+{
+    // Readers announced from now on cannot reach what was retired so far
+    storage.epoch.fetch_add(1);
+    std::uint64_t oldest = std::numeric_limits<std::uint64_t>::max();
+    for (const ReaderSlot &reader : storage.readers)
+    {
+        const std::uint64_t epoch = reader.epoch.load();
+        if (epoch != 0)
+        {
+            oldest = std::min(oldest, epoch);
+        }
+    }
+    while (!stripe.retired.empty() && stripe.retired.front().epoch < oldest)
+    {
+        freeRetired(stripe.retired.front());
+        stripe.retired.pop_front();
+    }
+}
+
+// Hands a version that is no longer linked to its comic, or a change no
+// longer in the log, over to be freed when it is out of reach; called
+// with the stripe's lock held.
+void retire(Storage &storage, Stripe &stripe, Version *version, LoggedChange *logged = nullptr)
+{
+    // Readers announced in this epoch may have reached it before it was
+    // unlinked; the epoch only moves on when reclaim runs, which saves
+    // every retire an atomic increment
+    stripe.retired.push_back(Retired{version, logged, storage.epoch.load()});
+    if (stripe.retired.size() % RECLAIM_BATCH == 0)
+    {
+        reclaim(storage, stripe);
+    }
+}
+
+// Returns the newest version of the comic whose change has been
+// published; views pinned from now on see none older. Null if there is
+// none yet.
+Version *newestPublished(const Storage &storage, std::size_t id)
+{
+    return versionAt(storage, id, storage.sequence.load());
+}
+
+// Unlinks from below the newest version those older ones that no pinned
+// view can see, and returns whether any are kept; called with the lock
+// of the comic's stripe held, and the pin mutex too unless there are no
+// pins. A version is seen by the views pinned from its commit up to, but
+// not including, the commit of the version that replaced it.
+bool pruneHistory(Storage &storage, Stripe &stripe, Version &newest, const Pins &pins)
+{
+    Version      *kept = &newest;
+    std::uint64_t replacedAt = newest.sequence.load();
+    Version      *older = newest.previous.load();
+    bool          any = false;
+    while (older != nullptr)
+    {
+        const std::uint64_t committedAt = older->sequence.load();
+        Version            *next = older->previous.load();
+        auto                pin = pins.lower_bound(committedAt);
+        if (pin != pins.end() && *pin < replacedAt)
+        {
+            if (kept->previous.load() != older)
+            {
+                kept->previous.store(older);
+            }
+            kept = older;
+            any = true;
+        }
+        else
+        {
+            // Still reachable from the kept version until the link is moved past it
+            if (kept->previous.load() == older)
+            {
+                kept->previous.store(next);
+            }
+            retire(storage, stripe, older);
+            storage.collected.fetch_add(1, std::memory_order_relaxed);
+        }
+        replacedAt = committedAt;
+        older = next;
+    }
+    return any;
+}
+
+// Prunes the versions of the comic replaced by a published one, taking
+// the pin mutex only while views are pinned, and retires the change its
+// writer pushed out of the log, if any, under the same lock of the
+// stripe; called by a reader.
+void pruneComic(Storage &storage, std::size_t id, LoggedChange *dropped = nullptr)
+{
+    Stripe &stripe = stripeOf(storage, id);
+    {
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        if (dropped != nullptr)
+        {
+            retire(storage, stripe, nullptr, dropped);
+        }
+        Version *newest = newestPublished(storage, id);
+        if (newest == nullptr)
+        {
+            return;
+        }
+        // A view pinned after this check is pinned at or after newest,
+        // as pinning counts the view before it reads the sequence number
+        if (storage.pinned.load() == 0)
+        {
+            pruneHistory(storage, stripe, *newest, Pins{});
+            return;
+        }
+    }
+    std::unique_lock<std::mutex> pinLock(storage.pinMutex);
+    std::unique_lock<std::mutex> lock(stripe.mutex);
+    Version                     *newest = newestPublished(storage, id);
+    if (newest != nullptr && pruneHistory(storage, stripe, *newest, storage.pins))
+    {
+        storage.keptIds.insert(id);
+    }
+}
+
+// Prunes the history of the comics with older versions kept, after a
+// pinned view has gone; called with the pin mutex held by a reader.
+void collectHistory(Storage &storage)
+{
+    for (auto it = storage.keptIds.begin(); it != storage.keptIds.end();)
+    {
+        Stripe                      &stripe = stripeOf(storage, *it);
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        Version                     *newest = newestPublished(storage, *it);
+        if (newest != nullptr && pruneHistory(storage, stripe, *newest, storage.pins))
+        {
+            ++it;
+        }
+        else
+        {
+            it = storage.keptIds.erase(it);
+        }
+    }
+    for (Stripe &stripe : storage.stripes)
+    {
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        reclaim(storage, stripe);
+    }
+}
+
+// Hands out the next sequence number, once the change it pushes out of
+// the log has been published.
+std::uint64_t claimSequence(Storage &storage)
+{
+    const std::uint64_t sequence = storage.claimed.fetch_add(1) + 1;
+    while (sequence > storage.sequence.load() + CHANGE_LOG_CAPACITY)
+    {
+        std::this_thread::yield();
+    }
+    return sequence;
+}
+
+// Puts a numbered change in the log and publishes it, along with the
+// changes ahead of it that are in the log but not yet published. Returns
+// once the change is published, waiting only while a writer ahead has
+// yet to put its change in, with the change it pushed out of the log,
+// if any, for the caller to retire. Called by a reader.
+LoggedChange *publishChange(Storage &storage, LoggedChange *logged)
+{
+    const std::uint64_t sequence = logged->sequence;
+    LoggedChange       *dropped = storage.changes[sequence % CHANGE_LOG_CAPACITY].exchange(logged);
+    for (;;)
+    {
+        std::uint64_t last = storage.sequence.load();
+        if (last >= sequence)
+        {
+            return dropped;
+        }
+        const LoggedChange *next = storage.changes[(last + 1) % CHANGE_LOG_CAPACITY].load();
+        if (next == nullptr || next->sequence != last + 1)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            storage.sequence.compare_exchange_strong(last, last + 1);
+        }
+    }
+}
+
+// Publishes a change held in full, and prunes the comics it commits
+// versions of; called by a reader.
+void publishChanges(Storage &storage, LoggedChange *logged)
+{
+    LoggedChange *dropped = publishChange(storage, logged);
+    const Change &change = *logged->change;
+    auto          prune = [&](std::size_t id)
+    {
+        pruneComic(storage, id, dropped);
+        dropped = nullptr;
+    };
+    if (change.kind == Change::Kind::Create || change.kind == Change::Kind::Update ||
+        change.kind == Change::Kind::Delete)
+    {
+        prune(change.id);
+    }
+    for (const Change &part : change.changes)
+    {
+        prune(part.id);
+    }
+    if (dropped != nullptr)
+    {
+        Stripe                      &stripe = stripeOf(storage, logged->sequence);
+        std::unique_lock<std::mutex> lock(stripe.mutex);
+        retire(storage, stripe, nullptr, dropped);
+    }
+}
+
+// Returns the change that commits the version, as yet unnumbered.
+Change changeOf(const Version &version, std::int64_t timeMs)
+{
+    Change change;
+    change.kind = version.kind;
+    change.id = version.id;
+    change.timeMs = timeMs;
+    change.comic = version.comic;
+    return change;
+}
+
+// The persons a comic credits, each once, padded with nulls.
+using Credited = std::array<const Person *, 5>;
+
+// Returns the persons a comic credits; none for a deleted one.
+Credited creditedPersons(const Comic *comic)
+{
+    Credited persons{};
+    if (comic == nullptr || comic->issue == Comic::DELETED_ISSUE)
+    {
+        return persons;
+    }
+    auto end = persons.begin();
+    for (const PersonPtr *person : {&comic->script, &comic->pencils, &comic->inks, &comic->letters, &comic->colors})
+    {
+        if (*person && std::find(persons.begin(), end, person->get()) == end)
+        {
+            *end++ = person->get();
+        }
+    }
+    return persons;
+}
+
+// Moves the comic's credits in the index from the persons of the comic
+// it replaces to its own; called before the version is committed, so
+// that the comic's next writer finds the index up to date.
+void updateCredits(Storage &storage, std::size_t id, const Comic *before, const Comic *after)
+{
+    const Credited removed = creditedPersons(before);
+    const Credited added = creditedPersons(after);
+    if (removed == added)
+    {
+        // Most writes keep the credits
+        return;
+    }
+    std::unique_lock<std::mutex> lock(storage.creditsMutex);
+    for (const Person *person : removed)
+    {
+        if (person == nullptr || std::find(added.begin(), added.end(), person) != added.end())
+        {
+            continue;
+        }
+        auto it = storage.credits.find(person);
+        if (it != storage.credits.end() && it->second.erase(id) != 0 && it->second.empty())
+        {
+            storage.credits.erase(it);
+        }
+    }
+    for (const Person *person : added)
+    {
+        if (person != nullptr && std::find(removed.begin(), removed.end(), person) == removed.end())
+        {
+            storage.credits[person].insert(id);
+        }
+    }
+}
+
+// Gives the version its sequence number, making it visible to readers
+// of the latest comics, and indexes its credits; views see it once its
+// change is published.
+void stampVersion(Storage &storage, Version &version, std::uint64_t sequence)
+{
+    const Version *replaced = version.previous.load();
+    updateCredits(storage, version.id, replaced != nullptr ? &replaced->comic : nullptr, &version.comic);
+    version.sequence.store(sequence);
+}
+
+// Numbers and logs the change of a published version, which no other
+// writer may replace until it is committed; called by a reader.
+std::uint64_t commit(Storage &storage, Version &version)
+{
+    const std::uint64_t sequence = claimSequence(storage);
+    version.timeMs = nowMs();
+    version.logged.version = &version;
+    version.logged.sequence = sequence;
+    // The log's hold on the version, let go when the change leaves it.
+    // Nothing else can let go of the version before it is stamped, as
+    // only a newer version replaces it in its comic.
+    version.owners.store(2, std::memory_order_relaxed);
+    stampVersion(storage, version, sequence);
+    storage.commits.fetch_add(1, std::memory_order_relaxed);
+    pruneComic(storage, version.id, publishChange(storage, &version.logged));
+    return sequence;
+}
+
+// Tells the listener how far the log has been published; called with no
+// lock held.
+void notifyChange(const Storage &storage)
+{
+    if (storage.listener)
+    {
+        storage.listener(storage.sequence.load());
+    }
+}
+
+// Lets the writer of an uncommitted version get on with committing it,
+// or taking it back; the comic is not written again until then, so that
+// the log keeps each comic's versions in order.
+void awaitCommit()
+{
+    std::this_thread::yield();
+}
+
+// Replaces the comic with the version made from the committed one,
+// retrying when another writer swaps in a version first. makeComic
+// returns false to give up instead; then NO_VERSION is returned.
+template <typename MakeComic>
+std::uint64_t replaceComic(ComicDb &db, std::size_t id, Change::Kind kind, MakeComic makeComic)
+{
+    Storage &storage = *db.storage;
+    Slot    *slot = findSlot(storage, id);
+    if (slot == nullptr)
+    {
+        throw invalidId(id);
+    }
+    ReadGuard guard(storage);
+    for (;;)
+    {
+        Version *head = slot->load();
+        if (head != nullptr && head->sequence.load() == 0)
+        {
+            awaitCommit();
+            continue;
+        }
+        if (!live(head))
+        {
+            throw invalidId(id);
+        }
+        Comic comic;
+        if (!makeComic(*head, comic))
+        {
+            return NO_VERSION;
+        }
+        auto next = std::make_unique<Version>(id, kind, std::move(comic), head);
+        if (slot->compare_exchange_strong(head, next.get()))
+        {
+            const std::uint64_t sequence = commit(storage, *next.release());
+            notifyChange(storage);
+            return sequence;
+        }
+        storage.retries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::uint64_t writeComic(ComicDb &db, std::size_t id, const Comic &comic, std::uint64_t ifVersion)
 {
     if (!validComic(comic))
     {
         throw std::runtime_error("Invalid comic");
     }
+    return replaceComic(db, id, Change::Kind::Update,
+                        [&](const Version &current, Comic &next)
+                        {
+                            next = comic;
+                            return ifVersion == NO_VERSION || current.sequence.load() == ifVersion;
+                        });
+}
 
-    std::unique_lock<std::mutex> lock(g_dbMutex);
-    db[id] = comic;
+std::uint64_t eraseComic(ComicDb &db, std::size_t id, std::uint64_t ifVersion)
+{
+    return replaceComic(db, id, Change::Kind::Delete,
+                        [&](const Version &current, Comic &)
+                        { return ifVersion == NO_VERSION || current.sequence.load() == ifVersion; });
+}
+
+// Publishes an uncommitted version of the comic made from its committed
+// one, and returns it, or null if makeComic returns false; called with the
+// commit mutex held by a reader. Writers of the comic wait for the
+// version to be committed before replacing it.
+template <typename MakeComic>
+Version *publishVersion(Storage &storage, Slot &slot, std::size_t id, Change::Kind kind, MakeComic makeComic)
+{
+    for (;;)
+    {
+        Version *head = slot.load();
+        if (head != nullptr && head->sequence.load() == 0)
+        {
+            awaitCommit();
+            continue;
+        }
+        if (!live(head))
+        {
+            throw invalidId(id);
+        }
+        Comic comic;
+        if (!makeComic(*head, comic))
+        {
+            return nullptr;
+        }
+        auto next = std::make_unique<Version>(id, kind, std::move(comic), head);
+        if (slot.compare_exchange_strong(head, next.get()))
+        {
+            return next.release();
+        }
+        storage.retries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Publishes the version written by an update or delete of a transaction,
+// once the comic meets its condition.
+Version *publishMutation(Storage &storage, Slot &slot, const Mutation &mutation)
+{
+    return publishVersion(storage, slot, mutation.id, mutation.kind,
+                          [&](const Version &current, Comic &next)
+                          {
+                              if (mutation.kind != Change::Kind::Delete)
+                              {
+                                  next = mutation.comic;
+                              }
+                              return mutation.ifVersion == NO_VERSION ||
+                                     current.sequence.load() == mutation.ifVersion;
+                          });
+}
+
+// Takes back the uncommitted versions published by a transaction that
+// failed, newest first; called with the commit mutex held.
+void unpublish(Storage &storage, const std::vector<Version *> &published)
+{
+    for (auto it = published.rbegin(); it != published.rend(); ++it)
+    {
+        if (*it != nullptr)
+        {
+            Stripe                      &stripe = stripeOf(storage, (*it)->id);
+            std::unique_lock<std::mutex> lock(stripe.mutex);
+            findSlot(storage, (*it)->id)->store((*it)->previous.load());
+            retire(storage, stripe, *it);
+        }
+    }
+}
+
+// Numbers a change committing the versions published for it, and logs
+// it with them; called with the commit mutex held by a reader.
+std::uint64_t commitPublished(Storage &storage, Change &&change, const std::vector<Version *> &published)
+{
+    change.sequence = claimSequence(storage);
+    for (Version *version : published)
+    {
+        stampVersion(storage, *version, change.sequence);
+        change.changes.push_back(changeOf(*version, change.timeMs));
+        change.changes.back().sequence = change.sequence;
+    }
+    storage.commits.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t sequence = change.sequence;
+    publishChanges(storage, new LoggedChange{sequence, nullptr, std::make_unique<const Change>(std::move(change))});
+    return sequence;
+}
+
+// Publishes a version with a sequence number from elsewhere, such as a
+// primary, over the one in the slot; called with the commit mutex held
+// by the only writer, a replica or mirror, which prunes the comic once
+// the sequence number is published.
+void storeVersion(Storage &storage, std::size_t id, Change::Kind kind, const Comic &comic, std::uint64_t sequence)
+{
+    Slot *slot = findSlot(storage, id, true);
+    if (slot == nullptr)
+    {
+        throw invalidId(id);
+    }
+    coverId(storage, id);
+    auto *version = new Version(id, kind, comic, slot->load(), sequence);
+    const Version *replaced = version->previous.load();
+    updateCredits(storage, id, replaced != nullptr ? &replaced->comic : nullptr, &version->comic);
+    slot->store(version);
+}
+
+// Empties the slot, retiring the versions in it; called with the commit
+// mutex held.
+void clearSlot(Storage &storage, std::size_t id)
+{
+    Slot *slot = findSlot(storage, id, false);
+    if (slot == nullptr)
+    {
+        return;
+    }
+    Stripe                      &stripe = stripeOf(storage, id);
+    std::unique_lock<std::mutex> lock(stripe.mutex);
+    Version                     *version = slot->exchange(nullptr);
+    updateCredits(storage, id, version != nullptr ? &version->comic : nullptr, nullptr);
+    while (version != nullptr)
+    {
+        Version *previous = version->previous.load();
+        retire(storage, stripe, version);
+        version = previous;
+    }
+}
+
+// Applies a person change to the persons; called with the commit mutex
+// held. Changes from the log of a primary are skipped when the persons
+// already reflect them, as they do when the replica shares the primary's
+// process and with it the persons.
+void applyPersonChange(const Change &change, bool fromPrimary)
+{
+    if (change.kind == Change::Kind::RenamePerson)
+    {
+        if (!fromPrimary || lookupPerson(change.name))
+        {
+            renamePerson(change.name, change.newName);
+        }
+    }
+    else if (!fromPrimary || (lookupPerson(change.name) && lookupPerson(change.newName)))
+    {
+        mergePersons(change.name, change.newName);
+    }
+}
+
+// Returns the ids of the comics whose credits a person change renames:
+// those crediting the person renamed, or merged away; called with the
+// commit mutex held.
+std::set<std::size_t> renamedComics(Storage &storage, const Change &change)
+{
+    std::set<std::size_t> ids;
+    if (change.kind == Change::Kind::MergePersons)
+    {
+        const PersonPtr from = lookupPerson(change.name);
+        const PersonPtr into = lookupPerson(change.newName);
+        if (!from || !into || &from->canonical() == &into->canonical())
+        {
+            return ids;
+        }
+    }
+    std::unique_lock<std::mutex> lock(storage.creditsMutex);
+    for (const PersonPtr &identity : personIdentities(change.name))
+    {
+        auto it = storage.credits.find(identity.get());
+        if (it != storage.credits.end())
+        {
+            ids.insert(it->second.begin(), it->second.end());
+        }
+    }
+    return ids;
+}
+
+// Applies a person change and logs it, under the commit mutex so that
+// the log has person changes in the order they were made. Every comic
+// whose credits change name gets a new version with the change's
+// sequence number, so that conditional writes made against the old
+// names fail and delta sync sends the comics again. The versions are
+// published before the persons change, so that no writer can slip in a
+// comic made with the old names in between.
+void commitPersonChange(Storage &storage, Change &&change)
+{
+    ReadGuard                    guard(storage);
+    std::unique_lock<std::mutex> lock(storage.commitMutex);
+    std::vector<Version *>       published;
+    try
+    {
+        for (std::size_t id : renamedComics(storage, change))
+        {
+            published.push_back(publishVersion(storage, *findSlot(storage, id), id, Change::Kind::Update,
+                                               [](const Version &current, Comic &next)
+                                               {
+                                                   next = current.comic;
+                                                   return true;
+                                               }));
+        }
+        applyPersonChange(change, false);
+    }
+    catch (...)
+    {
+        unpublish(storage, published);
+        throw;
+    }
+    commitPublished(storage, std::move(change), published);
+    lock.unlock();
+    notifyChange(storage);
+}
+
+} // namespace
+
+ComicDb::ComicDb() :
+    storage(std::make_unique<Storage>())
+{
+}
+
+ComicDb::ComicDb(ComicDb &&rhs) noexcept = default;
+ComicDb &ComicDb::operator=(ComicDb &&rhs) noexcept = default;
+ComicDb::~ComicDb() = default;
+
+ComicDb load()
+{
+    v1::ComicDb old = v1::load();
+    ComicDb result;
+    for (const v1::Comic &oldComic : old)
+    {
+        // Loaded comics are created like any other, so that they have versions
+        createComic(result, upgrade(oldComic));
+    }
+
+    return result;
+}
+
+Comic readComic(const ComicDb &db, std::size_t id)
+{
+    ReadGuard guard(*db.storage);
+    Version  *version = committed(loadSlot(*db.storage, id));
+    if (!live(version))
+    {
+        throw invalidId(id);
+    }
+
+    return version->comic;
+}
+
+void deleteComic(ComicDb &db, std::size_t id)
+{
+    eraseComic(db, id, NO_VERSION);
+}
+
+void updateComic(ComicDb &db, std::size_t id, const Comic &comic)
+{
+    writeComic(db, id, comic, NO_VERSION);
 }
 
 std::size_t createComic(ComicDb &db, Comic &&comic)
@@ -178,13 +1110,438 @@ std::size_t createComic(ComicDb &db, Comic &&comic)
         throw std::runtime_error("Invalid comic");
     }
 
-    std::unique_lock<std::mutex> lock(g_dbMutex);
+    Storage &storage = *db.storage;
     // ids are zero-based
-    const std::size_t id = db.size();
-    db.push_back(comic);
+    const std::size_t id = storage.size.fetch_add(1);
+    Slot             *slot = findSlot(storage, id, true);
+    if (slot == nullptr)
+    {
+        throw std::runtime_error("No room for comic " + std::to_string(id));
+    }
+    ReadGuard guard(storage);
+    auto     *version = new Version(id, Change::Kind::Create, std::move(comic), nullptr);
+    slot->store(version);
+    commit(storage, *version);
+    notifyChange(storage);
     return id;
 }
 
+std::uint64_t modifyComic(ComicDb &db, std::size_t id, const ComicEdit &edit)
+{
+    return replaceComic(db, id, Change::Kind::Update,
+                        [&](const Version &current, Comic &next)
+                        {
+                            next = current.comic;
+                            edit(next);
+                            if (!validComic(next))
+                            {
+                                throw std::runtime_error("Invalid comic");
+                            }
+                            return true;
+                        });
+}
+
+TransactionResult commitTransaction(ComicDb &db, const Transaction &transaction)
+{
+    Storage                        &storage = *db.storage;
+    std::unordered_set<std::size_t> written;
+    for (const Mutation &mutation : transaction)
+    {
+        const bool write = mutation.kind == Change::Kind::Create || mutation.kind == Change::Kind::Update ||
+                           mutation.kind == Change::Kind::Delete;
+        if (!write || (mutation.kind != Change::Kind::Delete && !validComic(mutation.comic)))
+        {
+            throw std::runtime_error("Invalid comic");
+        }
+        if (mutation.kind != Change::Kind::Create &&
+            (findSlot(storage, mutation.id) == nullptr || !written.insert(mutation.id).second))
+        {
+            throw invalidId(mutation.id);
+        }
+    }
+
+    TransactionResult      result;
+    std::vector<Version *> published(transaction.size()); // in mutation order
+    ReadGuard              guard(storage);
+    const std::int64_t     timeMs = nowMs();
+    std::unique_lock<std::mutex> lock(storage.commitMutex);
+    try
+    {
+        // Conditions are checked first, so that no id is handed out to a
+        // create of a transaction that fails
+        for (std::size_t i = 0; i < transaction.size(); ++i)
+        {
+            const Mutation &mutation = transaction[i];
+            if (mutation.kind == Change::Kind::Create)
+            {
+                continue;
+            }
+            published[i] = publishMutation(storage, *findSlot(storage, mutation.id), mutation);
+            if (published[i] == nullptr)
+            {
+                unpublish(storage, published);
+                return result;
+            }
+        }
+        for (std::size_t i = 0; i < transaction.size(); ++i)
+        {
+            const Mutation &mutation = transaction[i];
+            if (mutation.kind != Change::Kind::Create)
+            {
+                continue;
+            }
+            const std::size_t id = storage.size.fetch_add(1);
+            Slot             *slot = findSlot(storage, id, true);
+            if (slot == nullptr)
+            {
+                throw std::runtime_error("No room for comic " + std::to_string(id));
+            }
+            published[i] = new Version(id, Change::Kind::Create, mutation.comic, nullptr);
+            slot->store(published[i]);
+        }
+    }
+    catch (...)
+    {
+        unpublish(storage, published);
+        throw;
+    }
+
+    // Every version gets the one sequence number, and pinned views see
+    // all or none of them
+    Change record;
+    record.kind = Change::Kind::Transaction;
+    record.timeMs = timeMs;
+    for (Version *version : published)
+    {
+        result.ids.push_back(version->id);
+    }
+    result.version = commitPublished(storage, std::move(record), published);
+    lock.unlock();
+    notifyChange(storage);
+    return result;
+}
+
+WriteStats writeStats(const ComicDb &db)
+{
+    WriteStats stats;
+    stats.commits = db.storage->commits.load(std::memory_order_relaxed);
+    stats.retries = db.storage->retries.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PinnedView::PinnedView(const ComicDb &db) :
+    m_storage(*db.storage)
+{
+    std::unique_lock<std::mutex> lock(m_storage.pinMutex);
+    // Counted before the sequence number is read, so that writers that
+    // find no views pinned prune nothing this view sees
+    m_storage.pinned.fetch_add(1);
+    m_sequence = m_storage.sequence.load();
+    m_size = m_storage.size.load();
+    m_storage.pins.insert(m_sequence);
+}
+
+PinnedView::~PinnedView()
+{
+    ReadGuard                    guard(m_storage);
+    std::unique_lock<std::mutex> lock(m_storage.pinMutex);
+    m_storage.pins.erase(m_storage.pins.find(m_sequence));
+    m_storage.pinned.fetch_sub(1);
+    collectHistory(m_storage);
+}
+
+Comic PinnedView::readComic(std::size_t id) const
+{
+    // The pin keeps the versions the view sees; the guard covers the
+    // newer ones passed on the way to them
+    ReadGuard      guard(m_storage);
+    const Version *version = id < m_size ? versionAt(m_storage, id, m_sequence) : nullptr;
+    if (!live(version))
+    {
+        throw invalidId(id);
+    }
+
+    return version->comic;
+}
+
+void PinnedView::forEachComic(const std::function<void(std::size_t id, const Comic &comic)> &visit) const
+{
+    ReadGuard guard(m_storage);
+    for (std::size_t id = 0; id < m_size; ++id)
+    {
+        const Version *version = versionAt(m_storage, id, m_sequence);
+        if (live(version))
+        {
+            visit(id, version->comic);
+        }
+    }
+}
+
+HistoryStats historyStats(const ComicDb &db)
+{
+    Storage                     &storage = *db.storage;
+    ReadGuard                    guard(storage);
+    std::unique_lock<std::mutex> lock(storage.pinMutex);
+    HistoryStats                 stats;
+    stats.pinnedViews = storage.pins.size();
+    stats.collectedVersions = storage.collected.load();
+    for (std::size_t id : storage.keptIds)
+    {
+        // The newest published version is not an older one kept
+        std::unique_lock<std::mutex> stripeLock(stripeOf(storage, id).mutex);
+        const Version               *newest = newestPublished(storage, id);
+        for (const Version *version = newest != nullptr ? newest->previous.load() : nullptr; version != nullptr;
+             version = version->previous.load())
+        {
+            ++stats.keptVersions;
+        }
+    }
+    return stats;
+}
+
+VersionedComic readVersionedComic(const ComicDb &db, std::size_t id)
+{
+    ReadGuard guard(*db.storage);
+    Version  *version = committed(loadSlot(*db.storage, id));
+    if (!live(version))
+    {
+        throw invalidId(id);
+    }
+
+    return VersionedComic{id, version->sequence.load(), version->comic};
+}
+
+std::uint64_t updateComicIfVersion(ComicDb &db, std::size_t id, const Comic &comic, std::uint64_t version)
+{
+    return version == NO_VERSION ? NO_VERSION : writeComic(db, id, comic, version);
+}
+
+std::uint64_t deleteComicIfVersion(ComicDb &db, std::size_t id, std::uint64_t version)
+{
+    return version == NO_VERSION ? NO_VERSION : eraseComic(db, id, version);
+}
+
+Delta changedSince(const ComicDb &db, std::uint64_t version)
+{
+    // A pinned view, so that the delta is exactly the changes up to its version
+    const PinnedView view(db);
+    Delta            delta;
+    delta.version = view.sequence();
+    for (std::size_t id = 0; id < view.size(); ++id)
+    {
+        const Version *changed = versionAt(*db.storage, id, view.sequence());
+        if (changed != nullptr && changed->sequence.load() > version)
+        {
+            delta.comics.push_back(VersionedComic{id, changed->sequence.load(), changed->comic});
+        }
+    }
+    return delta;
+}
+
+void applyDelta(ComicDb &mirror, const Delta &delta)
+{
+    Storage                     &storage = *mirror.storage;
+    ReadGuard                    guard(storage);
+    std::unique_lock<std::mutex> lock(storage.commitMutex);
+    for (const VersionedComic &changed : delta.comics)
+    {
+        storeVersion(storage, changed.id, Change::Kind::Update, changed.comic, changed.version);
+    }
+    const std::uint64_t sequence = std::max(storage.sequence.load(), delta.version);
+    storage.claimed.store(sequence);
+    storage.sequence.store(sequence);
+    for (const VersionedComic &changed : delta.comics)
+    {
+        pruneComic(storage, changed.id);
+    }
+}
+
+PersonCredits personCredits(const ComicDb &db, const std::string &name)
+{
+    const std::vector<PersonPtr> identities = personIdentities(name);
+    if (identities.empty())
+    {
+        throw std::runtime_error("Unknown person " + name);
+    }
+    Storage                     &storage = *db.storage;
+    std::set<std::size_t>        comics;
+    std::unique_lock<std::mutex> lock(storage.creditsMutex);
+    for (const PersonPtr &identity : identities)
+    {
+        auto it = storage.credits.find(identity.get());
+        if (it != storage.credits.end())
+        {
+            comics.insert(it->second.begin(), it->second.end());
+        }
+    }
+    lock.unlock();
+    return PersonCredits{identities.front()->name(), {comics.begin(), comics.end()}};
+}
+
+void renamePerson(ComicDb &db, const std::string &name, const std::string &newName)
+{
+    Change change;
+    change.kind = Change::Kind::RenamePerson;
+    change.timeMs = nowMs();
+    change.name = name;
+    change.newName = newName;
+    commitPersonChange(*db.storage, std::move(change));
+}
+
+void mergePersons(ComicDb &db, const std::string &from, const std::string &into)
+{
+    Change change;
+    change.kind = Change::Kind::MergePersons;
+    change.timeMs = nowMs();
+    change.name = from;
+    change.newName = into;
+    commitPersonChange(*db.storage, std::move(change));
+}
+
+void setChangeListener(ComicDb &db, ChangeListener listener)
+{
+    std::unique_lock<std::mutex> lock(db.storage->commitMutex);
+    db.storage->listener = std::move(listener);
+}
+
+std::uint64_t lastSequence(const ComicDb &db)
+{
+    return db.storage->sequence.load();
+}
+
+ChangeBatch changesSince(const ComicDb &db, std::uint64_t since, std::size_t limit)
+{
+    const Storage &storage = *db.storage;
+    ReadGuard      guard(storage);
+    ChangeBatch    batch;
+    batch.sequence = storage.sequence.load();
+    if (since >= batch.sequence)
+    {
+        return batch;
+    }
+    const std::uint64_t end = since + std::min<std::uint64_t>(batch.sequence - since, limit);
+    batch.changes.reserve(static_cast<std::size_t>(end - since));
+    for (std::uint64_t sequence = since + 1; sequence <= end; ++sequence)
+    {
+        // A change pushed out of the log has been replaced by a later one
+        const LoggedChange *logged = storage.changes[sequence % CHANGE_LOG_CAPACITY].load();
+        if (logged == nullptr || logged->sequence != sequence)
+        {
+            batch.changes.clear();
+            batch.resync = true;
+            return batch;
+        }
+        if (logged->version != nullptr)
+        {
+            batch.changes.push_back(changeOf(*logged->version, logged->version->timeMs));
+            batch.changes.back().sequence = sequence;
+        }
+        else
+        {
+            batch.changes.push_back(*logged->change);
+        }
+    }
+    return batch;
+}
+
+Snapshot snapshot(const ComicDb &db)
+{
+    // Copied from a pinned view, so that writers carry on meanwhile
+    const PinnedView view(db);
+    Snapshot         result;
+    result.sequence = view.sequence();
+    for (std::size_t id = 0; id < view.size(); ++id)
+    {
+        const Version *version = versionAt(*db.storage, id, view.sequence());
+        result.comics.push_back(version != nullptr ? version->comic : Comic{});
+        result.versions.push_back(version != nullptr ? version->sequence.load() : NO_VERSION);
+    }
+    return result;
+}
+
+void restore(ComicDb &db, Snapshot &&snapshot)
+{
+    Storage                     &storage = *db.storage;
+    ReadGuard                    guard(storage);
+    std::unique_lock<std::mutex> lock(storage.commitMutex);
+    const std::size_t            oldSize = storage.size.load();
+    for (std::size_t id = 0; id < snapshot.comics.size(); ++id)
+    {
+        const std::uint64_t version = id < snapshot.versions.size() ? snapshot.versions[id] : NO_VERSION;
+        if (version == NO_VERSION && snapshot.comics[id].issue == Comic::DELETED_ISSUE)
+        {
+            clearSlot(storage, id);
+            continue;
+        }
+        // Snapshots without versions date every comic to the snapshot
+        storeVersion(storage, id, Change::Kind::Create, snapshot.comics[id],
+                     version != NO_VERSION ? version : std::max<std::uint64_t>(snapshot.sequence, 1));
+    }
+    for (std::size_t id = snapshot.comics.size(); id < oldSize; ++id)
+    {
+        clearSlot(storage, id);
+    }
+    storage.size.store(snapshot.comics.size());
+    for (std::uint64_t i = 0; i < CHANGE_LOG_CAPACITY; ++i)
+    {
+        if (LoggedChange *dropped = storage.changes[i].exchange(nullptr))
+        {
+            Stripe                      &stripe = stripeOf(storage, i);
+            std::unique_lock<std::mutex> stripeLock(stripe.mutex);
+            retire(storage, stripe, nullptr, dropped);
+        }
+    }
+    storage.claimed.store(snapshot.sequence);
+    storage.sequence.store(snapshot.sequence);
+    for (std::size_t id = 0; id < snapshot.comics.size(); ++id)
+    {
+        pruneComic(storage, id);
+    }
+    lock.unlock();
+    notifyChange(storage);
+}
+
+void applyChange(ComicDb &db, const Change &change)
+{
+    Storage                     &storage = *db.storage;
+    ReadGuard                    guard(storage);
+    std::unique_lock<std::mutex> lock(storage.commitMutex);
+    if (change.sequence != storage.claimed.load() + 1)
+    {
+        throw std::runtime_error("Change " + std::to_string(change.sequence) + " out of order after " +
+                                 std::to_string(storage.claimed.load()));
+    }
+    if (change.kind == Change::Kind::Transaction)
+    {
+        for (const Change &part : change.changes)
+        {
+            storeVersion(storage, part.id, part.kind, part.comic, change.sequence);
+        }
+    }
+    else if (change.kind == Change::Kind::RenamePerson || change.kind == Change::Kind::MergePersons)
+    {
+        applyPersonChange(change, true);
+        // The replica's own copies of the comics, whose persons have just changed
+        for (const Change &part : change.changes)
+        {
+            const Version *current = loadSlot(storage, part.id);
+            if (live(current))
+            {
+                storeVersion(storage, part.id, Change::Kind::Update, current->comic, change.sequence);
+            }
+        }
+    }
+    else
+    {
+        storeVersion(storage, change.id, change.kind, change.comic, change.sequence);
+    }
+    // Keep the primary's numbering and commit time, so that the replica can be tailed in turn
+    claimSequence(storage);
+    publishChanges(storage, new LoggedChange{change.sequence, nullptr, std::make_unique<const Change>(change)});
+    lock.unlock();
+    notifyChange(storage);
+}
+
 } // namespace v2
 
 } // namespace comicsdb
@@ -3,6 +3,10 @@
 #include "comic.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace comicsdb
@@ -24,7 +28,93 @@ std::size_t createComic(ComicDb &db, Comic &&comic);
 namespace v2
 {
 
-using ComicDb = std::vector<Comic>;
+// A create, update or delete of one comic, a transaction of several, or
+// a rename or merge of persons, numbered in commit order.
+struct Change
+{
+    enum class Kind
+    {
+        Create,
+        Update,
+        Delete,
+        Transaction,
+        RenamePerson,
+        MergePersons,
+    };
+    std::uint64_t       sequence{};
+    Kind                kind{Kind::Update};
+    std::size_t         id{};
+    std::int64_t        timeMs{}; // commit time on the primary, in ms since the epoch
+    Comic               comic;    // the comic after the change; deleted for Delete
+    std::vector<Change> changes;  // for Transaction and person changes, the comics changed, with its sequence number
+    // For RenamePerson the old and new name; for MergePersons the name of
+    // the person merged and of the person merged into.
+    std::string name;
+    std::string newName;
+};
+
+// Called after each change is committed, with no lock held, with the last
+// sequence number published to the change feed: at least the change's,
+// and perhaps that of a later one committed meanwhile.
+using ChangeListener = std::function<void(std::uint64_t sequence)>;
+
+// Number of recent changes kept for readers of the change feed.
+constexpr std::size_t CHANGE_LOG_CAPACITY = 10000;
+
+// Each comic is held as an immutable version that readers load without
+// a lock and writers replace with a compare-and-swap, retrying when
+// another writer got in first. A version is committed when it is stamped
+// with a sequence number taken from an atomic counter; readers only see
+// committed versions. Its change then goes into the log at that number
+// and is published to the change feed and pinned views once every
+// earlier change is in, so that writes of a single comic take no lock
+// over the whole database. Replaced versions are freed once no reader
+// announced before they were replaced is still running.
+struct ComicDb
+{
+    ComicDb();
+    ComicDb(ComicDb &&rhs) noexcept;
+    ComicDb &operator=(ComicDb &&rhs) noexcept;
+    ~ComicDb();
+
+    struct Storage;
+    std::unique_ptr<Storage> storage;
+};
+
+// All comics as of one sequence number, deleted ones included.
+struct Snapshot
+{
+    std::uint64_t              sequence{};
+    std::vector<Comic>         comics;
+    std::vector<std::uint64_t> versions;
+};
+
+// A comic with the sequence number of its last change, which serves as
+// its version for conditional writes.
+struct VersionedComic
+{
+    std::size_t   id{};
+    std::uint64_t version{};
+    Comic         comic; // deleted when the last change was a delete
+};
+
+// The current state of every comic changed after a version; unlike a
+// ChangeBatch it never needs a resync, as it does not depend on the log.
+struct Delta
+{
+    std::uint64_t               version{}; // the database's last sequence number
+    std::vector<VersionedComic> comics;    // in id order
+};
+
+// Changes read from the feed; resync means that changes were dropped
+// from the log before they were read, so the reader has to start over
+// from a snapshot.
+struct ChangeBatch
+{
+    std::uint64_t       sequence{}; // the primary's last sequence number
+    bool                resync{};
+    std::vector<Change> changes;
+};
 
 ComicDb load();
 Comic readComic(const ComicDb &db, std::size_t id);
@@ -32,6 +122,133 @@ void deleteComic(ComicDb &db, std::size_t id);
 void updateComic(ComicDb &db, std::size_t id, const Comic &comic);
 std::size_t createComic(ComicDb &db, Comic &&comic);
 
+// Read-modify-write; the edit is applied to the latest version of the
+// comic, and applied again to a newer one whenever another writer
+// commits first. Returns the comic's new version.
+using ComicEdit = std::function<void(Comic &comic)>;
+std::uint64_t modifyComic(ComicDb &db, std::size_t id, const ComicEdit &edit);
+
+// Commits, and compare-and-swaps lost to another writer and retried.
+struct WriteStats
+{
+    std::uint64_t commits{};
+    std::uint64_t retries{};
+};
+WriteStats writeStats(const ComicDb &db);
+
+// A consistent view of the database as of the sequence number it was
+// pinned at. Reading through it takes no lock and writers carry on
+// meanwhile; the versions it can see are kept while it lives, and those
+// no view can see any more are garbage-collected. A view takes one of
+// the database's reader slots only for the length of each read, so any
+// number of views may be alive, and a long-lived one holds back the
+// collection of just the versions it sees. The one exception to the view
+// being as of its pin is the names of persons: versions share persons,
+// so a view shows names as renamed and merged since its pin, although
+// the comics concerned have new versions it does not see.
+class PinnedView
+{
+public:
+    explicit PinnedView(const ComicDb &db);
+    PinnedView(const PinnedView &rhs) = delete;
+    PinnedView &operator=(const PinnedView &rhs) = delete;
+    ~PinnedView();
+
+    std::uint64_t sequence() const
+    {
+        return m_sequence;
+    }
+    // Returns the number of ids, deleted comics included, as of the view.
+    std::size_t size() const
+    {
+        return m_size;
+    }
+    Comic readComic(std::size_t id) const;
+    // Visits the comics that exist as of the view, in id order.
+    void forEachComic(const std::function<void(std::size_t id, const Comic &comic)> &visit) const;
+
+private:
+    ComicDb::Storage &m_storage;
+    std::uint64_t     m_sequence{};
+    std::size_t       m_size{};
+};
+
+// Pinned views, and the older versions kept for them.
+struct HistoryStats
+{
+    std::size_t   pinnedViews{};
+    std::size_t   keptVersions{};
+    std::uint64_t collectedVersions{};
+};
+HistoryStats historyStats(const ComicDb &db);
+
+// Versions start at 1. The conditional writes return the comic's new
+// version, or NO_VERSION without changing anything when the comic is no
+// longer at the given version.
+constexpr std::uint64_t NO_VERSION = 0;
+VersionedComic readVersionedComic(const ComicDb &db, std::size_t id);
+std::uint64_t updateComicIfVersion(ComicDb &db, std::size_t id, const Comic &comic, std::uint64_t version);
+std::uint64_t deleteComicIfVersion(ComicDb &db, std::size_t id, std::uint64_t version);
+Delta changedSince(const ComicDb &db, std::uint64_t version);
+
+// One write of a transaction; id is ignored for Create, and comic for
+// Delete. An update or delete with a version other than NO_VERSION is
+// conditional on the comic still being at that version.
+struct Mutation
+{
+    Change::Kind  kind{Change::Kind::Update};
+    std::size_t   id{};
+    Comic         comic;
+    std::uint64_t ifVersion{NO_VERSION};
+};
+using Transaction = std::vector<Mutation>;
+
+struct TransactionResult
+{
+    std::uint64_t            version{}; // of every comic written, or NO_VERSION if nothing was
+    std::vector<std::size_t> ids;       // of the comics written, in mutation order
+};
+
+// Applies all of the mutations, or none of them when a condition fails,
+// under the lock shared with other writes of more than one comic, and as
+// one change in the log. Invalid comics, unknown ids and an id written
+// twice throw before anything is written.
+TransactionResult commitTransaction(ComicDb &db, const Transaction &transaction);
+
+// Mirrors; a mirror applies deltas of another database, keeping its ids
+// and versions, and records no changes of its own.
+void applyDelta(ComicDb &mirror, const Delta &delta);
+
+// The comics crediting a person, under their name or the name of anyone
+// merged into them, found through an index that each commit keeps up to
+// date rather than by scanning the comics.
+struct PersonCredits
+{
+    std::string              name;   // the person's current name
+    std::vector<std::size_t> comics; // in id order
+};
+PersonCredits personCredits(const ComicDb &db, const std::string &name);
+
+// Renames and merges of persons, logged so that replicas follow them.
+// The persons change in constant time, but every comic whose credits are
+// renamed, found through the credits index, also gets a new version with
+// the change's sequence number, so that writes conditional on an older
+// version fail and delta sync sends the comic again. They throw like
+// their counterparts in comic.h.
+void renamePerson(ComicDb &db, const std::string &name, const std::string &newName);
+void mergePersons(ComicDb &db, const std::string &from, const std::string &into);
+
+// Change feed
+void setChangeListener(ComicDb &db, ChangeListener listener);
+std::uint64_t lastSequence(const ComicDb &db);
+ChangeBatch changesSince(const ComicDb &db, std::uint64_t since, std::size_t limit);
+Snapshot snapshot(const ComicDb &db);
+
+// Replication; a replica restores a snapshot of the primary and then
+// applies the primary's changes in sequence order.
+void restore(ComicDb &db, Snapshot &&snapshot);
+void applyChange(ComicDb &db, const Change &change);
+
 }
 
 } // namespace comicsdb
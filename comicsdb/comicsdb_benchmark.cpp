@@ -0,0 +1,237 @@
+//
+// Compares ComicDb, whose readers take no lock and whose writers
+// compare-and-swap versions, with the design it replaced: one mutex held
+// by every read and write, writes appending to the change log under it.
+//
+// The second measurement runs full scans, which need a consistent view,
+// alongside writers: the old design holds the mutex for the whole scan,
+// ComicDb scans a pinned view.
+//
+// Usage: comicsdb_benchmark [<threads> [<operations per thread> [<write percent>]]]
+//
+#include "comicsdb.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace Comics = comicsdb::v2;
+
+namespace
+{
+
+constexpr std::size_t NUM_COMICS = 1000;
+
+Comics::Comic makeComic(int issue)
+{
+    Comics::Comic comic;
+    comic.title = "The Fantastic Four";
+    comic.issue = issue;
+    comic.script = Comics::findPerson("Stan Lee");
+    comic.pencils = Comics::findPerson("Jack Kirby");
+    comic.inks = Comics::findPerson("George Klein");
+    comic.letters = Comics::findPerson("Artie Simek");
+    comic.colors = Comics::findPerson("Stan Goldberg");
+    return comic;
+}
+
+// The previous design, reduced to what the workload touches
+class LockedDb
+{
+public:
+    LockedDb() :
+        m_comics(NUM_COMICS, makeComic(1))
+    {
+    }
+
+    Comics::Comic read(std::size_t id)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return m_comics[id];
+    }
+
+    void update(std::size_t id, const Comics::Comic &comic)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_comics[id] = comic;
+        m_changes.push_back(comic);
+        if (m_changes.size() > Comics::CHANGE_LOG_CAPACITY)
+        {
+            m_changes.pop_front();
+        }
+    }
+
+    // Returns the number of comics inked by George Klein
+    std::size_t scan()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return std::count_if(m_comics.begin(), m_comics.end(),
+                             [](const Comics::Comic &comic) { return comic.inks->name() == "George Klein"; });
+    }
+
+private:
+    std::mutex                 m_mutex;
+    std::vector<Comics::Comic> m_comics;
+    std::deque<Comics::Comic>  m_changes;
+};
+
+class VersionedDb
+{
+public:
+    VersionedDb()
+    {
+        for (std::size_t id = 0; id < NUM_COMICS; ++id)
+        {
+            createComic(m_db, makeComic(1));
+        }
+    }
+
+    Comics::Comic read(std::size_t id)
+    {
+        return readComic(m_db, id);
+    }
+
+    void update(std::size_t id, const Comics::Comic &comic)
+    {
+        updateComic(m_db, id, comic);
+    }
+
+    std::size_t scan()
+    {
+        const Comics::PinnedView view(m_db);
+        std::size_t              count{};
+        view.forEachComic([&count](std::size_t, const Comics::Comic &comic)
+                          { count += comic.inks->name() == "George Klein" ? 1 : 0; });
+        return count;
+    }
+
+    std::uint64_t retries() const
+    {
+        return writeStats(m_db).retries;
+    }
+
+private:
+    Comics::ComicDb m_db;
+};
+
+// Returns operations per second over all threads
+template <typename Db>
+double measure(Db &db, int threads, int operations, int writePercent)
+{
+    const Comics::Comic      comic = makeComic(2);
+    std::vector<std::thread> workers;
+    const auto               begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back(
+            [&, t]
+            {
+                std::mt19937                               random(t);
+                std::uniform_int_distribution<std::size_t> ids(0, NUM_COMICS - 1);
+                std::uniform_int_distribution<int>         percent(0, 99);
+                for (int i = 0; i < operations; ++i)
+                {
+                    const std::size_t id = ids(random);
+                    if (percent(random) < writePercent)
+                    {
+                        db.update(id, comic);
+                    }
+                    else
+                    {
+                        db.read(id);
+                    }
+                }
+            });
+    }
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return threads * operations / elapsed.count();
+}
+
+struct ScanRates
+{
+    double writes;
+    double scans;
+};
+
+// Runs one thread of full scans alongside writers for a while
+template <typename Db>
+ScanRates measureScans(Db &db, int writers, std::chrono::milliseconds duration)
+{
+    const Comics::Comic      comic = makeComic(2);
+    std::atomic<bool>        done{};
+    std::atomic<std::size_t> writes{};
+    std::size_t              scans{};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < writers; ++t)
+    {
+        workers.emplace_back(
+            [&, t]
+            {
+                std::mt19937                               random(t);
+                std::uniform_int_distribution<std::size_t> ids(0, NUM_COMICS - 1);
+                std::size_t                                count{};
+                while (!done)
+                {
+                    db.update(ids(random), comic);
+                    ++count;
+                }
+                writes += count;
+            });
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - begin < duration)
+    {
+        db.scan();
+        ++scans;
+    }
+    done = true;
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return {writes / elapsed.count(), scans / elapsed.count()};
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    const int threads = argc > 1 ? std::atoi(argv[1]) : static_cast<int>(std::thread::hardware_concurrency());
+    const int operations = argc > 2 ? std::atoi(argv[2]) : 200000;
+    const int writePercent = argc > 3 ? std::atoi(argv[3]) : 10;
+
+    LockedDb     locked;
+    VersionedDb  versioned;
+    const double lockedRate = measure(locked, threads, operations, writePercent);
+    const double versionedRate = measure(versioned, threads, operations, writePercent);
+
+    std::printf("%d threads, %d operations each, %d%% writes, %zu comics\n", threads, operations, writePercent,
+                NUM_COMICS);
+    std::printf("%-16s %14s %10s\n", "design", "ops/s", "retries");
+    std::printf("%-16s %14.0f %10s\n", "global mutex", lockedRate, "-");
+    std::printf("%-16s %14.0f %10llu\n", "versioned CAS", versionedRate,
+                static_cast<unsigned long long>(versioned.retries()));
+
+    const int                       writers = std::max(1, threads - 1);
+    const std::chrono::milliseconds duration{1000};
+    const ScanRates                 lockedScans = measureScans(locked, writers, duration);
+    const ScanRates                 pinnedScans = measureScans(versioned, writers, duration);
+
+    std::printf("\n1 scanning thread, %d writing threads, %zu comics\n", writers, NUM_COMICS);
+    std::printf("%-16s %14s %10s\n", "scan", "writes/s", "scans/s");
+    std::printf("%-16s %14.0f %10.0f\n", "global mutex", lockedScans.writes, lockedScans.scans);
+    std::printf("%-16s %14.0f %10.0f\n", "pinned view", pinnedScans.writes, pinnedScans.scans);
+    return 0;
+}
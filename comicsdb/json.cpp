@@ -1,4 +1,4 @@
-#include "comic.h"
+#include "json.h"
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
@@ -52,36 +52,46 @@ Comic fromJson(const std::string &json)
 namespace v2
 {
 
-std::string toJson(const Comic &comic)
+namespace
 {
-    rapidjson::Document doc;
-    rapidjson::Value &obj = doc.SetObject();
-    auto addMember = [&obj, &doc](const char *key, const std::string &value)
-    {
-        using String = rapidjson::GenericStringRef<char>;
-        obj.AddMember(String{key}, String{value.c_str()}, doc.GetAllocator());
-    };
+
+using String = rapidjson::GenericStringRef<char>;
+
+void addComic(rapidjson::Value &obj, const Comic &comic, rapidjson::Document::AllocatorType &allocator)
+{
+    auto addMember = [&obj, &allocator](const char *key, const std::string &value)
+    { obj.AddMember(String{key}, String{value.c_str()}, allocator); };
     addMember("title", comic.title);
-    obj.AddMember("issue", comic.issue, doc.GetAllocator());
-    addMember("script", comic.script->name);
-    addMember("pencils", comic.pencils->name);
-    addMember("inks", comic.inks->name);
-    addMember("letters", comic.letters->name);
-    addMember("colors", comic.colors->name);
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    doc.Accept(writer);
-    return buffer.GetString();
+    obj.AddMember("issue", comic.issue, allocator);
+    addMember("script", comic.script->name());
+    addMember("pencils", comic.pencils->name());
+    addMember("inks", comic.inks->name());
+    addMember("letters", comic.letters->name());
+    addMember("colors", comic.colors->name());
 }
 
-Comic fromJson(const std::string &json)
+// Deleted comics have no persons to write
+rapidjson::Value comicValue(const Comic &comic, rapidjson::Document::AllocatorType &allocator)
 {
-    rapidjson::Document doc;
-    doc.Parse(json.c_str());
+    rapidjson::Value value;
+    if (comic.issue != Comic::DELETED_ISSUE)
+    {
+        value.SetObject();
+        addComic(value, comic, allocator);
+    }
+    return value;
+}
+
+Comic comicFromValue(const rapidjson::Value &value)
+{
+    if (value.IsNull())
+    {
+        return Comic{};
+    }
     Comic comic{};
-    auto getString = [&doc](const char *key) { return doc[key].GetString(); };
+    auto getString = [&value](const char *key) { return value[key].GetString(); };
     comic.title = getString("title");
-    comic.issue = doc["issue"].GetInt();
+    comic.issue = value["issue"].GetInt();
     const std::string writer = getString("script");
     comic.script = findPerson(writer);
     const std::string penciler = getString("pencils");
@@ -95,6 +105,316 @@ Comic fromJson(const std::string &json)
     return comic;
 }
 
+const char *kindName(Change::Kind kind)
+{
+    switch (kind)
+    {
+    case Change::Kind::Create:
+        return "create";
+    case Change::Kind::Update:
+        return "update";
+    case Change::Kind::Delete:
+        return "delete";
+    case Change::Kind::Transaction:
+        return "transaction";
+    case Change::Kind::RenamePerson:
+        return "renamePerson";
+    case Change::Kind::MergePersons:
+        return "mergePersons";
+    }
+    return "update";
+}
+
+Change::Kind kindFromName(const std::string &name)
+{
+    if (name == "create")
+        return Change::Kind::Create;
+    if (name == "delete")
+        return Change::Kind::Delete;
+    if (name == "transaction")
+        return Change::Kind::Transaction;
+    if (name == "renamePerson")
+        return Change::Kind::RenamePerson;
+    if (name == "mergePersons")
+        return Change::Kind::MergePersons;
+    return Change::Kind::Update;
+}
+
+bool isPersonChange(Change::Kind kind)
+{
+    return kind == Change::Kind::RenamePerson || kind == Change::Kind::MergePersons;
+}
+
+// Transactions carry their changes, which carry no further ones; person
+// changes carry names, and the ids of the comics given new versions, as
+// the replica writes its own copies of them
+rapidjson::Value changeValue(const Change &change, rapidjson::Document::AllocatorType &allocator)
+{
+    rapidjson::Value obj(rapidjson::kObjectType);
+    obj.AddMember("sequence", change.sequence, allocator);
+    obj.AddMember("kind", String{kindName(change.kind)}, allocator);
+    obj.AddMember("time", change.timeMs, allocator);
+    if (isPersonChange(change.kind))
+    {
+        obj.AddMember("name", String{change.name.c_str()}, allocator);
+        obj.AddMember("newName", String{change.newName.c_str()}, allocator);
+        rapidjson::Value ids(rapidjson::kArrayType);
+        for (const Change &part : change.changes)
+        {
+            ids.PushBack(static_cast<std::uint64_t>(part.id), allocator);
+        }
+        obj.AddMember("ids", ids, allocator);
+        return obj;
+    }
+    if (change.kind != Change::Kind::Transaction)
+    {
+        obj.AddMember("id", static_cast<std::uint64_t>(change.id), allocator);
+        obj.AddMember("comic", comicValue(change.comic, allocator), allocator);
+        return obj;
+    }
+    rapidjson::Value changes(rapidjson::kArrayType);
+    for (const Change &part : change.changes)
+    {
+        changes.PushBack(changeValue(part, allocator), allocator);
+    }
+    obj.AddMember("changes", changes, allocator);
+    return obj;
+}
+
+Change changeFromValue(const rapidjson::Value &obj)
+{
+    Change change;
+    change.sequence = obj["sequence"].GetUint64();
+    change.kind = kindFromName(obj["kind"].GetString());
+    change.timeMs = obj["time"].GetInt64();
+    if (isPersonChange(change.kind))
+    {
+        change.name = obj["name"].GetString();
+        change.newName = obj["newName"].GetString();
+        for (const rapidjson::Value &id : obj["ids"].GetArray())
+        {
+            Change part;
+            part.sequence = change.sequence;
+            part.id = static_cast<std::size_t>(id.GetUint64());
+            change.changes.push_back(std::move(part));
+        }
+        return change;
+    }
+    if (change.kind != Change::Kind::Transaction)
+    {
+        change.id = static_cast<std::size_t>(obj["id"].GetUint64());
+        change.comic = comicFromValue(obj["comic"]);
+        return change;
+    }
+    for (const rapidjson::Value &part : obj["changes"].GetArray())
+    {
+        change.changes.push_back(changeFromValue(part));
+    }
+    return change;
+}
+
+std::string toString(const rapidjson::Document &doc)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    doc.Accept(writer);
+    return buffer.GetString();
+}
+
+} // namespace
+
+std::string toJson(const Comic &comic)
+{
+    rapidjson::Document doc;
+    addComic(doc.SetObject(), comic, doc.GetAllocator());
+    return toString(doc);
+}
+
+Comic fromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    return comicFromValue(doc);
+}
+
+std::string toJson(const Snapshot &snapshot)
+{
+    rapidjson::Document doc;
+    auto &allocator = doc.GetAllocator();
+    doc.SetObject();
+    doc.AddMember("sequence", snapshot.sequence, allocator);
+    rapidjson::Value comics(rapidjson::kArrayType);
+    for (const Comic &comic : snapshot.comics)
+    {
+        comics.PushBack(comicValue(comic, allocator), allocator);
+    }
+    doc.AddMember("comics", comics, allocator);
+    rapidjson::Value versions(rapidjson::kArrayType);
+    for (std::uint64_t version : snapshot.versions)
+    {
+        versions.PushBack(version, allocator);
+    }
+    doc.AddMember("versions", versions, allocator);
+    return toString(doc);
+}
+
+Snapshot snapshotFromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    Snapshot snapshot;
+    snapshot.sequence = doc["sequence"].GetUint64();
+    for (const rapidjson::Value &comic : doc["comics"].GetArray())
+    {
+        snapshot.comics.push_back(comicFromValue(comic));
+    }
+    if (doc.HasMember("versions"))
+    {
+        for (const rapidjson::Value &version : doc["versions"].GetArray())
+        {
+            snapshot.versions.push_back(version.GetUint64());
+        }
+    }
+    return snapshot;
+}
+
+std::string toJson(const ChangeBatch &batch)
+{
+    rapidjson::Document doc;
+    auto &allocator = doc.GetAllocator();
+    doc.SetObject();
+    doc.AddMember("sequence", batch.sequence, allocator);
+    doc.AddMember("resync", batch.resync, allocator);
+    rapidjson::Value changes(rapidjson::kArrayType);
+    for (const Change &change : batch.changes)
+    {
+        changes.PushBack(changeValue(change, allocator), allocator);
+    }
+    doc.AddMember("changes", changes, allocator);
+    return toString(doc);
+}
+
+ChangeBatch changeBatchFromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    ChangeBatch batch;
+    batch.sequence = doc["sequence"].GetUint64();
+    batch.resync = doc["resync"].GetBool();
+    for (const rapidjson::Value &obj : doc["changes"].GetArray())
+    {
+        batch.changes.push_back(changeFromValue(obj));
+    }
+    return batch;
+}
+
+std::string toJson(const Delta &delta)
+{
+    rapidjson::Document doc;
+    auto &allocator = doc.GetAllocator();
+    doc.SetObject();
+    doc.AddMember("version", delta.version, allocator);
+    rapidjson::Value comics(rapidjson::kArrayType);
+    for (const VersionedComic &changed : delta.comics)
+    {
+        rapidjson::Value obj(rapidjson::kObjectType);
+        obj.AddMember("id", static_cast<std::uint64_t>(changed.id), allocator);
+        obj.AddMember("version", changed.version, allocator);
+        obj.AddMember("comic", comicValue(changed.comic, allocator), allocator);
+        comics.PushBack(obj, allocator);
+    }
+    doc.AddMember("comics", comics, allocator);
+    return toString(doc);
+}
+
+Delta deltaFromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    Delta delta;
+    delta.version = doc["version"].GetUint64();
+    for (const rapidjson::Value &obj : doc["comics"].GetArray())
+    {
+        VersionedComic changed;
+        changed.id = static_cast<std::size_t>(obj["id"].GetUint64());
+        changed.version = obj["version"].GetUint64();
+        changed.comic = comicFromValue(obj["comic"]);
+        delta.comics.push_back(std::move(changed));
+    }
+    return delta;
+}
+
+Transaction transactionFromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    Transaction transaction;
+    for (const rapidjson::Value &obj : doc["mutations"].GetArray())
+    {
+        Mutation mutation;
+        mutation.kind = kindFromName(obj["kind"].GetString());
+        if (obj.HasMember("id"))
+        {
+            mutation.id = static_cast<std::size_t>(obj["id"].GetUint64());
+        }
+        if (obj.HasMember("comic"))
+        {
+            mutation.comic = comicFromValue(obj["comic"]);
+        }
+        if (obj.HasMember("ifVersion"))
+        {
+            mutation.ifVersion = obj["ifVersion"].GetUint64();
+        }
+        transaction.push_back(std::move(mutation));
+    }
+    return transaction;
+}
+
+std::string toJson(const TransactionResult &result)
+{
+    rapidjson::Document doc;
+    auto &allocator = doc.GetAllocator();
+    doc.SetObject();
+    doc.AddMember("version", result.version, allocator);
+    rapidjson::Value ids(rapidjson::kArrayType);
+    for (std::size_t id : result.ids)
+    {
+        ids.PushBack(static_cast<std::uint64_t>(id), allocator);
+    }
+    doc.AddMember("ids", ids, allocator);
+    return toString(doc);
+}
+
+std::string toJson(const PersonCredits &credits)
+{
+    rapidjson::Document doc;
+    auto &allocator = doc.GetAllocator();
+    doc.SetObject();
+    doc.AddMember("name", String{credits.name.c_str()}, allocator);
+    rapidjson::Value comics(rapidjson::kArrayType);
+    for (std::size_t id : credits.comics)
+    {
+        comics.PushBack(static_cast<std::uint64_t>(id), allocator);
+    }
+    doc.AddMember("comics", comics, allocator);
+    return toString(doc);
+}
+
+std::map<std::string, std::string> stringsFromJson(const std::string &json)
+{
+    rapidjson::Document doc;
+    doc.Parse(json.c_str());
+    std::map<std::string, std::string> strings;
+    for (const auto &member : doc.GetObject())
+    {
+        if (member.value.IsString())
+        {
+            strings.emplace(member.name.GetString(), member.value.GetString());
+        }
+    }
+    return strings;
+}
+
 } // namespace v2
 
 } // namespace comicsdb
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "comic.h"
+#include "comicsdb.h"
 
+#include <map>
 #include <string>
 
 namespace comicsdb
@@ -21,6 +23,26 @@ namespace v2
 std::string toJson(const Comic &comic);
 Comic fromJson(const std::string &json);
 
+// Replication feed; deleted comics are written as null.
+std::string toJson(const Snapshot &snapshot);
+Snapshot snapshotFromJson(const std::string &json);
+std::string toJson(const ChangeBatch &batch);
+ChangeBatch changeBatchFromJson(const std::string &json);
+
+// Delta sync; deleted comics are written as null.
+std::string toJson(const Delta &delta);
+Delta deltaFromJson(const std::string &json);
+
+// Transactions; mutations are objects with a kind, an id unless they
+// create, a comic unless they delete and an optional ifVersion.
+Transaction transactionFromJson(const std::string &json);
+std::string toJson(const TransactionResult &result);
+
+// Persons; the bodies of person requests are objects of string members,
+// such as the name and new name of a rename.
+std::string toJson(const PersonCredits &credits);
+std::map<std::string, std::string> stringsFromJson(const std::string &json);
+
 } // namespace v2
 
 } // namespace comicsdb
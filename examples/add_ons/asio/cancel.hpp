@@ -0,0 +1,248 @@
+#pragma once
+#ifndef INC_ASIO_CANCEL_HPP_
+#define INC_ASIO_CANCEL_HPP_
+
+//
+// Cancellation tokens and deadlines for the promisified operations of
+// io.hpp, given to the overloads in cancellable_io.hpp
+//
+// A cancel_token is passed to each operation of a chain. Cancelling it,
+// or reaching its deadline, cancels every operation of the chain still
+// in flight, which then rejects with boost::asio::error::operation_aborted,
+// and rejects every later operation given the token right away.
+//
+// Operations that asio supports per-operation cancellation for are
+// cancelled through a cancellation slot bound to their handler, which
+// needs Boost 1.77 or later. The resolver and beast's http operations,
+// and all operations with older Boost, are cancelled by calling cancel()
+// on their I/O object. Tokens are not thread safe; use them on the
+// thread that runs the operations.
+//
+// Classes --
+//   class cancel_token;
+//
+// Functions --
+//   void cancel_token::cancel();
+//   bool cancel_token::cancelled() const;
+//   void cancel_token::expires_after(boost::asio::io_service &io, uint64_t time_ms);
+//   void cancel_token::release();
+//
+// Example --
+//   cancel_token token;
+//   token.expires_after(io, 5000);
+//   async_resolve(resolver, host, port, token).then([=](results_type &results) {
+//       return async_connect(socket, results, token);
+//   }).finally([=] {
+//       token.release();
+//   });
+//
+
+#include "promise-cpp/promise.hpp"
+#include "add_ons/asio/timer.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
+#include <boost/asio/error.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 107700
+#include <boost/asio/bind_cancellation_slot.hpp>
+#include <boost/asio/cancellation_signal.hpp>
+#endif
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace promise {
+namespace detail {
+
+// An operation in flight, linked into its token's list until it completes
+struct cancel_hook {
+    cancel_hook *prev = nullptr;
+    cancel_hook *next = nullptr;
+
+    virtual ~cancel_hook() = default;
+    virtual void cancel() = 0;
+
+    bool linked() const {
+        return prev != nullptr;
+    }
+};
+
+// Cancels an operation by cancelling its I/O object
+template<typename IoObject>
+struct object_cancel_hook : cancel_hook {
+    explicit object_cancel_hook(IoObject &object)
+        : object_(object) {
+    }
+
+    void cancel() override {
+        boost::system::error_code ignored;
+        cancel_object(object_, ignored);
+    }
+
+private:
+    // Resolvers have no error_code overload of cancel()
+    template<typename T>
+    static auto cancel_object(T &object, boost::system::error_code &err) -> decltype(object.cancel(err), void()) {
+        object.cancel(err);
+    }
+    template<typename T>
+    static void cancel_object(T &object, ...) {
+        object.cancel();
+    }
+
+    IoObject &object_;
+};
+
+#if BOOST_VERSION >= 107700
+// Cancels an operation through the cancellation slot bound to its handler
+struct slot_cancel_hook : cancel_hook {
+    boost::asio::cancellation_signal signal;
+
+    void cancel() override {
+        signal.emit(boost::asio::cancellation_type::terminal);
+    }
+};
+#endif
+
+class cancel_state {
+public:
+    cancel_state() {
+        head_.prev = head_.next = &head_;
+    }
+    cancel_state(const cancel_state &) = delete;
+    cancel_state &operator=(const cancel_state &) = delete;
+    ~cancel_state() {
+        // Operations still in flight complete without their token
+        while (head_.next != &head_)
+            unlink(head_.next);
+        release();
+    }
+
+    bool cancelled() const {
+        return cancelled_;
+    }
+
+    void link(cancel_hook *hook) {
+        hook->prev = head_.prev;
+        hook->next = &head_;
+        head_.prev->next = hook;
+        head_.prev = hook;
+    }
+
+    static void unlink(cancel_hook *hook) {
+        if (!hook->linked())
+            return;
+        hook->prev->next = hook->next;
+        hook->next->prev = hook->prev;
+        hook->prev = hook->next = nullptr;
+    }
+
+    void cancel() {
+        cancelled_ = true;
+        while (head_.next != &head_) {
+            cancel_hook *hook = head_.next;
+            unlink(hook);
+            hook->cancel();
+        }
+        release();
+    }
+
+    void expires_after(boost::asio::io_service &io, uint64_t time_ms, std::weak_ptr<cancel_state> self) {
+        release();
+        deadline_ = delay(io, time_ms).then([self]() {
+            if (auto state = self.lock())
+                state->cancel();
+        });
+    }
+
+    void release() {
+        if (deadline_) {
+            Promise deadline = std::move(*deadline_);
+            deadline_.reset();
+            cancelDelay(deadline);
+        }
+    }
+
+private:
+    struct sentinel : cancel_hook {
+        void cancel() override {
+        }
+    };
+
+    sentinel head_;
+    bool cancelled_ = false;
+    std::optional<Promise> deadline_;
+};
+
+}
+
+class cancel_token {
+public:
+    cancel_token()
+        : state_(std::allocate_shared<detail::cancel_state>(pool_memory::pool_allocator<detail::cancel_state>{})) {
+    }
+
+    // Cancels the operations in flight and rejects those started later
+    void cancel() const {
+        state_->cancel();
+    }
+
+    bool cancelled() const {
+        return state_->cancelled();
+    }
+
+    // Cancels the token after time_ms, replacing any earlier deadline
+    void expires_after(boost::asio::io_service &io, uint64_t time_ms) const {
+        state_->expires_after(io, time_ms, state_);
+    }
+
+    // Stops the deadline's timer once the chain has settled
+    void release() const {
+        state_->release();
+    }
+
+    // Returns a hook registered for an operation on object, or null when
+    // the token is already cancelled; complete() it in the handler.
+    template<typename IoObject>
+    std::shared_ptr<detail::cancel_hook> track(IoObject &object) const {
+        using hook = detail::object_cancel_hook<IoObject>;
+        return link(std::allocate_shared<hook>(pool_memory::pool_allocator<hook>{}, object));
+    }
+
+#if BOOST_VERSION >= 107700
+    // As track(), for an operation whose handler is bound to the hook's
+    // slot with bind_slot()
+    std::shared_ptr<detail::slot_cancel_hook> track_slot() const {
+        using hook = detail::slot_cancel_hook;
+        return link(std::allocate_shared<hook>(pool_memory::pool_allocator<hook>{}));
+    }
+
+    template<typename Handler>
+    static auto bind_slot(const std::shared_ptr<detail::slot_cancel_hook> &hook, Handler &&handler) {
+        return boost::asio::bind_cancellation_slot(hook->signal.slot(), std::forward<Handler>(handler));
+    }
+#endif
+
+    static void complete(const std::shared_ptr<detail::cancel_hook> &hook) {
+        detail::cancel_state::unlink(hook.get());
+    }
+
+    // Rejects defer with operation_aborted; for operations started after cancel()
+    static void reject_cancelled(Defer &defer) {
+        defer.reject(boost::system::error_code{boost::asio::error::operation_aborted});
+    }
+
+private:
+    template<typename Hook>
+    std::shared_ptr<Hook> link(std::shared_ptr<Hook> hook) const {
+        if (state_->cancelled())
+            return nullptr;
+        state_->link(hook.get());
+        return hook;
+    }
+
+    std::shared_ptr<detail::cancel_state> state_;
+};
+
+}
+#endif
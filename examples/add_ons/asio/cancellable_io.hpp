@@ -0,0 +1,159 @@
+#pragma once
+#ifndef INC_ASIO_CANCELLABLE_IO_HPP_
+#define INC_ASIO_CANCELLABLE_IO_HPP_
+
+//
+// Overloads of the promisified operations of io.hpp that take a
+// cancel_token, kept apart so that io.hpp does not pull the timer wheel
+// and the pool allocator into every user.
+//
+// async_connect and async_write_buffers bind a cancellation slot to
+// their handler with Boost 1.77 or later and cancel the socket
+// otherwise; see cancel.hpp.
+//
+// Functions --
+//   Promise async_resolve(resolver, host, port, token);
+//   Promise async_connect(socket, results, token);
+//   Promise async_read(stream, buffer, content, token);
+//   Promise async_read_header(stream, buffer, parser, token);
+//   Promise async_write(stream, content, token);
+//   Promise async_write_buffers(stream, buffers, token);
+//
+// Example --
+//   cancel_token token;
+//   token.expires_after(io, 5000);
+//   async_write(stream, request, token).then([=] {
+//       return async_read(stream, buffer, response, token);
+//   }).finally([=] {
+//       token.release();
+//   });
+//
+
+#include "add_ons/asio/io.hpp"
+#include "add_ons/asio/cancel.hpp"
+
+namespace promise{
+
+template<typename Resolver>
+inline Promise async_resolve(
+    Resolver &resolver,
+    const std::string &host, const std::string &port,
+    const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+        auto hook = token.track(resolver);
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        resolver.async_resolve(
+            host,
+            port,
+            [defer, hook](boost::system::error_code err,
+                typename Resolver::results_type results) {
+                cancel_token::complete(hook);
+                setPromise(defer, err, "resolve", results);
+        });
+    });
+}
+
+template<typename ResolverResult, typename Socket>
+inline Promise async_connect(
+    Socket &socket,
+    const ResolverResult &results,
+    const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+#if BOOST_VERSION >= 107700
+        auto hook = token.track_slot();
+#else
+        auto hook = token.track(socket);
+#endif
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        auto handler = [defer, hook](boost::system::error_code err,
+            typename ResolverResult::iterator i) {
+            cancel_token::complete(hook);
+            setPromise(defer, err, "connect", i);
+        };
+#if BOOST_VERSION >= 107700
+        boost::asio::async_connect(socket, results.begin(), results.end(),
+            cancel_token::bind_slot(hook, std::move(handler)));
+#else
+        boost::asio::async_connect(socket, results.begin(), results.end(), std::move(handler));
+#endif
+    });
+}
+
+template<typename Stream, typename Buffer, typename Content>
+inline Promise async_read(Stream &stream,
+    Buffer &buffer,
+    Content &content,
+    const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+        auto hook = token.track(boost::beast::get_lowest_layer(stream));
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        boost::beast::http::async_read(stream, buffer, content,
+            [defer, hook](boost::system::error_code err,
+                std::size_t bytes_transferred) {
+                cancel_token::complete(hook);
+                setPromise(defer, err, "read", bytes_transferred);
+        });
+    });
+}
+
+template<typename Stream, typename Buffer, typename Parser>
+inline Promise async_read_header(Stream &stream,
+    Buffer &buffer,
+    Parser &parser,
+    const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+        auto hook = token.track(boost::beast::get_lowest_layer(stream));
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        boost::beast::http::async_read_header(stream, buffer, parser,
+            [defer, hook](boost::system::error_code err,
+                std::size_t bytes_transferred) {
+                cancel_token::complete(hook);
+                setPromise(defer, err, "read_header", bytes_transferred);
+        });
+    });
+}
+
+template<typename Stream, typename Content>
+inline Promise async_write(Stream &stream, Content &content, const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+        auto hook = token.track(boost::beast::get_lowest_layer(stream));
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        boost::beast::http::async_write(stream, content,
+            [defer, hook](boost::system::error_code err,
+                std::size_t bytes_transferred) {
+                cancel_token::complete(hook);
+                setPromise(defer, err, "write", bytes_transferred);
+        });
+    });
+}
+
+template<typename Stream, typename ConstBufferSequence>
+inline Promise async_write_buffers(Stream &stream, const ConstBufferSequence &buffers, const cancel_token &token) {
+    return newPromise([&](Defer &defer) {
+#if BOOST_VERSION >= 107700
+        auto hook = token.track_slot();
+#else
+        auto hook = token.track(stream);
+#endif
+        if (!hook)
+            return cancel_token::reject_cancelled(defer);
+        auto handler = [defer, hook](boost::system::error_code err,
+            std::size_t bytes_transferred) {
+            cancel_token::complete(hook);
+            setPromise(defer, err, "write", bytes_transferred);
+        };
+#if BOOST_VERSION >= 107700
+        boost::asio::async_write(stream, buffers, cancel_token::bind_slot(hook, std::move(handler)));
+#else
+        boost::asio::async_write(stream, buffers, std::move(handler));
+#endif
+    });
+}
+
+}
+#endif
@@ -0,0 +1,317 @@
+#pragma once
+#ifndef INC_ASIO_COROUTINE_HPP_
+#define INC_ASIO_COROUTINE_HPP_
+
+//
+// C++20 coroutine support for promise-cpp and the asio add-ons
+//
+// A coroutine may return Promise; the promise resolves when the
+// coroutine returns and is rejected with the error_code of an uncaught
+// boost::system::system_error, or the exception itself otherwise. The
+// coroutine frame is allocated from pool_allocator's pool.
+//
+// Inside such a coroutine --
+//   co_await promise;                     resumes when promise settles,
+//                                         throwing system_error if it is
+//                                         rejected with an error_code,
+//                                         rethrowing a std::exception_ptr,
+//                                         or throwing rejected_promise
+//                                         for any other rejection; it
+//                                         does not suspend when promise
+//                                         has already settled
+//   co_await as_awaitable<T>(promise);    the same, returning the resolved T
+//   co_await typed::async_read(...);      any typed_io.hpp operation,
+//                                         returning typed::result<R>
+//   co_await coro::delay(io, time_ms);    returns the timer's error_code
+//   co_await coro::yield(io);             resumes from the io_service queue
+//
+// Example --
+//   Promise echo(tcp::socket &socket, flat_buffer &buffer, request &req) {
+//       auto [err, n] = co_await typed::async_read(socket, buffer, req);
+//       ...
+//   }
+//
+
+#if !defined(__cpp_impl_coroutine)
+#error "add_ons/asio/coroutine.hpp requires C++20 coroutines"
+#endif
+
+#include "promise-cpp/promise.hpp"
+#include "add_ons/asio/typed_io.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/system/system_error.hpp>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace promise {
+
+// The promise_type of coroutines returning Promise
+class coroutine_promise {
+public:
+    Promise get_return_object() {
+        return promise_;
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+        return {};
+    }
+
+    void return_void() {
+        promise_.resolve();
+    }
+
+    void unhandled_exception() {
+        try {
+            throw;
+        }
+        catch (const boost::system::system_error &error) {
+            promise_.reject(error.code());
+        }
+        catch (...) {
+            promise_.reject(std::current_exception());
+        }
+    }
+
+    static void *operator new(std::size_t size) {
+        return pool_memory::detail::pool_allocate(size);
+    }
+
+    static void operator delete(void *p, std::size_t size) noexcept {
+        pool_memory::detail::pool_deallocate(p, size);
+    }
+
+private:
+    Promise promise_ = newPromise([](Defer &) {});
+};
+
+// Thrown by co_await for a promise rejected with neither an error_code
+// nor a std::exception_ptr
+class rejected_promise : public std::runtime_error {
+public:
+    rejected_promise()
+        : std::runtime_error("promise rejected") {
+    }
+};
+
+namespace detail {
+
+// What the promise awaiters share: the rejection, and resuming the
+// coroutine only if it has suspended. The promise's callbacks run
+// within then() when it has already settled, and the coroutine must
+// not be resumed from inside await_suspend; watch() returns false
+// then, so that it carries on without suspending. on_resolved stores
+// the value and calls settle().
+class promise_awaiter_base {
+public:
+    explicit promise_awaiter_base(Promise promise)
+        : promise_(std::move(promise)) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+protected:
+    template<typename OnResolved>
+    bool watch(std::coroutine_handle<> handle, OnResolved on_resolved) {
+        promise_.then(std::move(on_resolved), [this, handle](boost::system::error_code err) {
+            error_ = std::make_exception_ptr(boost::system::system_error(err));
+            settle(handle);
+        }).fail([this, handle](std::exception_ptr error) {
+            error_ = error;
+            settle(handle);
+        }).fail([this, handle]() {
+            error_ = std::make_exception_ptr(rejected_promise());
+            settle(handle);
+        });
+        return !settled_.exchange(true);
+    }
+
+    void settle(std::coroutine_handle<> handle) {
+        if (settled_.exchange(true))
+            handle.resume();
+    }
+
+    void rethrow_rejection() const {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+private:
+    Promise promise_;
+    std::exception_ptr error_;
+    std::atomic<bool> settled_{false};
+};
+
+}
+
+// Awaits a promise that resolves with a T
+template<typename T>
+class promise_awaiter : public detail::promise_awaiter_base {
+public:
+    using promise_awaiter_base::promise_awaiter_base;
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        return watch(handle, [this, handle](T &value) {
+            value_.emplace(std::move(value));
+            settle(handle);
+        });
+    }
+
+    T await_resume() {
+        rethrow_rejection();
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template<>
+class promise_awaiter<void> : public detail::promise_awaiter_base {
+public:
+    using promise_awaiter_base::promise_awaiter_base;
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+        return watch(handle, [this, handle]() {
+            settle(handle);
+        });
+    }
+
+    void await_resume() {
+        rethrow_rejection();
+    }
+};
+
+template<typename T = void>
+inline promise_awaiter<T> as_awaitable(Promise promise) {
+    return promise_awaiter<T>{std::move(promise)};
+}
+
+inline promise_awaiter<void> operator co_await(Promise promise) {
+    return promise_awaiter<void>{std::move(promise)};
+}
+
+namespace typed {
+
+// Awaits a typed operation, which starts when the coroutine suspends
+template<typename Initiation, typename Result>
+class operation_awaiter {
+public:
+    explicit operation_awaiter(operation<Initiation, Result> &&op)
+        : op_(std::move(op)) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        std::move(op_).then([this, handle](boost::system::error_code err, Result value) {
+            result_.emplace(result<Result>{err, std::move(value)});
+            handle.resume();
+        });
+    }
+
+    result<Result> await_resume() {
+        return std::move(*result_);
+    }
+
+private:
+    operation<Initiation, Result> op_;
+    std::optional<result<Result>> result_;
+};
+
+template<typename Initiation, typename Result>
+inline operation_awaiter<Initiation, Result> operator co_await(operation<Initiation, Result> &&op) {
+    return operation_awaiter<Initiation, Result>{std::move(op)};
+}
+
+}
+
+namespace coro {
+
+// Coroutine counterpart of delay(); the timer lives in the coroutine frame
+class delay_awaiter {
+public:
+    delay_awaiter(boost::asio::io_service &io, uint64_t time_ms)
+        : timer_(io, std::chrono::milliseconds(time_ms)) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        timer_.async_wait(typed::pooled_handler{[this, handle](const boost::system::error_code &err) {
+            error_ = err;
+            handle.resume();
+        }});
+    }
+
+    boost::system::error_code await_resume() const noexcept {
+        return error_;
+    }
+
+private:
+    boost::asio::steady_timer timer_;
+    boost::system::error_code error_;
+};
+
+// Coroutine counterpart of yield()
+class yield_awaiter {
+public:
+    explicit yield_awaiter(boost::asio::io_service &io)
+        : io_(io) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        boost::asio::post(io_, typed::pooled_handler{[handle]() {
+            handle.resume();
+        }});
+    }
+
+    void await_resume() const noexcept {
+    }
+
+private:
+    boost::asio::io_service &io_;
+};
+
+inline delay_awaiter delay(boost::asio::io_service &io, uint64_t time_ms) {
+    return delay_awaiter{io, time_ms};
+}
+
+inline yield_awaiter yield(boost::asio::io_service &io) {
+    return yield_awaiter{io};
+}
+
+}
+}
+
+namespace std {
+
+template<typename... Args>
+struct coroutine_traits<::promise::Promise, Args...> {
+    using promise_type = ::promise::coroutine_promise;
+};
+
+}
+
+#endif
@@ -30,6 +30,7 @@
 #include "promise-cpp/promise.hpp"
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/connect.hpp>
+#include <boost/asio/write.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 
@@ -98,6 +99,20 @@ inline Promise async_read(Stream &stream,
     });
 }
 
+template<typename Stream, typename Buffer, typename Parser>
+inline Promise async_read_header(Stream &stream,
+    Buffer &buffer,
+    Parser &parser) {
+    //read the header only, the body is left for async_read
+    return newPromise([&](Defer &defer) {
+        boost::beast::http::async_read_header(stream, buffer, parser,
+            [defer](boost::system::error_code err,
+                std::size_t bytes_transferred) {
+                setPromise(defer, err, "read_header", bytes_transferred);
+        });
+    });
+}
+
 template<typename Stream, typename Content>
 inline Promise async_write(Stream &stream, Content &content) {
     return newPromise([&](Defer &defer) {
@@ -110,6 +125,17 @@ inline Promise async_write(Stream &stream, Content &content) {
     });
 }
 
+template<typename Stream, typename ConstBufferSequence>
+inline Promise async_write_buffers(Stream &stream, const ConstBufferSequence &buffers) {
+    return newPromise([&](Defer &defer) {
+        //write already serialized data
+        boost::asio::async_write(stream, buffers,
+            [defer](boost::system::error_code err,
+                std::size_t bytes_transferred) {
+                setPromise(defer, err, "write", bytes_transferred);
+        });
+    });
+}
 
 }
 #endif
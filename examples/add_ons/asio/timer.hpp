@@ -30,9 +30,15 @@
 //
 // Promisified timer based on promise-cpp and boost::asio
 //
+// delay() and the functions built on it keep their timers in the
+// io_service's timer_wheel, see timer_wheel.hpp; precise_delay() uses
+// a steady_timer of its own for when the wheel's 1 ms ticks are too
+// coarse.
+//
 // Functions --
 //   Promise yield(boost::asio::io_service &io);
 //   Promise delay(boost::asio::io_service &io, uint64_t time_ms);
+//   Promise precise_delay(boost::asio::io_service &io, uint64_t time_ms);
 //   void cancelDelay(Promise promise);
 // 
 //   Promise setTimeout(boost::asio::io_service &io,
@@ -42,6 +48,7 @@
 //
 
 #include "promise-cpp/promise.hpp"
+#include "add_ons/asio/timer_wheel.hpp"
 #include <chrono>
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
@@ -65,6 +72,10 @@ inline Promise yield(boost::asio::io_service &io){
 }
 
 inline Promise delay(boost::asio::io_service &io, uint64_t time_ms) {
+    return boost::asio::use_service<timer_wheel>(io).delay(time_ms);
+}
+
+inline Promise precise_delay(boost::asio::io_service &io, uint64_t time_ms) {
     auto timer = std::make_shared<boost::asio::steady_timer>(io, std::chrono::milliseconds(time_ms));
     return newPromise([timer, &io](Defer &defer) {
         timer->async_wait([defer, timer](const boost::system::error_code& error_code) {
@@ -0,0 +1,317 @@
+#pragma once
+#ifndef INC_ASIO_TIMER_WHEEL_HPP_
+#define INC_ASIO_TIMER_WHEEL_HPP_
+
+//
+// Hierarchical timer wheel behind delay() in timer.hpp
+//
+// Each io_service gets one timer_wheel service. It keeps every pending
+// delay on an intrusive list in one of 4 levels of 64 slots with a
+// resolution of 1 ms, so that adding and cancelling a delay is O(1)
+// and asio's timer queue only ever holds the single timer that ticks
+// the wheel. The wheel only ticks while delays are pending.
+//
+// Classes --
+//   class timer_wheel;      // boost::asio service
+//
+// Functions --
+//   Promise timer_wheel::delay(uint64_t time_ms);
+//
+
+#include "promise-cpp/promise.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+
+namespace promise {
+namespace detail {
+
+struct wheel_entry {
+    wheel_entry *prev = nullptr;
+    wheel_entry *next = nullptr;
+    uint64_t expires = 0;
+
+    bool linked() const {
+        return prev != nullptr;
+    }
+};
+
+// Circular doubly linked list of entries around a sentinel
+class wheel_list {
+public:
+    wheel_list() {
+        head_.prev = head_.next = &head_;
+    }
+    wheel_list(const wheel_list &) = delete;
+    wheel_list &operator=(const wheel_list &) = delete;
+
+    bool empty() const {
+        return head_.next == &head_;
+    }
+
+    void push_back(wheel_entry *entry) {
+        entry->prev = head_.prev;
+        entry->next = &head_;
+        head_.prev->next = entry;
+        head_.prev = entry;
+    }
+
+    // Returns the first entry, unlinked, or null when empty
+    wheel_entry *pop_front() {
+        if (empty())
+            return nullptr;
+        wheel_entry *entry = head_.next;
+        unlink(entry);
+        return entry;
+    }
+
+    static void unlink(wheel_entry *entry) {
+        entry->prev->next = entry->next;
+        entry->next->prev = entry->prev;
+        entry->prev = entry->next = nullptr;
+    }
+
+private:
+    wheel_entry head_;
+};
+
+// Wheel of 4 levels of 64 slots; level n holds the entries due within
+// 64^(n+1) ticks and is cascaded into the level below every 64^n ticks.
+class hierarchical_wheel {
+public:
+    static constexpr unsigned slot_bits = 6;
+    static constexpr unsigned slots = 1u << slot_bits;
+    static constexpr unsigned levels = 4;
+    static constexpr uint64_t span = uint64_t{1} << (slot_bits * levels);
+
+    explicit hierarchical_wheel(uint64_t now = 0)
+        : next_(now) {
+    }
+    hierarchical_wheel(const hierarchical_wheel &) = delete;
+    hierarchical_wheel &operator=(const hierarchical_wheel &) = delete;
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    // The next tick advance() will process
+    uint64_t next_tick() const {
+        return next_;
+    }
+
+    // Only valid while empty; moves the wheel to the current time
+    void reset(uint64_t now) {
+        next_ = now;
+    }
+
+    // Entries already due expire on the next tick
+    void insert(wheel_entry *entry, uint64_t expires) {
+        entry->expires = expires < next_ ? next_ : expires;
+        place(entry);
+        ++size_;
+    }
+
+    void remove(wheel_entry *entry) {
+        if (!entry->linked())
+            return;
+        wheel_list::unlink(entry);
+        --size_;
+    }
+
+    // Returns the earliest tick at which advance() can expire an entry
+    // or has to cascade; the wheel need not be advanced before then.
+    uint64_t next_event() const {
+        uint64_t const boundary = (next_ | (slots - 1)) + 1;
+        for (uint64_t tick = next_; tick < boundary; ++tick) {
+            if (!levels_[0][tick & (slots - 1)].empty())
+                return tick;
+        }
+        return boundary;
+    }
+
+    // Processes all ticks up to and including now, calling
+    // on_expired with each expired entry, already unlinked
+    template<typename OnExpired>
+    void advance(uint64_t now, OnExpired &&on_expired) {
+        while (next_ <= now) {
+            if (empty()) {
+                next_ = now + 1;
+                return;
+            }
+            uint64_t const tick = next_;
+            unsigned const index = tick & (slots - 1);
+            for (unsigned level = 1; level < levels && ((tick >> (slot_bits * (level - 1))) & (slots - 1)) == 0; ++level)
+                cascade(level, (tick >> (slot_bits * level)) & (slots - 1));
+
+            wheel_list &due = levels_[0][index];
+            while (wheel_entry *entry = due.pop_front()) {
+                --size_;
+                on_expired(entry);
+            }
+            ++next_;
+        }
+    }
+
+    // Unlinks every entry, calling on_removed with each
+    template<typename OnRemoved>
+    void clear(OnRemoved &&on_removed) {
+        for (auto &level : levels_) {
+            for (wheel_list &slot : level) {
+                while (wheel_entry *entry = slot.pop_front()) {
+                    --size_;
+                    on_removed(entry);
+                }
+            }
+        }
+    }
+
+private:
+    void place(wheel_entry *entry) {
+        uint64_t expires = entry->expires;
+        uint64_t const delta = expires - next_;
+        unsigned level = 0;
+        while (level + 1 < levels && delta >= (uint64_t{1} << (slot_bits * (level + 1))))
+            ++level;
+        // Beyond the wheel's span the entry waits in the last slot it
+        // reaches and is placed again when that slot is cascaded
+        if (delta >= span)
+            expires = next_ + span - 1;
+        levels_[level][(expires >> (slot_bits * level)) & (slots - 1)].push_back(entry);
+    }
+
+    void cascade(unsigned level, unsigned index) {
+        wheel_list &slot = levels_[level][index];
+        while (wheel_entry *entry = slot.pop_front())
+            place(entry);
+    }
+
+    wheel_list levels_[levels][slots];
+    uint64_t next_;
+    std::size_t size_ = 0;
+};
+
+}
+
+class timer_wheel : public boost::asio::io_context::service {
+public:
+    static inline boost::asio::io_context::id id;
+
+    explicit timer_wheel(boost::asio::io_context &io)
+        : boost::asio::io_context::service(io)
+        , timer_(io)
+        , start_(std::chrono::steady_clock::now()) {
+    }
+
+    // Returns a promise resolved after time_ms; rejecting or otherwise
+    // settling it early removes it from the wheel.
+    Promise delay(uint64_t time_ms) {
+        auto pending = std::allocate_shared<entry>(pool_memory::pool_allocator<entry>{});
+        return newPromise([this, pending, time_ms](Defer &defer) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending->defer = defer;
+            uint64_t const now = current_tick();
+            if (wheel_.empty())
+                wheel_.reset(now);
+            wheel_.insert(pending.get(), now + time_ms);
+            arm();
+        }).finally([this, pending]() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (pending->expired)
+                unlink_expired(pending.get());
+            else
+                wheel_.remove(pending.get());
+            // Break the cycle between the entry and its promise
+            pending->defer.reset();
+        });
+    }
+
+private:
+    struct entry : detail::wheel_entry {
+        std::optional<Defer> defer;
+        bool expired = false;
+    };
+
+    // Entries that expired are on tick()'s list until resolved
+    static void unlink_expired(entry *expired) {
+        if (expired->linked())
+            detail::wheel_list::unlink(expired);
+    }
+
+    void shutdown() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        wheel_.clear([](detail::wheel_entry *removed) {
+            static_cast<entry *>(removed)->defer.reset();
+        });
+    }
+
+    uint64_t current_tick() const {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_).count());
+    }
+
+    // Called with the mutex held; moves the tick earlier when a new
+    // entry is due before the pending one
+    void arm() {
+        if (wheel_.empty())
+            return;
+        uint64_t const next = wheel_.next_event();
+        if (armed_ && next >= armed_at_)
+            return;
+        armed_ = true;
+        armed_at_ = next;
+        timer_.expires_at(start_ + std::chrono::milliseconds(next));
+        timer_.async_wait([this](const boost::system::error_code &err) {
+            if (!err)
+                tick();
+        });
+    }
+
+    void tick() {
+        detail::wheel_list expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            armed_ = false;
+            wheel_.advance(current_tick(), [&expired](detail::wheel_entry *due) {
+                static_cast<entry *>(due)->expired = true;
+                expired.push_back(due);
+            });
+            arm();
+        }
+
+        // Resolve outside the lock; an entry settled meanwhile
+        // has already been unlinked from expired by its finally()
+        for (;;) {
+            std::optional<Defer> defer;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                detail::wheel_entry *due = expired.pop_front();
+                if (due == nullptr)
+                    break;
+                defer = std::move(static_cast<entry *>(due)->defer);
+                static_cast<entry *>(due)->defer.reset();
+            }
+            if (defer)
+                defer->resolve();
+        }
+    }
+
+    std::mutex mutex_;
+    detail::hierarchical_wheel wheel_;
+    boost::asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point const start_;
+    bool armed_ = false;
+    uint64_t armed_at_ = 0;
+};
+
+}
+#endif
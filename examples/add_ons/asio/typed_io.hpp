@@ -0,0 +1,213 @@
+#pragma once
+#ifndef INC_ASIO_TYPED_IO_HPP_
+#define INC_ASIO_TYPED_IO_HPP_
+
+//
+// Allocation-free counterparts of the adapters in io.hpp
+//
+// The io.hpp adapters create a promise for every operation and pass the
+// result through pm_any, which costs several heap allocations per I/O.
+// These return a move-only operation instead. Calling then() with a
+// handler taking (error_code, result) starts the I/O; the handler runs
+// with the typed result and its state, like that of the composed
+// operation, lives in memory from pool_allocator. to_promise() turns
+// an operation into a Promise where a chain needs one.
+//
+// Functions --
+//   typed::operation<..., results_type> typed::async_resolve(Resolver &resolver,
+//                                                            const std::string &host,
+//                                                            const std::string &port);
+//   typed::operation<..., iterator> typed::async_connect(Socket &socket,
+//                                                        const ResolverResult &results);
+//   typed::operation<..., std::size_t> typed::async_read(Stream &stream,
+//                                                        Buffer &buffer,
+//                                                        Content &content);
+//   typed::operation<..., std::size_t> typed::async_read_header(Stream &stream,
+//                                                               Buffer &buffer,
+//                                                               Parser &parser);
+//   typed::operation<..., std::size_t> typed::async_write(Stream &stream,
+//                                                         Content &content);
+//   typed::operation<..., std::size_t> typed::async_write_buffers(Stream &stream,
+//                                                                 const ConstBufferSequence &buffers);
+//
+// Example --
+//   typed::async_write(stream, response).then(
+//       [](boost::system::error_code err, std::size_t bytes_transferred) {
+//           ...
+//       });
+//
+
+#include "add_ons/asio/io.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
+#include <boost/asio/associated_executor.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION >= 107700
+#include <boost/asio/associated_cancellation_slot.hpp>
+#endif
+#include <type_traits>
+#include <utility>
+
+namespace promise {
+namespace typed {
+
+// Outcome of an operation, for handlers that keep it for later
+template<typename Result>
+struct result {
+    boost::system::error_code error;
+    Result value;
+};
+
+// Completion handler whose asynchronous state is allocated from the pool;
+// the wrapped handler's executor and cancellation slot still apply
+template<typename Handler>
+class pooled_handler {
+public:
+    using allocator_type = pool_memory::pool_allocator<char>;
+
+    explicit pooled_handler(Handler handler)
+        : handler_(std::move(handler)) {
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return allocator_type{};
+    }
+
+    const Handler &handler() const noexcept {
+        return handler_;
+    }
+
+    template<typename... Args>
+    void operator()(Args &&...args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    Handler handler_;
+};
+
+// A not yet started asynchronous operation completing with (error_code, Result)
+template<typename Initiation, typename Result>
+class operation {
+public:
+    using result_type = Result;
+
+    explicit operation(Initiation initiation)
+        : initiation_(std::move(initiation)) {
+    }
+
+    operation(operation &&) = default;
+    operation &operator=(operation &&) = default;
+    operation(const operation &) = delete;
+    operation &operator=(const operation &) = delete;
+
+    // Start the operation; the handler is called once, with the typed result
+    template<typename Handler>
+    void then(Handler &&handler) && {
+        std::move(initiation_)(pooled_handler<std::decay_t<Handler>>{std::forward<Handler>(handler)});
+    }
+
+    // Start the operation and settle a promise with its result
+    Promise to_promise(const char *errorString) && {
+        return newPromise([&](Defer &defer) {
+            std::move(*this).then([defer, errorString](boost::system::error_code err, Result result) {
+                setPromise(defer, err, errorString, result);
+            });
+        });
+    }
+
+private:
+    Initiation initiation_;
+};
+
+template<typename Result, typename Initiation>
+inline operation<Initiation, Result> make_operation(Initiation initiation) {
+    return operation<Initiation, Result>{std::move(initiation)};
+}
+
+template<typename Resolver>
+inline auto async_resolve(
+    Resolver &resolver,
+    const std::string &host, const std::string &port) {
+    return make_operation<typename Resolver::results_type>(
+        [&resolver, host, port](auto handler) {
+            resolver.async_resolve(host, port, std::move(handler));
+        });
+}
+
+template<typename ResolverResult, typename Socket>
+inline auto async_connect(
+    Socket &socket,
+    const ResolverResult &results) {
+    return make_operation<typename ResolverResult::iterator>(
+        [&socket, &results](auto handler) {
+            boost::asio::async_connect(socket, results.begin(), results.end(), std::move(handler));
+        });
+}
+
+template<typename Stream, typename Buffer, typename Content>
+inline auto async_read(Stream &stream,
+    Buffer &buffer,
+    Content &content) {
+    return make_operation<std::size_t>(
+        [&stream, &buffer, &content](auto handler) {
+            boost::beast::http::async_read(stream, buffer, content, std::move(handler));
+        });
+}
+
+template<typename Stream, typename Buffer, typename Parser>
+inline auto async_read_header(Stream &stream,
+    Buffer &buffer,
+    Parser &parser) {
+    return make_operation<std::size_t>(
+        [&stream, &buffer, &parser](auto handler) {
+            boost::beast::http::async_read_header(stream, buffer, parser, std::move(handler));
+        });
+}
+
+template<typename Stream, typename Content>
+inline auto async_write(Stream &stream, Content &content) {
+    return make_operation<std::size_t>(
+        [&stream, &content](auto handler) {
+            boost::beast::http::async_write(stream, content, std::move(handler));
+        });
+}
+
+template<typename Stream, typename ConstBufferSequence>
+inline auto async_write_buffers(Stream &stream, const ConstBufferSequence &buffers) {
+    return make_operation<std::size_t>(
+        [&stream, buffers](auto handler) {
+            boost::asio::async_write(stream, buffers, std::move(handler));
+        });
+}
+
+}
+}
+
+namespace boost {
+namespace asio {
+
+template<typename Handler, typename Executor>
+struct associated_executor<promise::typed::pooled_handler<Handler>, Executor> {
+    using type = associated_executor_t<Handler, Executor>;
+
+    static type get(const promise::typed::pooled_handler<Handler> &handler,
+                    const Executor &executor = Executor()) noexcept {
+        return associated_executor<Handler, Executor>::get(handler.handler(), executor);
+    }
+};
+
+#if BOOST_VERSION >= 107700
+template<typename Handler, typename CancellationSlot>
+struct associated_cancellation_slot<promise::typed::pooled_handler<Handler>, CancellationSlot> {
+    using type = associated_cancellation_slot_t<Handler, CancellationSlot>;
+
+    static type get(const promise::typed::pooled_handler<Handler> &handler,
+                    const CancellationSlot &slot = CancellationSlot()) noexcept {
+        return associated_cancellation_slot<Handler, CancellationSlot>::get(handler.handler(), slot);
+    }
+};
+#endif
+
+}
+}
+#endif
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef INC_HTTP_ENCODING_HPP_
+#define INC_HTTP_ENCODING_HPP_
+
+//
+// HTTP content encoding helpers based on boost::beast
+//
+// Functions --
+//   double http_encoding::accepts_encoding(boost::beast::string_view accept_encoding,
+//                                          boost::beast::string_view coding);
+//   bool http_encoding::is_compressible(boost::beast::string_view content_type);
+//   std::string http_encoding::gzip(boost::beast::string_view data,
+//                                   boost::beast::error_code &ec,
+//                                   int level = 6);
+//
+
+#include <boost/beast/core/string.hpp>
+#include <boost/beast/zlib.hpp>
+#include <boost/crc.hpp>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+namespace http_encoding {
+
+// Returns the q-value the Accept-Encoding header value gives the
+// coding, 0 meaning not acceptable. Wildcards are honoured.
+inline double accepts_encoding(boost::beast::string_view accept_encoding,
+    boost::beast::string_view coding) {
+    using boost::beast::iequals;
+    auto trim = [](boost::beast::string_view s) {
+        while(!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while(!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        return s;
+    };
+
+    double wildcard = 0;
+    bool has_wildcard = false;
+    while(!accept_encoding.empty()) {
+        auto const comma = accept_encoding.find(',');
+        auto item = accept_encoding.substr(0, comma);
+        accept_encoding = comma == boost::beast::string_view::npos
+            ? boost::beast::string_view{}
+            : accept_encoding.substr(comma + 1);
+
+        double q = 1;
+        auto const semicolon = item.find(';');
+        if(semicolon != boost::beast::string_view::npos) {
+            auto const param = trim(item.substr(semicolon + 1));
+            if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                q = std::strtod(std::string{param.substr(2)}.c_str(), nullptr);
+            item = item.substr(0, semicolon);
+        }
+        item = trim(item);
+        if(iequals(item, coding))
+            return q;
+        if(item == "*") {
+            wildcard = q;
+            has_wildcard = true;
+        }
+    }
+    return has_wildcard ? wildcard : 0;
+}
+
+// Whether bodies of the content type shrink enough to be worth encoding
+inline bool is_compressible(boost::beast::string_view content_type) {
+    using boost::beast::iequals;
+    auto const type = content_type.substr(0, content_type.find(';'));
+    return iequals(type.substr(0, 5), "text/") ||
+        iequals(type, "application/javascript") ||
+        iequals(type, "application/json") ||
+        iequals(type, "application/xml") ||
+        iequals(type, "image/svg+xml");
+}
+
+// Compress data in the gzip format (RFC 1952) with beast's deflate.
+// On failure ec is set and the result is empty; the data should then
+// be sent unencoded.
+inline std::string gzip(boost::beast::string_view data, boost::beast::error_code &ec, int level = 6) {
+    namespace zlib = boost::beast::zlib;
+
+    // Member header: magic, deflate, no flags, no mtime, unknown OS
+    static char const header[] = {
+        '\x1f', '\x8b', '\x08', '\x00', '\x00', '\x00', '\x00', '\x00', '\x00', '\xff'};
+    std::string out(header, sizeof(header));
+
+    zlib::deflate_stream stream;
+    stream.reset(level, 15, 8, zlib::Strategy::normal);
+    out.resize(sizeof(header) + stream.upper_bound(data.size()));
+
+    zlib::z_params zs;
+    zs.next_in = data.data();
+    zs.avail_in = data.size();
+    zs.next_out = &out[sizeof(header)];
+    zs.avail_out = out.size() - sizeof(header);
+    // With room for the upper bound the whole input is consumed in
+    // one call, which then reports end_of_stream.
+    ec = {};
+    stream.write(zs, zlib::Flush::finish, ec);
+    if(ec == zlib::error::end_of_stream)
+        ec = {};
+    else if(!ec)
+        ec = zlib::error::stream_error; // stopped short of the end
+    if(ec)
+        return {};
+    out.resize(sizeof(header) + zs.total_out);
+
+    // Trailer: CRC-32 and size of the input, little endian
+    boost::crc_32_type crc;
+    crc.process_bytes(data.data(), data.size());
+    auto put32 = [&out](std::uint32_t value) {
+        for(int i = 0; i < 4; ++i)
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    };
+    put32(crc.checksum());
+    put32(static_cast<std::uint32_t>(data.size()));
+    return out;
+}
+
+}
+#endif
@@ -0,0 +1,237 @@
+#pragma once
+#ifndef INC_HTTP_MIME_TYPES_HPP_
+#define INC_HTTP_MIME_TYPES_HPP_
+
+//
+// MIME types by file extension, looked up in a perfect hash table
+//
+// The built in extensions are hashed at compile time with a seed that
+// gives each its own slot, so a lookup is one case insensitive hash and
+// one comparison. mime_types::load() merges an Apache style mime.types
+// file over them and rehashes the lot the same way at runtime.
+//
+// Classes --
+//   class http_mime::mime_types;
+//
+// Example --
+//   http_mime::mime_types types;
+//   types.load("/etc/mime.types");
+//   std::string_view type = types.find(".png"); // empty when unknown
+//
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace http_mime {
+
+// An extension and the MIME type it maps to
+struct mime_entry {
+    std::string_view extension;
+    std::string_view type;
+};
+
+constexpr char
+ascii_lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr bool
+ascii_iequals(std::string_view lhs, std::string_view rhs)
+{
+    if(lhs.size() != rhs.size())
+        return false;
+    for(std::size_t i = 0; i < lhs.size(); ++i)
+        if(ascii_lower(lhs[i]) != ascii_lower(rhs[i]))
+            return false;
+    return true;
+}
+
+// Case insensitive FNV-1a, perturbed by the seed
+constexpr std::uint32_t
+mime_hash(std::string_view extension, std::uint32_t seed)
+{
+    std::uint32_t hash = 2166136261u ^ (seed * 16777619u);
+    for(char c : extension)
+    {
+        hash ^= static_cast<unsigned char>(ascii_lower(c));
+        hash *= 16777619u;
+    }
+    // FNV's low bits only depend on the low bits of its input, so
+    // mix the high bits down before the hash is reduced to a slot
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// A perfect hash table: the seed is searched for until every extension
+// has a slot of its own, so a lookup is one hash and one comparison.
+template<std::size_t Slots>
+struct mime_table {
+    std::array<mime_entry, Slots> slots{};
+    std::uint32_t seed = 0;
+
+    constexpr std::string_view
+    find(std::string_view extension) const
+    {
+        auto const& slot = slots[mime_hash(extension, seed) % Slots];
+        return ascii_iequals(slot.extension, extension) ? slot.type : std::string_view{};
+    }
+};
+
+template<std::size_t Slots, std::size_t N>
+constexpr mime_table<Slots>
+make_mime_table(mime_entry const (&entries)[N])
+{
+    for(std::uint32_t seed = 0;; ++seed)
+    {
+        mime_table<Slots> table{};
+        table.seed = seed;
+        bool collision = false;
+        for(std::size_t i = 0; i < N && !collision; ++i)
+        {
+            auto& slot = table.slots[mime_hash(entries[i].extension, seed) % Slots];
+            collision = !slot.extension.empty();
+            slot = entries[i];
+        }
+        if(!collision)
+            return table;
+    }
+}
+
+inline constexpr mime_entry builtin_mime_entries[] = {
+    {".htm",  "text/html"},
+    {".html", "text/html"},
+    {".php",  "text/html"},
+    {".css",  "text/css"},
+    {".txt",  "text/plain"},
+    {".js",   "application/javascript"},
+    {".json", "application/json"},
+    {".xml",  "application/xml"},
+    {".swf",  "application/x-shockwave-flash"},
+    {".flv",  "video/x-flv"},
+    {".png",  "image/png"},
+    {".jpe",  "image/jpeg"},
+    {".jpeg", "image/jpeg"},
+    {".jpg",  "image/jpeg"},
+    {".gif",  "image/gif"},
+    {".bmp",  "image/bmp"},
+    {".ico",  "image/vnd.microsoft.icon"},
+    {".tiff", "image/tiff"},
+    {".tif",  "image/tiff"},
+    {".svg",  "image/svg+xml"},
+    {".svgz", "image/svg+xml"},
+};
+
+inline constexpr auto builtin_mime_types = make_mime_table<64>(builtin_mime_entries);
+static_assert(builtin_mime_types.find(".PNG") == "image/png", "perfect hash lookup");
+
+// The MIME types in use: the built in table, or after load() the
+// built in types plus those of a mime.types file rehashed together.
+class mime_types {
+public:
+    // Add the types of an Apache style mime.types file, where each
+    // line is a type followed by its extensions, e.g. "image/webp webp".
+    // Returns false when the file cannot be read.
+    bool
+    load(std::string const& filename)
+    {
+        std::ifstream in(filename);
+        if(!in)
+            return false;
+
+        std::vector<std::pair<std::string, std::string>> added;
+        std::string line;
+        while(std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::istringstream words(line);
+            std::string type, extension;
+            if(!(words >> type))
+                continue;
+            while(words >> extension)
+                added.emplace_back("." + extension, type);
+        }
+
+        // Built in types first, so that files override them
+        if(entries_.empty())
+            entries_.assign(std::begin(builtin_mime_entries), std::end(builtin_mime_entries));
+        // Own the strings; the deque keeps them at fixed addresses
+        for(auto const& entry : added)
+        {
+            strings_.push_back(entry.first);
+            std::string_view const extension = strings_.back();
+            strings_.push_back(entry.second);
+            entries_.push_back({extension, strings_.back()});
+        }
+        rehash(entries_);
+        return true;
+    }
+
+    std::string_view
+    find(std::string_view extension) const
+    {
+        if(slots_.empty())
+            return builtin_mime_types.find(extension);
+        auto const& slot = slots_[mime_hash(extension, seed_) % slots_.size()];
+        return ascii_iequals(slot.extension, extension) ? slot.type : std::string_view{};
+    }
+
+private:
+    void
+    rehash(std::vector<mime_entry> const& entries)
+    {
+        // Later entries replace earlier ones with the same extension
+        std::vector<mime_entry> unique;
+        for(auto const& entry : entries)
+        {
+            auto it = std::find_if(unique.begin(), unique.end(),
+                [&](mime_entry const& e) { return ascii_iequals(e.extension, entry.extension); });
+            if(it != unique.end())
+                *it = entry;
+            else
+                unique.push_back(entry);
+        }
+
+        // Grow the table whenever a reasonable number of seeds fails
+        for(std::size_t size = 4 * unique.size() + 1;; size *= 2)
+        {
+            for(std::uint32_t seed = 0; seed < 1000; ++seed)
+            {
+                std::vector<mime_entry> slots(size);
+                bool collision = false;
+                for(std::size_t i = 0; i < unique.size() && !collision; ++i)
+                {
+                    auto& slot = slots[mime_hash(unique[i].extension, seed) % size];
+                    collision = !slot.extension.empty();
+                    slot = unique[i];
+                }
+                if(!collision)
+                {
+                    slots_ = std::move(slots);
+                    seed_ = seed;
+                    return;
+                }
+            }
+        }
+    }
+
+    std::deque<std::string> strings_;
+    std::vector<mime_entry> entries_;
+    std::vector<mime_entry> slots_;
+    std::uint32_t seed_ = 0;
+};
+
+}
+#endif
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef INC_MEMORY_POOL_ALLOCATOR_HPP_
+#define INC_MEMORY_POOL_ALLOCATOR_HPP_
+
+//
+// Allocator that recycles released blocks instead of returning them
+// to the heap, so that objects created per connection or per request
+// (sessions, sockets, messages, buffer storage) stop allocating once
+// the server has warmed up. Parsed header fields and message bodies
+// still come from std::allocator, so each request allocates for those.
+//
+// Blocks are kept on per thread free lists in power of two size
+// classes from 16 bytes to 64 KiB, at most 64 blocks per class.
+// Larger requests go straight to operator new.
+//
+// Classes --
+//   template<class T> class pool_allocator;
+//
+// Example --
+//   auto session = std::allocate_shared<Session>(pool_allocator<Session>{}, ...);
+//   boost::beast::basic_flat_buffer<pool_allocator<char>> buffer;
+//
+
+#include <cstddef>
+#include <new>
+
+namespace pool_memory {
+namespace detail {
+
+struct pool_block {
+    pool_block *next;
+};
+
+struct pool_free_list {
+    pool_block *head;
+    std::size_t count;
+};
+
+// Trivially destructible so that it stays usable while other
+// thread_local and static objects release blocks during exit.
+struct pool_lists {
+    static constexpr std::size_t min_shift = 4;
+    static constexpr std::size_t max_shift = 16;
+    static constexpr std::size_t max_blocks = 64;
+
+    pool_free_list lists[max_shift - min_shift + 1];
+    bool destroyed;
+};
+
+// Returns the cached blocks to the heap when the thread exits
+struct pool_lists_cleanup {
+    pool_lists &pool;
+
+    ~pool_lists_cleanup() {
+        for(pool_free_list &list : pool.lists) {
+            while(list.head) {
+                pool_block *block = list.head;
+                list.head = block->next;
+                ::operator delete(block);
+            }
+            list.count = 0;
+        }
+        pool.destroyed = true;
+    }
+};
+
+inline pool_lists &thread_pool_lists() {
+    thread_local pool_lists lists{};
+    // Set up by the first use on each thread, so that threads that only
+    // release blocks allocated elsewhere return them too
+    thread_local pool_lists_cleanup cleanup{lists};
+    (void)cleanup;
+    return lists;
+}
+
+inline std::size_t pool_size_class(std::size_t size) {
+    std::size_t shift = pool_lists::min_shift;
+    while((std::size_t{1} << shift) < size)
+        ++shift;
+    return shift;
+}
+
+inline void *pool_allocate(std::size_t size) {
+    std::size_t const shift = pool_size_class(size);
+    if(shift > pool_lists::max_shift)
+        return ::operator new(size);
+
+    pool_free_list &list = thread_pool_lists().lists[shift - pool_lists::min_shift];
+    if(list.head) {
+        pool_block *block = list.head;
+        list.head = block->next;
+        --list.count;
+        return block;
+    }
+    return ::operator new(std::size_t{1} << shift);
+}
+
+inline void pool_deallocate(void *p, std::size_t size) noexcept {
+    std::size_t const shift = pool_size_class(size);
+    pool_lists &pool = thread_pool_lists();
+    if(shift > pool_lists::max_shift || pool.destroyed) {
+        ::operator delete(p);
+        return;
+    }
+
+    pool_free_list &list = pool.lists[shift - pool_lists::min_shift];
+    if(list.count == pool_lists::max_blocks) {
+        ::operator delete(p);
+        return;
+    }
+    pool_block *block = static_cast<pool_block *>(p);
+    block->next = list.head;
+    list.head = block;
+    ++list.count;
+}
+
+}
+
+template<class T>
+class pool_allocator {
+public:
+    static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+
+    template<class U>
+    pool_allocator(pool_allocator<U> const &) noexcept {
+    }
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(detail::pool_allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        detail::pool_deallocate(p, n * sizeof(T));
+    }
+
+    friend bool operator==(pool_allocator const &, pool_allocator const &) noexcept {
+        return true;
+    }
+
+    friend bool operator!=(pool_allocator const &, pool_allocator const &) noexcept {
+        return false;
+    }
+};
+
+}
+#endif
@@ -0,0 +1,258 @@
+#pragma once
+#ifndef INC_PROMISE_COMBINATORS_HPP_
+#define INC_PROMISE_COMBINATORS_HPP_
+
+//
+// Combinators that run a sequence of promise-producing tasks with at
+// most limit of them pending at a time
+//
+// The tasks are produced lazily: task(*it) is only called, and the
+// iterator only advanced, when a slot frees up, so the input may be an
+// input iterator over a large or generated range. Apart from the live
+// tasks' promises each call allocates one state object, plus the result
+// vector for mapLimit and allSettledLimit. Each task's promise has to
+// resolve with a T, or nothing for T = void. A rejection with a
+// boost::system::error_code, as those of the asio add-ons are, is kept
+// in settled::error; any other rejection in settled::exception, as the
+// std::exception_ptr it carries, or a std::runtime_error if it carries
+// something else. Tasks must settle on the thread that runs the
+// combinator.
+//
+// Functions --
+//   Promise eachLimit<T>(Iterator first, Iterator last, std::size_t limit,
+//                        Task task, Sink sink);
+//       sink(std::size_t index, settled<T> &&result) is called as each
+//       task settles; returning false stops starting further tasks.
+//       Resolves, with no value, once the started tasks have settled.
+//   Promise mapLimit<T>(Iterator first, Iterator last, std::size_t limit,
+//                       Task task);
+//       Resolves with std::vector<T> in input order, or is rejected with
+//       the first error, or exception, once the tasks already started
+//       have settled.
+//   Promise allSettledLimit<T>(Iterator first, Iterator last, std::size_t limit,
+//                              Task task);
+//       Resolves with std::vector<settled<T>> in input order.
+//
+// Example --
+//   mapLimit<std::string>(ids.begin(), ids.end(), 8, [&](int id) {
+//       return fetchComic(id);
+//   }).then([](std::vector<std::string> &comics) {
+//       ...
+//   });
+//
+
+#include "promise-cpp/promise.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
+#include <boost/system/error_code.hpp>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace promise {
+
+// Outcome of one task
+template<typename T>
+struct settled {
+    bool fulfilled = false;
+    boost::system::error_code error;
+    std::exception_ptr exception;
+    T value{};
+};
+
+template<>
+struct settled<void> {
+    bool fulfilled = false;
+    boost::system::error_code error;
+    std::exception_ptr exception;
+};
+
+namespace detail {
+
+// Resolves with the settled<T> outcome of promise
+template<typename T>
+inline Promise outcome_of(Promise promise) {
+    Promise outcome = [&promise]() {
+        if constexpr (std::is_void<T>::value) {
+            return promise.then([]() {
+                return settled<void>{true};
+            }, [](boost::system::error_code err) {
+                return settled<void>{false, err};
+            });
+        }
+        else {
+            return promise.then([](T &value) {
+                return settled<T>{true, {}, {}, std::move(value)};
+            }, [](boost::system::error_code err) {
+                return settled<T>{false, err};
+            });
+        }
+    }();
+    return outcome.fail([](std::exception_ptr exception) {
+        return settled<T>{false, {}, exception};
+    }).fail([]() {
+        return settled<T>{false, {}, std::make_exception_ptr(std::runtime_error("task rejected"))};
+    });
+}
+
+// Calls on_settled with the typed outcome of promise. The outcome is
+// resolved before on_settled is called, so that an exception thrown by
+// on_settled is not taken for the task's rejection.
+template<typename T, typename OnSettled>
+inline void watch_settled(Promise promise, OnSettled on_settled) {
+    outcome_of<T>(std::move(promise)).then([on_settled](settled<T> &result) mutable {
+        on_settled(std::move(result));
+    });
+}
+
+template<typename T, typename Iterator, typename Task, typename Sink, typename Finish>
+class limit_runner {
+public:
+    limit_runner(Iterator first, Iterator last, std::size_t limit, Task task, Sink sink, Finish finish)
+        : next_(std::move(first))
+        , last_(std::move(last))
+        , limit_(limit == 0 ? 1 : limit)
+        , task_(std::move(task))
+        , sink_(std::move(sink))
+        , finish_(std::move(finish)) {
+    }
+
+    static Promise run(std::shared_ptr<limit_runner> self) {
+        return newPromise([&self](Defer &defer) {
+            self->done_ = defer;
+            self->pump(self);
+        });
+    }
+
+private:
+    // Starts tasks while there are free slots. Tasks that settle while
+    // it runs only free their slot, so that synchronously settling
+    // tasks loop here instead of recursing.
+    void pump(const std::shared_ptr<limit_runner> &self) {
+        if (pumping_)
+            return;
+        pumping_ = true;
+        while (!stopped_ && running_ < limit_ && next_ != last_) {
+            std::size_t const index = index_++;
+            Promise promise = task_(*next_);
+            ++next_;
+            ++running_;
+            watch_settled<T>(promise, [self, index](settled<T> &&result) {
+                self->settle(self, index, std::move(result));
+            });
+        }
+        pumping_ = false;
+
+        if (running_ == 0 && (stopped_ || next_ == last_) && done_) {
+            Defer done = std::move(*done_);
+            done_.reset();
+            finish_(done);
+        }
+    }
+
+    void settle(const std::shared_ptr<limit_runner> &self, std::size_t index, settled<T> &&result) {
+        --running_;
+        if (!sink_(index, std::move(result)))
+            stopped_ = true;
+        pump(self);
+    }
+
+    Iterator next_;
+    Iterator last_;
+    std::size_t const limit_;
+    Task task_;
+    Sink sink_;
+    Finish finish_;
+    std::optional<Defer> done_;
+    std::size_t index_ = 0;
+    std::size_t running_ = 0;
+    bool pumping_ = false;
+    bool stopped_ = false;
+};
+
+template<typename T, typename Iterator, typename Task, typename Sink, typename Finish>
+inline Promise run_limited(Iterator first, Iterator last, std::size_t limit, Task task, Sink sink, Finish finish) {
+    using runner = limit_runner<T, Iterator, Task, Sink, Finish>;
+    return runner::run(std::allocate_shared<runner>(pool_memory::pool_allocator<runner>{},
+        std::move(first), std::move(last), limit, std::move(task), std::move(sink), std::move(finish)));
+}
+
+// Number of results to reserve for, when the range can tell cheaply
+template<typename Iterator>
+inline std::size_t expected_count(const Iterator &first, const Iterator &last) {
+    using category = typename std::iterator_traits<Iterator>::iterator_category;
+    if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value)
+        return static_cast<std::size_t>(std::distance(first, last));
+    else
+        return 0;
+}
+
+}
+
+template<typename T, typename Iterator, typename Task, typename Sink>
+inline Promise eachLimit(Iterator first, Iterator last, std::size_t limit, Task task, Sink sink) {
+    return detail::run_limited<T>(std::move(first), std::move(last), limit, std::move(task), std::move(sink),
+        [](Defer &done) {
+            done.resolve();
+        });
+}
+
+template<typename T, typename Iterator, typename Task>
+inline Promise mapLimit(Iterator first, Iterator last, std::size_t limit, Task task) {
+    static_assert(!std::is_void<T>::value, "use eachLimit for tasks without results");
+    struct results {
+        std::vector<T> values;
+        boost::system::error_code error;
+        std::exception_ptr exception;
+        bool failed = false;
+    };
+    auto collected = std::allocate_shared<results>(pool_memory::pool_allocator<results>{});
+    collected->values.resize(detail::expected_count(first, last));
+
+    return detail::run_limited<T>(std::move(first), std::move(last), limit, std::move(task),
+        [collected](std::size_t index, settled<T> &&result) {
+            if (!result.fulfilled) {
+                collected->error = result.error;
+                collected->exception = result.exception;
+                collected->failed = true;
+                return false;
+            }
+            if (index >= collected->values.size())
+                collected->values.resize(index + 1);
+            collected->values[index] = std::move(result.value);
+            return true;
+        },
+        [collected](Defer &done) {
+            if (collected->exception)
+                done.reject(collected->exception);
+            else if (collected->failed)
+                done.reject(collected->error);
+            else
+                done.resolve(std::move(collected->values));
+        });
+}
+
+template<typename T, typename Iterator, typename Task>
+inline Promise allSettledLimit(Iterator first, Iterator last, std::size_t limit, Task task) {
+    auto collected = std::allocate_shared<std::vector<settled<T>>>(pool_memory::pool_allocator<std::vector<settled<T>>>{});
+    collected->resize(detail::expected_count(first, last));
+
+    return detail::run_limited<T>(std::move(first), std::move(last), limit, std::move(task),
+        [collected](std::size_t index, settled<T> &&result) {
+            if (index >= collected->size())
+                collected->resize(index + 1);
+            (*collected)[index] = std::move(result);
+            return true;
+        },
+        [collected](Defer &done) {
+            done.resolve(std::move(*collected));
+        });
+}
+
+}
+#endif
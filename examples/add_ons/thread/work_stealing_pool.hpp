@@ -0,0 +1,314 @@
+#pragma once
+#ifndef INC_THREAD_WORK_STEALING_POOL_HPP_
+#define INC_THREAD_WORK_STEALING_POOL_HPP_
+
+//
+// Work-stealing thread pool for CPU-bound steps of promise chains
+//
+// Each worker owns a queue. Tasks posted from a worker go onto its own
+// queue and are taken newest first, while idle workers steal the oldest
+// tasks of the others. Tasks posted from any other thread are spread
+// over the queues in turn.
+//
+// offload() runs a function on the pool and settles the returned
+// promise on an asio executor, such as a session's strand, so that the
+// chain resumes where it left off. The promise and its Defer are only
+// touched on that executor, never on the pool's threads. It resolves
+// with the function's result, or is rejected with the std::exception_ptr
+// of an exception the function throws.
+//
+// Classes --
+//   class work_stealing_pool;
+//
+// Functions --
+//   void work_stealing_pool::post(Function fn);
+//   work_stealing_pool::stats work_stealing_pool::statistics() const;
+//   Promise offload(work_stealing_pool &pool, const Executor &executor, Function fn);
+//
+// Example --
+//   offload(pool, session->stream_.get_executor(), [session] {
+//       return parse(session->req_.body());
+//   }).then([session](Document &doc) {
+//       ...
+//   });
+//
+
+#include "promise-cpp/promise.hpp"
+#include <boost/asio/post.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace promise {
+namespace detail {
+
+struct pool_task {
+    virtual ~pool_task() = default;
+    // Runs on a worker, which passes ownership of the task
+    virtual void run(std::unique_ptr<pool_task> self) = 0;
+};
+
+template<typename Function>
+class function_task : public pool_task {
+public:
+    explicit function_task(Function fn)
+        : fn_(std::move(fn)) {
+    }
+
+    void run(std::unique_ptr<pool_task>) override {
+        fn_();
+    }
+
+private:
+    Function fn_;
+};
+
+class worker_queue {
+public:
+    void push(pool_task *task) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push_back(task);
+    }
+
+    // Taken by the owner, newest first
+    pool_task *pop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty())
+            return nullptr;
+        pool_task *task = tasks_.back();
+        tasks_.pop_back();
+        return task;
+    }
+
+    // Taken by other workers, oldest first
+    pool_task *steal() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tasks_.empty())
+            return nullptr;
+        pool_task *task = tasks_.front();
+        tasks_.pop_front();
+        return task;
+    }
+
+    std::size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tasks_.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (pool_task *task : tasks_)
+            delete task;
+        tasks_.clear();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<pool_task *> tasks_;
+};
+
+}
+
+class work_stealing_pool {
+public:
+    struct stats {
+        std::size_t threads = 0;
+        std::size_t queued = 0;                 // tasks waiting, all queues
+        std::size_t high_water = 0;             // most tasks ever waiting
+        std::uint64_t executed = 0;
+        std::uint64_t stolen = 0;               // tasks run by another worker than queued them
+        std::vector<std::size_t> queue_depths;  // tasks waiting, per worker
+    };
+
+    explicit work_stealing_pool(std::size_t threads = std::thread::hardware_concurrency())
+        : queues_(std::max<std::size_t>(1, threads)) {
+        workers_.reserve(queues_.size());
+        for (std::size_t i = 0; i < queues_.size(); ++i)
+            workers_.emplace_back([this, i] { work(i); });
+    }
+
+    work_stealing_pool(const work_stealing_pool &) = delete;
+    work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+    // Finishes the running tasks; those still queued are discarded
+    ~work_stealing_pool() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex_);
+            stopping_ = true;
+        }
+        idle_.notify_all();
+        for (std::thread &worker : workers_)
+            worker.join();
+        for (detail::worker_queue &queue : queues_)
+            queue.clear();
+    }
+
+    std::size_t size() const {
+        return queues_.size();
+    }
+
+    template<typename Function>
+    void post(Function fn) {
+        submit(std::make_unique<detail::function_task<Function>>(std::move(fn)));
+    }
+
+    void submit(std::unique_ptr<detail::pool_task> task) {
+        std::size_t index;
+        if (current_pool() == this)
+            index = current_index();
+        else
+            index = next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        queues_[index].push(task.release());
+
+        std::size_t const queued = queued_.fetch_add(1) + 1;
+        std::size_t high_water = high_water_.load(std::memory_order_relaxed);
+        while (queued > high_water && !high_water_.compare_exchange_weak(high_water, queued, std::memory_order_relaxed))
+            ;
+        if (sleeping_.load() > 0) {
+            { std::lock_guard<std::mutex> lock(idle_mutex_); }
+            idle_.notify_one();
+        }
+    }
+
+    stats statistics() const {
+        stats result;
+        result.threads = queues_.size();
+        result.queued = queued_.load(std::memory_order_relaxed);
+        result.high_water = high_water_.load(std::memory_order_relaxed);
+        result.executed = executed_.load(std::memory_order_relaxed);
+        result.stolen = stolen_.load(std::memory_order_relaxed);
+        result.queue_depths.reserve(queues_.size());
+        for (const detail::worker_queue &queue : queues_)
+            result.queue_depths.push_back(queue.size());
+        return result;
+    }
+
+private:
+    static work_stealing_pool *&current_pool() {
+        static thread_local work_stealing_pool *pool = nullptr;
+        return pool;
+    }
+
+    static std::size_t &current_index() {
+        static thread_local std::size_t index = 0;
+        return index;
+    }
+
+    detail::pool_task *take(std::size_t index) {
+        if (detail::pool_task *task = queues_[index].pop())
+            return task;
+        for (std::size_t i = 1; i < queues_.size(); ++i) {
+            if (detail::pool_task *task = queues_[(index + i) % queues_.size()].steal()) {
+                stolen_.fetch_add(1, std::memory_order_relaxed);
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    void work(std::size_t index) {
+        current_pool() = this;
+        current_index() = index;
+        for (;;) {
+            if (detail::pool_task *task = take(index)) {
+                queued_.fetch_sub(1);
+                task->run(std::unique_ptr<detail::pool_task>(task));
+                executed_.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Counted as sleeping before checking for work, so that
+            // submit() either sees the sleeper or it sees the task
+            std::unique_lock<std::mutex> lock(idle_mutex_);
+            ++sleeping_;
+            idle_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+            --sleeping_;
+            if (stopping_)
+                return;
+        }
+    }
+
+    std::vector<detail::worker_queue> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> next_queue_{0};
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> high_water_{0};
+    std::atomic<std::uint64_t> executed_{0};
+    std::atomic<std::uint64_t> stolen_{0};
+    std::atomic<std::size_t> sleeping_{0};
+    std::mutex idle_mutex_;
+    std::condition_variable idle_;
+    bool stopping_ = false;
+};
+
+namespace detail {
+
+// Runs the function on a worker, then settles the promise on the executor
+template<typename Executor, typename Function>
+class offload_task : public pool_task {
+public:
+    using result_type = typename std::invoke_result<Function &>::type;
+
+    offload_task(const Executor &executor, Function fn, const Defer &defer)
+        : executor_(executor)
+        , fn_(std::move(fn))
+        , defer_(defer) {
+    }
+
+    void run(std::unique_ptr<pool_task> self) override {
+        try {
+            if constexpr (std::is_void<result_type>::value)
+                fn_();
+            else
+                result_.emplace(fn_());
+        }
+        catch (...) {
+            error_ = std::current_exception();
+        }
+        boost::asio::post(executor_, [task = std::unique_ptr<offload_task>(static_cast<offload_task *>(self.release()))]() {
+            task->settle();
+        });
+    }
+
+private:
+    void settle() {
+        if (error_)
+            defer_.reject(error_);
+        else if constexpr (std::is_void<result_type>::value)
+            defer_.resolve();
+        else
+            defer_.resolve(std::move(*result_));
+    }
+
+    struct no_result {};
+    using stored_type = typename std::conditional<std::is_void<result_type>::value, no_result, result_type>::type;
+
+    Executor executor_;
+    Function fn_;
+    Defer defer_;
+    std::optional<stored_type> result_;
+    std::exception_ptr error_;
+};
+
+}
+
+template<typename Executor, typename Function>
+inline Promise offload(work_stealing_pool &pool, const Executor &executor, Function fn) {
+    return newPromise([&](Defer &defer) {
+        pool.submit(std::make_unique<detail::offload_task<Executor, Function>>(executor, std::move(fn), defer));
+    });
+}
+
+}
+#endif
@@ -0,0 +1,47 @@
+#include "allocation_count.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Kept in a translation unit of their own, so that the compiler does not
+// see the malloc and free behind the replaced operators where they are used.
+
+static std::atomic<std::size_t> allocations{0};
+static std::atomic<std::size_t> deallocations{0};
+
+std::size_t allocation_count() {
+    return allocations.load();
+}
+
+std::size_t deallocation_count() {
+    return deallocations.load();
+}
+
+void *operator new(std::size_t size) {
+    ++allocations;
+    if (void *p = std::malloc(size == 0 ? 1 : size))
+        return p;
+    throw std::bad_alloc{};
+}
+
+void *operator new[](std::size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    if (p)
+        ++deallocations;
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    ::operator delete(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+    ::operator delete(p);
+}
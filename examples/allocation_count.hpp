@@ -0,0 +1,20 @@
+#pragma once
+#ifndef INC_ALLOCATION_COUNT_HPP_
+#define INC_ALLOCATION_COUNT_HPP_
+
+//
+// Counts the heap allocations and deallocations made through the global
+// operator new and operator delete, for benchmarks and tests that report
+// or check them.
+//
+// The counting replacements are defined in allocation_count.cpp. Only
+// programs that are built with that file get them, so they do not
+// replace the global operators anywhere else.
+//
+
+#include <cstddef>
+
+std::size_t allocation_count();
+std::size_t deallocation_count();
+
+#endif
@@ -0,0 +1,133 @@
+//
+// Load generator for the HTTP servers. Each connection sends GET
+// requests for one target over a keep-alive connection, one at a time,
+// until the time is up, and the responses and body bytes received per
+// second are reported. Bodies are read in 64 KiB pieces and dropped,
+// so large files cost the client no more memory than small ones.
+//
+// Usage: asio_http_load <host> <port> <target> [<connections> [<seconds>]]
+//
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace asio  = boost::asio;
+namespace beast = boost::beast;
+namespace http  = boost::beast::http;
+using     tcp   = boost::asio::ip::tcp;
+using     clock_type = std::chrono::steady_clock;
+
+struct totals {
+    std::uint64_t responses = 0;
+    std::uint64_t body_bytes = 0;
+    std::uint64_t errors = 0;
+};
+
+class connection : public std::enable_shared_from_this<connection> {
+public:
+    connection(asio::io_context &ioc, const std::string &host, const std::string &target,
+               clock_type::time_point deadline, totals &counts)
+        : socket_(ioc)
+        , deadline_(deadline)
+        , counts_(counts) {
+        req_.method(http::verb::get);
+        req_.target(target);
+        req_.version(11);
+        req_.set(http::field::host, host);
+        req_.keep_alive(true);
+    }
+
+    void start(const tcp::resolver::results_type &endpoints) {
+        asio::async_connect(socket_, endpoints,
+            [self = shared_from_this()](boost::system::error_code err, const tcp::endpoint &) {
+                if (err)
+                    return self->fail(err, "connect");
+                self->send();
+            });
+    }
+
+private:
+    void send() {
+        http::async_write(socket_, req_,
+            [self = shared_from_this()](boost::system::error_code err, std::size_t) {
+                if (err)
+                    return self->fail(err, "write");
+                self->parser_.emplace();
+                self->parser_->body_limit((std::numeric_limits<std::uint64_t>::max)());
+                self->read();
+            });
+    }
+
+    void read() {
+        http::buffer_body::value_type &body = parser_->get().body();
+        body.data = chunk_;
+        body.size = sizeof(chunk_);
+        http::async_read_some(socket_, buffer_, *parser_,
+            [self = shared_from_this()](boost::system::error_code err, std::size_t) {
+                if (err == http::error::need_buffer)
+                    err = {};
+                if (err)
+                    return self->fail(err, "read");
+                self->counts_.body_bytes += sizeof(self->chunk_) - self->parser_->get().body().size;
+                if (!self->parser_->is_done())
+                    return self->read();
+                if (self->parser_->get().result() == http::status::ok)
+                    ++self->counts_.responses;
+                else
+                    ++self->counts_.errors;
+                if (clock_type::now() < self->deadline_ && self->parser_->get().keep_alive())
+                    self->send();
+            });
+    }
+
+    void fail(boost::system::error_code err, const char *what) {
+        ++counts_.errors;
+        std::fprintf(stderr, "%s: %s\n", what, err.message().c_str());
+    }
+
+    tcp::socket socket_;
+    beast::flat_buffer buffer_;
+    http::request<http::empty_body> req_;
+    std::optional<http::response_parser<http::buffer_body>> parser_;
+    char chunk_[64 * 1024];
+    clock_type::time_point const deadline_;
+    totals &counts_;
+};
+
+int main(int argc, char *argv[]) {
+    if (argc < 4 || argc > 6) {
+        std::fprintf(stderr, "Usage: %s <host> <port> <target> [<connections> [<seconds>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    std::string const host = argv[1];
+    std::string const port = argv[2];
+    std::string const target = argv[3];
+    int const connections = argc > 4 ? std::atoi(argv[4]) : 16;
+    int const seconds = argc > 5 ? std::atoi(argv[5]) : 10;
+
+    asio::io_context ioc;
+    tcp::resolver resolver{ioc};
+    auto const endpoints = resolver.resolve(host, port);
+    totals counts;
+    auto const begin = clock_type::now();
+    auto const deadline = begin + std::chrono::seconds(seconds);
+    for (int i = 0; i < connections; ++i)
+        std::make_shared<connection>(ioc, host, target, deadline, counts)->start(endpoints);
+    ioc.run();
+    double const elapsed = std::chrono::duration<double>(clock_type::now() - begin).count();
+
+    std::printf("%d connections, %.1f s\n", connections, elapsed);
+    std::printf("%-14s %14s %14s %10s\n", "target", "responses/s", "MB/s", "errors");
+    std::printf("%-14s %14.0f %14.1f %10llu\n", target.c_str(), counts.responses / elapsed,
+        counts.body_bytes / elapsed / 1e6, static_cast<unsigned long long>(counts.errors));
+    return counts.errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -29,17 +29,55 @@
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/config.hpp>
 #include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 #include <iostream>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <vector>
+#include <sys/stat.h>
 
+// Define USE_SENDFILE=0 to serve files with http::file_body instead
+#if !defined(USE_SENDFILE)
+#   if defined(__linux__) && BOOST_BEAST_USE_POSIX_FILE
+#       define USE_SENDFILE 1
+#   else
+#       define USE_SENDFILE 0
+#   endif
+#endif
+#if USE_SENDFILE
+#   include <sys/sendfile.h>
+#endif
+
+#if defined(__linux__)
+#   define USE_FILE_CACHE 1
+#   include <boost/asio/posix/stream_descriptor.hpp>
+#   include <fcntl.h>
+#   include <sys/inotify.h>
+#   include <unistd.h>
+#else
+#   define USE_FILE_CACHE 0
+#endif
 
 #include "add_ons/asio/io.hpp"
+#include "add_ons/http/encoding.hpp"
+#include "add_ons/http/mime_types.hpp"
+#include "add_ons/memory/pool_allocator.hpp"
 
 using namespace promise;
+using namespace pool_memory;
+using namespace http_encoding;
+using namespace http_mime;
 
 namespace asio        = boost::asio;
 namespace ip          = boost::asio::ip;
@@ -48,20 +86,25 @@ using     tcp         = boost::asio::ip::tcp;
 namespace beast       = boost::beast;
 namespace http        = boost::beast::http;
 
+class file_cache;
+
 struct Session {
     bool close_;
     tcp::socket socket_;
-    beast::flat_buffer buffer_;
+    beast::basic_flat_buffer<pool_allocator<char>> buffer_;
     std::string doc_root_;
+    std::shared_ptr<file_cache> cache_;
     http::request<http::string_body> req_;
 
     explicit Session(
         tcp::socket &socket,
-        std::string const& doc_root
+        std::string const& doc_root,
+        std::shared_ptr<file_cache> const& cache
         )
         : close_(false)
         , socket_(std::move(socket))
-        , doc_root_(doc_root) {
+        , doc_root_(doc_root)
+        , cache_(cache) {
         std::cout << "new session" << std::endl;
     }
 
@@ -70,11 +113,20 @@ struct Session {
     }
 };
 
+// Report a failure
+void
+fail(boost::system::error_code ec, char const* what)
+{
+    std::cerr << what << ": " << ec.message() << "\n";
+}
+
 // Promisified functions
 Promise async_accept(tcp::acceptor &acceptor) {
     return newPromise([&](Defer &defer) {
-        // Look up the domain name
-        auto socket = std::make_shared<tcp::socket>(static_cast<asio::io_context &>(acceptor.get_executor().context()));
+        // Sockets, sessions and messages are pooled so that steady state
+        // connections reuse the memory of earlier ones
+        auto socket = std::allocate_shared<tcp::socket>(pool_allocator<tcp::socket>{},
+            static_cast<asio::io_context &>(acceptor.get_executor().context()));
         acceptor.async_accept(*socket,
             [=](boost::system::error_code err) {
             setPromise(defer, err, "resolve", socket);
@@ -82,43 +134,641 @@ Promise async_accept(tcp::acceptor &acceptor) {
     });
 }
 
+mime_types g_mime_types;
 
 // Return a reasonable mime type based on the extension of a file.
 beast::string_view
 mime_type(beast::string_view path)
 {
-    using beast::iequals;
-    auto const ext = [&path]
+    auto const pos = path.rfind(".");
+    if(pos == beast::string_view::npos)
+        return "application/text";
+    auto const type = g_mime_types.find(std::string_view{path.data() + pos, path.size() - pos});
+    if(type.empty())
+        return "application/text";
+    return beast::string_view{type.data(), type.size()};
+}
+
+// The size and validators of a file, used to answer
+// conditional and range requests.
+struct file_meta {
+    std::uint64_t size = 0;
+    std::time_t mtime = 0;
+    std::string content_type;
+    std::string content_encoding;
+    bool vary_encoding = false;
+    std::string etag;
+    std::string last_modified;
+};
+
+// Format a time as an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+std::string
+http_date(std::time_t time)
+{
+    std::tm tm{};
+#if BOOST_MSVC
+    gmtime_s(&tm, &time);
+#else
+    gmtime_r(&time, &tm);
+#endif
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+// Parse an IMF-fixdate; returns false for anything else.
+bool
+parse_http_date(beast::string_view value, std::time_t& time)
+{
+    static char const* const months[] = {
+        "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    char month_name[4] = {};
+    int day, year, hour, minute, second;
+    std::string const text{value};
+    if(std::sscanf(text.c_str(), "%*3s, %2d %3s %4d %2d:%2d:%2d GMT",
+        &day, month_name, &year, &hour, &minute, &second) != 6)
+        return false;
+    int month = 0;
+    while(month < 12 && std::strcmp(months[month], month_name) != 0)
+        ++month;
+    if(month == 12)
+        return false;
+
+    // Days since the epoch of the civil date, see
+    // http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+    int const y = year - (month < 2);
+    int const era = (y >= 0 ? y : y - 399) / 400;
+    int const yoe = y - era * 400;
+    int const doy = (153 * (month + (month < 2 ? 10 : -2)) + 2) / 5 + day - 1;
+    int const doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long long const days = era * 146097LL + doe - 719468;
+    time = static_cast<std::time_t>(((days * 24 + hour) * 60 + minute) * 60 + second);
+    return true;
+}
+
+// The sub-second part of a file's modification time, in nanoseconds
+long
+mtime_nsec(struct stat const& st)
+{
+#if defined(__APPLE__)
+    return st.st_mtimespec.tv_nsec;
+#else
+    return st.st_mtim.tv_nsec;
+#endif
+}
+
+file_meta
+make_file_meta(beast::string_view path, struct stat const& st)
+{
+    file_meta meta;
+    meta.size = static_cast<std::uint64_t>(st.st_size);
+    meta.mtime = st.st_mtime;
+    meta.content_type = std::string{mime_type(path)};
+    meta.vary_encoding = is_compressible(meta.content_type);
+    // A strong validator: a file replaced by another one, or rewritten
+    // within the same second, gets a new inode or modification time
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "\"%llx-%llx.%lx-%llx\"",
+        static_cast<unsigned long long>(st.st_ino),
+        static_cast<unsigned long long>(st.st_mtime),
+        mtime_nsec(st),
+        static_cast<unsigned long long>(st.st_size));
+    meta.etag = buf;
+    meta.last_modified = http_date(st.st_mtime);
+    return meta;
+}
+
+// A precompressed sibling of a file, e.g. index.html.br
+struct precompressed {
+    char const* coding;
+    char const* extension;
+};
+
+// The precompressed siblings the request accepts, best first
+std::vector<precompressed>
+accepted_siblings(http::request<http::string_body> const& req)
+{
+    static precompressed const siblings[] = {{"br", ".br"}, {"gzip", ".gz"}};
+    auto const accept_encoding = req[http::field::accept_encoding];
+    std::vector<std::pair<double, precompressed>> accepted;
+    for(auto const& sibling : siblings)
+    {
+        double const q = accepts_encoding(accept_encoding, sibling.coding);
+        if(q > 0)
+            accepted.emplace_back(q, sibling);
+    }
+    std::stable_sort(accepted.begin(), accepted.end(),
+        [](auto const& lhs, auto const& rhs) { return lhs.first > rhs.first; });
+    std::vector<precompressed> result;
+    for(auto const& entry : accepted)
+        result.push_back(entry.second);
+    return result;
+}
+
+// Describe the meta of a precompressed sibling as an
+// encoding of the file at path.
+void
+apply_encoding(file_meta& meta, beast::string_view path, precompressed const& sibling)
+{
+    meta.content_type = std::string{mime_type(path)};
+    meta.content_encoding = sibling.coding;
+    meta.vary_encoding = true;
+    // Each encoding is a different representation with its own validator
+    meta.etag.insert(meta.etag.size() - 1, std::string{"-"} + sibling.coding);
+}
+
+// Returns true when the request's validators show that the
+// client's copy is current and a 304 should be sent instead.
+bool
+not_modified(http::request<http::string_body> const& req, file_meta const& meta)
+{
+    auto const if_none_match = req.find(http::field::if_none_match);
+    if(if_none_match != req.end())
+    {
+        // Weak comparison: a W/ prefix does not matter here
+        beast::string_view tags = if_none_match->value();
+        while(!tags.empty())
+        {
+            auto const comma = tags.find(',');
+            auto tag = tags.substr(0, comma);
+            tags = comma == beast::string_view::npos ? beast::string_view{} : tags.substr(comma + 1);
+            while(!tag.empty() && tag.front() == ' ')
+                tag.remove_prefix(1);
+            while(!tag.empty() && tag.back() == ' ')
+                tag.remove_suffix(1);
+            if(tag.substr(0, 2) == "W/")
+                tag.remove_prefix(2);
+            if(tag == "*" || tag == meta.etag)
+                return true;
+        }
+        // If-Modified-Since is ignored when If-None-Match is present
+        return false;
+    }
+
+    std::time_t since;
+    auto const if_modified_since = req.find(http::field::if_modified_since);
+    return if_modified_since != req.end() &&
+        parse_http_date(if_modified_since->value(), since) &&
+        meta.mtime <= since;
+}
+
+struct byte_range {
+    std::uint64_t first;
+    std::uint64_t length;
+};
+
+// Parse the Range header of a GET request against a resource of the
+// given size. Returns false when the header should be ignored and the
+// whole resource sent; otherwise ranges holds the satisfiable ranges,
+// which is empty when none of them are.
+bool
+parse_ranges(
+    http::request<http::string_body> const& req,
+    file_meta const& meta,
+    std::vector<byte_range>& ranges)
+{
+    // Bounds the work and the response size of hostile range sets
+    std::size_t constexpr max_ranges = 16;
+
+    auto const range = req.find(http::field::range);
+    if(range == req.end())
+        return false;
+
+    // A stale If-Range means the client wants the whole new version
+    auto const if_range = req.find(http::field::if_range);
+    if(if_range != req.end() &&
+        if_range->value() != meta.etag &&
+        if_range->value() != meta.last_modified)
+        return false;
+
+    beast::string_view spec = range->value();
+    if(spec.substr(0, 6) != "bytes=")
+        return false;
+    spec.remove_prefix(6);
+
+    ranges.clear();
+    std::size_t count = 0;
+    while(!spec.empty())
+    {
+        auto const comma = spec.find(',');
+        std::string const item{spec.substr(0, comma)};
+        spec = comma == beast::string_view::npos ? beast::string_view{} : spec.substr(comma + 1);
+        if(++count > max_ranges)
+            return false;
+        // sscanf would accept signs, so allow nothing but digits around the dash
+        if(std::count(item.begin(), item.end(), '-') != 1 ||
+            item.find_first_not_of("0123456789- \t") != std::string::npos)
+            return false;
+
+        unsigned long long first = 0, last = 0;
+        char dash = 0;
+        char extra = 0;
+        if(std::sscanf(item.c_str(), " %llu - %llu %c", &first, &last, &extra) == 2)
+        {
+            // first-last
+            if(first > last)
+                return false;
+        }
+        else if(std::sscanf(item.c_str(), " %llu %c %c", &first, &dash, &extra) == 2 && dash == '-')
+        {
+            // first-
+            last = meta.size == 0 ? 0 : meta.size - 1;
+        }
+        else if(std::sscanf(item.c_str(), " -%llu %c", &last, &extra) == 1)
+        {
+            // -suffix_length
+            if(last == 0)
+                continue;
+            first = last >= meta.size ? 0 : meta.size - last;
+            last = meta.size == 0 ? 0 : meta.size - 1;
+        }
+        else
+        {
+            return false;
+        }
+        if(first >= meta.size)
+            continue;
+        last = std::min<unsigned long long>(last, meta.size - 1);
+        ranges.push_back({first, last - first + 1});
+    }
+    return true;
+}
+
+// One section of a response body: a multipart header followed by
+// length bytes of the file starting at offset.
+struct body_part {
+    std::string prefix;
+    std::uint64_t offset;
+    std::uint64_t length;
+};
+
+// The layout of a full, single range or multipart/byteranges body.
+struct body_layout {
+    http::status status = http::status::ok;
+    std::string content_type;
+    std::string content_range;
+    std::vector<body_part> parts;
+    std::string suffix;
+    std::uint64_t content_length = 0;
+};
+
+std::string
+content_range(byte_range const& range, std::uint64_t size)
+{
+    return "bytes " + std::to_string(range.first) + "-" +
+        std::to_string(range.first + range.length - 1) + "/" + std::to_string(size);
+}
+
+body_layout
+make_layout(file_meta const& meta, std::vector<byte_range> const& ranges)
+{
+    body_layout layout;
+    if(ranges.empty())
+    {
+        layout.content_type = meta.content_type;
+        layout.parts.push_back({std::string{}, 0, meta.size});
+    }
+    else if(ranges.size() == 1)
+    {
+        layout.status = http::status::partial_content;
+        layout.content_type = meta.content_type;
+        layout.content_range = content_range(ranges.front(), meta.size);
+        layout.parts.push_back({std::string{}, ranges.front().first, ranges.front().length});
+    }
+    else
     {
-        auto const pos = path.rfind(".");
-        if(pos == beast::string_view::npos)
-            return beast::string_view{};
-        return path.substr(pos);
-    }();
-    if(iequals(ext, ".htm"))  return "text/html";
-    if(iequals(ext, ".html")) return "text/html";
-    if(iequals(ext, ".php"))  return "text/html";
-    if(iequals(ext, ".css"))  return "text/css";
-    if(iequals(ext, ".txt"))  return "text/plain";
-    if(iequals(ext, ".js"))   return "application/javascript";
-    if(iequals(ext, ".json")) return "application/json";
-    if(iequals(ext, ".xml"))  return "application/xml";
-    if(iequals(ext, ".swf"))  return "application/x-shockwave-flash";
-    if(iequals(ext, ".flv"))  return "video/x-flv";
-    if(iequals(ext, ".png"))  return "image/png";
-    if(iequals(ext, ".jpe"))  return "image/jpeg";
-    if(iequals(ext, ".jpeg")) return "image/jpeg";
-    if(iequals(ext, ".jpg"))  return "image/jpeg";
-    if(iequals(ext, ".gif"))  return "image/gif";
-    if(iequals(ext, ".bmp"))  return "image/bmp";
-    if(iequals(ext, ".ico"))  return "image/vnd.microsoft.icon";
-    if(iequals(ext, ".tiff")) return "image/tiff";
-    if(iequals(ext, ".tif"))  return "image/tiff";
-    if(iequals(ext, ".svg"))  return "image/svg+xml";
-    if(iequals(ext, ".svgz")) return "image/svg+xml";
-    return "application/text";
+        // The etag is unique per file version and never occurs in the file's bytes by chance
+        std::string const boundary = "byteranges-" + meta.etag.substr(1, meta.etag.size() - 2);
+        layout.status = http::status::partial_content;
+        layout.content_type = "multipart/byteranges; boundary=" + boundary;
+        for(auto const& range : ranges)
+        {
+            layout.parts.push_back({
+                (layout.parts.empty() ? "--" : "\r\n--") + boundary + "\r\n"
+                    "Content-Type: " + meta.content_type + "\r\n"
+                    "Content-Range: " + content_range(range, meta.size) + "\r\n\r\n",
+                range.first,
+                range.length});
+        }
+        layout.suffix = "\r\n--" + boundary + "--\r\n";
+    }
+    for(auto const& part : layout.parts)
+        layout.content_length += part.prefix.size() + part.length;
+    layout.content_length += layout.suffix.size();
+    return layout;
+}
+
+#if USE_SENDFILE
+// A response whose body is copied by the kernel from the file
+// straight to the socket, without passing through userspace.
+struct sendfile_response {
+    http::response<http::empty_body> header;
+    beast::file file;
+    std::vector<body_part> parts;
+    std::string suffix;
+};
+
+Promise async_write_string(tcp::socket &socket, std::string const& data) {
+    return newPromise([&](Defer &defer) {
+        asio::async_write(socket, asio::buffer(data),
+            [defer](boost::system::error_code err, std::size_t bytes_transferred) {
+            setPromise(defer, err, "write", bytes_transferred);
+        });
+    });
 }
 
+// Send length bytes of the file starting at offset to the socket with
+// sendfile(2), waiting for the socket to become writable whenever it is full.
+Promise async_sendfile(tcp::socket &socket, beast::file &file, std::uint64_t offset, std::uint64_t length) {
+    socket.native_non_blocking(true);
+    auto const end = offset + length;
+    auto position = std::make_shared<off_t>(static_cast<off_t>(offset));
+    return doWhile([&socket, &file, end, position](DeferLoop &loop) {
+        while(static_cast<std::uint64_t>(*position) < end) {
+            ssize_t n = ::sendfile(socket.native_handle(), file.native_handle(),
+                position.get(), static_cast<std::size_t>(end - *position));
+            if(n > 0 || (n < 0 && errno == EINTR))
+                continue;
+            if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                socket.async_wait(tcp::socket::wait_write,
+                    [loop](boost::system::error_code err) {
+                    if(err)
+                        loop.reject(err);
+                    else
+                        loop.doContinue();
+                });
+                return;
+            }
+            // n == 0 means the file shrank underneath us
+            boost::system::error_code err = n < 0
+                ? boost::system::error_code{errno, boost::system::system_category()}
+                : boost::system::error_code{boost::asio::error::eof};
+            std::cerr << "sendfile: " << err.message() << "\n";
+            loop.reject(err);
+            return;
+        }
+        loop.doBreak();
+    });
+}
+
+// Send the body of the response, each part's multipart
+// header followed by its bytes from the file.
+Promise async_send_parts(tcp::socket &socket, std::shared_ptr<sendfile_response> res) {
+    auto next = std::make_shared<std::size_t>(0);
+    return doWhile([&socket, res, next](DeferLoop &loop) {
+        if(*next == res->parts.size()) {
+            loop.doBreak();
+            return;
+        }
+        body_part const& part = res->parts[(*next)++];
+        (part.prefix.empty() ? resolve() : async_write_string(socket, part.prefix)).then([&socket, res, &part]() {
+            return async_sendfile(socket, res->file, part.offset, part.length);
+        }).then(loop);
+    }).then([&socket, res]() {
+        return res->suffix.empty() ? resolve() : async_write_string(socket, res->suffix);
+    });
+}
+#endif
+
+#if USE_FILE_CACHE
+// A copy of a file in memory, together with the response header
+// values that are computed once when the file is loaded. It is copied
+// rather than mapped, so that a file truncated while it is being sent
+// cannot fault the server.
+struct cached_file {
+    std::unique_ptr<char[]> data;
+    file_meta meta;
+    // Extensions of the precompressed siblings present at load time
+    std::vector<std::string> siblings;
+};
+
+// Keeps served files in memory so that repeat requests never touch the
+// filesystem, evicting the least recently used ones to stay within the
+// total size. inotify reports any change, move or deletion of a cached
+// file, which drops it from the cache until it is requested again.
+// Files too large to cache are remembered until they change, so that
+// requests for them go straight to the filesystem.
+class file_cache : public std::enable_shared_from_this<file_cache> {
+public:
+    static constexpr std::uint64_t max_file_size = 16 * 1024 * 1024;
+    static constexpr std::uint64_t max_total_size = 256 * 1024 * 1024;
+
+    explicit file_cache(asio::io_context &ioc)
+        : inotify_(ioc) {
+        int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if(fd < 0)
+            fail({errno, boost::system::system_category()}, "inotify_init1");
+        else
+            inotify_.assign(fd);
+    }
+
+    // Start reading change notifications
+    void start() {
+        if(!inotify_.is_open())
+            return;
+        auto self = shared_from_this();
+        doWhile([self](DeferLoop &loop) {
+            self->inotify_.async_read_some(asio::buffer(self->events_),
+                [self, loop](boost::system::error_code err, std::size_t size) {
+                if(err) {
+                    fail(err, "inotify");
+                    loop.doBreak();
+                    return;
+                }
+                for(std::size_t pos = 0; pos < size;) {
+                    inotify_event event;
+                    std::memcpy(&event, self->events_.data() + pos, sizeof(event));
+                    self->invalidate(event.wd, (event.mask & IN_IGNORED) != 0);
+                    pos += sizeof(inotify_event) + event.len;
+                }
+                loop.doContinue();
+            });
+        });
+    }
+
+    // Returns the cached file, loading it on a miss. Returns null
+    // without an error when the file is too large to be cached.
+    std::shared_ptr<cached_file const>
+    find(std::string const& path, beast::error_code& ec) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = files_.find(path);
+            if(it != files_.end()) {
+                if(it->second.file)
+                    lru_.splice(lru_.begin(), lru_, it->second.lru);
+                return it->second.file;
+            }
+        }
+        if(!inotify_.is_open())
+            return nullptr;
+
+        // Watch before reading so no change can slip in unnoticed
+        int wd = ::inotify_add_watch(inotify_.native_handle(), path.c_str(),
+            IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+        if(wd < 0) {
+            ec = {errno, boost::system::system_category()};
+            return nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& paths = watches_[wd];
+            if(std::find(paths.begin(), paths.end(), path) == paths.end())
+                paths.push_back(path);
+        }
+
+        bool too_large = false;
+        auto file = load(path, too_large, ec);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(watches_.count(wd) == 0)
+            return file; // invalidated while loading, serve it uncached
+        if(file || too_large) {
+            if(file) {
+                while(total_size_ + file->meta.size > max_total_size && !lru_.empty())
+                    evict(files_.find(lru_.back()));
+            }
+            auto entry = files_.emplace(path, cache_entry{file, lru_.end(), wd});
+            if(entry.second && file) {
+                lru_.push_front(path);
+                entry.first->second.lru = lru_.begin();
+                total_size_ += file->meta.size;
+            }
+        }
+        else if(files_.count(path) == 0) {
+            // Not cached, so there is nothing to invalidate
+            unwatch(wd, path);
+        }
+        return file;
+    }
+
+private:
+    // A cached file, or a file too large to cache when file is null
+    struct cache_entry {
+        std::shared_ptr<cached_file const> file;
+        std::list<std::string>::iterator lru; // position in lru_ of a cached file
+        int wd;
+    };
+
+    // Reads the file into memory. Returns null without an error when it
+    // is too large to cache, or was truncated while it was read.
+    static std::shared_ptr<cached_file>
+    load(std::string const& path, bool& too_large, beast::error_code& ec) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0) {
+            ec = {errno, boost::system::system_category()};
+            return nullptr;
+        }
+        struct stat st;
+        if(::fstat(fd, &st) < 0) {
+            ec = {errno, boost::system::system_category()};
+            ::close(fd);
+            return nullptr;
+        }
+        if(!S_ISREG(st.st_mode)) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::no_such_file_or_directory);
+            ::close(fd);
+            return nullptr;
+        }
+        if(static_cast<std::uint64_t>(st.st_size) > max_file_size) {
+            too_large = true;
+            ::close(fd);
+            return nullptr;
+        }
+
+        auto file = std::make_shared<cached_file>();
+        file->meta = make_file_meta(path, st);
+        auto const size = static_cast<std::size_t>(file->meta.size);
+        file->data.reset(new char[size]);
+        for(std::size_t offset = 0; offset < size;) {
+            ssize_t n = ::read(fd, file->data.get() + offset, size - offset);
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n < 0) {
+                ec = {errno, boost::system::system_category()};
+                ::close(fd);
+                return nullptr;
+            }
+            if(n == 0) {
+                ::close(fd);
+                return nullptr; // truncated, inotify is about to report it
+            }
+            offset += static_cast<std::size_t>(n);
+        }
+        ::close(fd);
+
+        if(file->meta.vary_encoding) {
+            for(char const* extension : {".br", ".gz"}) {
+                struct stat sibling;
+                if(::stat((path + extension).c_str(), &sibling) == 0 && S_ISREG(sibling.st_mode))
+                    file->siblings.push_back(extension);
+            }
+        }
+        return file;
+    }
+
+    void invalidate(int wd, bool removed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = watches_.find(wd);
+        if(it == watches_.end())
+            return;
+        for(auto const& path : it->second) {
+            auto entry = files_.find(path);
+            if(entry != files_.end())
+                erase(entry);
+        }
+        watches_.erase(it);
+        if(!removed)
+            ::inotify_rm_watch(inotify_.native_handle(), wd);
+    }
+
+    // Drops the least recently used file, and stops watching it;
+    // called with the mutex held.
+    void evict(std::unordered_map<std::string, cache_entry>::iterator entry) {
+        unwatch(entry->second.wd, entry->first);
+        erase(entry);
+    }
+
+    // Called with the mutex held
+    void erase(std::unordered_map<std::string, cache_entry>::iterator entry) {
+        if(entry->second.file) {
+            total_size_ -= entry->second.file->meta.size;
+            lru_.erase(entry->second.lru);
+        }
+        files_.erase(entry);
+    }
+
+    // Stops watching the path, and the watch once it has no paths left;
+    // called with the mutex held.
+    void unwatch(int wd, std::string const& path) {
+        auto watch = watches_.find(wd);
+        if(watch == watches_.end())
+            return;
+        auto& paths = watch->second;
+        paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+        if(paths.empty()) {
+            watches_.erase(watch);
+            ::inotify_rm_watch(inotify_.native_handle(), wd);
+        }
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, cache_entry> files_;
+    std::list<std::string> lru_; // paths of the cached files, most recently used first
+    std::unordered_map<int, std::vector<std::string>> watches_;
+    std::uint64_t total_size_ = 0;
+    asio::posix::stream_descriptor inotify_;
+    alignas(inotify_event) std::array<char, 4096> events_;
+};
+
+// A response whose body points into a cached file; holding the
+// file keeps its contents alive until the write completes.
+struct cached_response {
+    http::response<http::span_body<char const>> message;
+    std::shared_ptr<cached_file const> file;
+};
+#endif
+
 // Append an HTTP rel-path to a local filesystem path.
 // The returned path is normalized for the platform.
 std::string
@@ -211,10 +861,147 @@ handle_request(
     if(session->req_.target().back() == '/')
         path.append("index.html");
 
-    // Attempt to open the file
+    // Checks the request's preconditions and ranges against the file;
+    // returns ok when the file, or the requested ranges of it, is sent.
+    std::vector<byte_range> ranges;
+    auto const check_preconditions =
+    [session, &ranges](file_meta const& meta, bool ranges_supported)
+    {
+        if(not_modified(session->req_, meta))
+            return http::status::not_modified;
+        if(ranges_supported &&
+            session->req_.method() == http::verb::get &&
+            parse_ranges(session->req_, meta, ranges) &&
+            ranges.empty())
+            return http::status::range_not_satisfiable;
+        return http::status::ok;
+    };
+
+    // Returns a not modified or range not satisfiable response
+    auto const precondition_response =
+    [session](file_meta const& meta, http::status status)
+    {
+        http::response<http::empty_body> res{status, session->req_.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::etag, meta.etag);
+        res.set(http::field::last_modified, meta.last_modified);
+        if(meta.vary_encoding)
+            res.set(http::field::vary, "Accept-Encoding");
+        if(status == http::status::range_not_satisfiable)
+        {
+            res.set(http::field::content_range, "bytes */" + std::to_string(meta.size));
+            res.content_length(0);
+        }
+        res.keep_alive(session->req_.keep_alive());
+        return res;
+    };
+
+    // Returns the header of the response carrying the file
+    auto const file_header =
+    [session](file_meta const& meta, body_layout const& layout, bool ranges_supported)
+    {
+        http::response<http::empty_body> res{layout.status, session->req_.version()};
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, layout.content_type);
+        if(!meta.content_encoding.empty())
+            res.set(http::field::content_encoding, meta.content_encoding);
+        if(meta.vary_encoding)
+            res.set(http::field::vary, "Accept-Encoding");
+        res.set(http::field::etag, meta.etag);
+        res.set(http::field::last_modified, meta.last_modified);
+        if(ranges_supported)
+            res.set(http::field::accept_ranges, "bytes");
+        if(!layout.content_range.empty())
+            res.set(http::field::content_range, layout.content_range);
+        res.content_length(layout.content_length);
+        res.keep_alive(session->req_.keep_alive());
+        return res;
+    };
+
     beast::error_code ec;
+#if USE_FILE_CACHE
+    // Serve from memory when the file is cached
+    if(auto file = session->cache_->find(path, ec)) {
+        // Swap in a precompressed sibling the client accepts
+        file_meta const* meta = &file->meta;
+        file_meta encoded;
+        if(!file->siblings.empty()) {
+            for(auto const& sibling : accepted_siblings(session->req_)) {
+                if(std::find(file->siblings.begin(), file->siblings.end(), sibling.extension) == file->siblings.end())
+                    continue;
+                beast::error_code sibling_ec;
+                if(auto encoded_file = session->cache_->find(path + sibling.extension, sibling_ec)) {
+                    encoded = encoded_file->meta;
+                    apply_encoding(encoded, path, sibling);
+                    meta = &encoded;
+                    file = encoded_file;
+                    break;
+                }
+            }
+        }
+
+        auto const status = check_preconditions(*meta, true);
+        if(status != http::status::ok)
+            return send(precondition_response(*meta, status));
+
+        body_layout const layout = make_layout(*meta, ranges);
+        auto header = file_header(*meta, layout, true);
+
+        // Respond to HEAD request
+        if(session->req_.method() == http::verb::head)
+            return send(std::move(header));
+
+        // Respond to GET request for the file or a single range of it
+        char const* data = file->data.get();
+        if(layout.parts.size() == 1)
+        {
+            body_part const& part = layout.parts.front();
+            cached_response res{
+                http::response<http::span_body<char const>>{
+                    std::move(header.base()),
+                    data + part.offset,
+                    static_cast<std::size_t>(part.length)},
+                file};
+            return send(std::move(res));
+        }
+
+        // Respond to GET request for multiple ranges
+        http::response<http::string_body> res{std::move(header.base())};
+        res.body().reserve(static_cast<std::size_t>(layout.content_length));
+        for(auto const& part : layout.parts)
+        {
+            res.body() += part.prefix;
+            res.body().append(data + part.offset, static_cast<std::size_t>(part.length));
+        }
+        res.body() += layout.suffix;
+        return send(std::move(res));
+    }
+    if(ec == boost::system::errc::no_such_file_or_directory)
+        return send(not_found(session->req_.target()));
+    if(ec)
+        return send(server_error(ec.message()));
+#endif
+
+    // Prefer a precompressed sibling the client accepts
+    std::string file_path = path;
+    precompressed const* encoding = nullptr;
+    std::vector<precompressed> siblings;
+    if(is_compressible(mime_type(path)))
+        siblings = accepted_siblings(session->req_);
+    for(auto const& sibling : siblings)
+    {
+        struct stat st;
+        if(::stat((path + sibling.extension).c_str(), &st) == 0 && S_ISREG(st.st_mode))
+        {
+            file_path = path + sibling.extension;
+            encoding = &sibling;
+            break;
+        }
+    }
+
+    // Attempt to open the file
     http::file_body::value_type body;
-    body.open(path.c_str(), beast::file_mode::scan, ec);
+    body.open(file_path.c_str(), beast::file_mode::scan, ec);
 
     // Handle the case where the file doesn't exist
     if(ec == boost::system::errc::no_such_file_or_directory)
@@ -224,41 +1011,43 @@ handle_request(
     if(ec)
         return send(server_error(ec.message()));
 
-    // Cache the size since we need it after the move
-    auto const size = body.size();
+    struct stat st;
+    if(::stat(file_path.c_str(), &st) != 0)
+        return send(server_error(std::strerror(errno)));
+    file_meta meta = make_file_meta(path, st);
+    if(encoding)
+        apply_encoding(meta, path, *encoding);
+
+    // Ranges are only served with sendfile(2)
+    bool constexpr ranges_supported = USE_SENDFILE != 0;
+    auto const status = check_preconditions(meta, ranges_supported);
+    if(status != http::status::ok)
+        return send(precondition_response(meta, status));
+
+    body_layout const layout = make_layout(meta, ranges);
+    auto header = file_header(meta, layout, ranges_supported);
 
     // Respond to HEAD request
     if(session->req_.method() == http::verb::head)
-    {
-        http::response<http::empty_body> res{http::status::ok, session->req_.version()};
-        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-        res.set(http::field::content_type, mime_type(path));
-        res.content_length(size);
-        res.keep_alive(session->req_.keep_alive());
-        return send(std::move(res));
-    }
+        return send(std::move(header));
 
+#if USE_SENDFILE
+    // Respond to GET request, the body is sent by sendfile(2)
+    sendfile_response res{
+        std::move(header),
+        std::move(body.file()),
+        layout.parts,
+        layout.suffix};
+    return send(std::move(res));
+#else
     // Respond to GET request
-    http::response<http::file_body> res{
-        std::piecewise_construct,
-        std::make_tuple(std::move(body)),
-        std::make_tuple(http::status::ok, session->req_.version())};
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, mime_type(path));
-    res.content_length(size);
-    res.keep_alive(session->req_.keep_alive());
+    http::response<http::file_body> res{std::move(header.base()), std::move(body)};
     return send(std::move(res));
+#endif
 }
 
 //------------------------------------------------------------------------------
 
-// Report a failure
-void
-fail(boost::system::error_code ec, char const* what)
-{
-    std::cerr << what << ": " << ec.message() << "\n";
-}
-
 // This is the C++11 equivalent of a generic lambda.
 // The function object is used to send an HTTP message.
 template<class Stream>
@@ -285,11 +1074,40 @@ struct send_lambda
         // The lifetime of the message has to extend
         // for the duration of the async operation so
         // we use a shared_ptr to manage it.
-        auto sp = std::make_shared<http::message<isRequest, Body, Fields>>(std::move(msg));
+        using message = http::message<isRequest, Body, Fields>;
+        auto sp = std::allocate_shared<message>(pool_allocator<message>{}, std::move(msg));
         return async_write(stream_, *sp).finally([sp]() {
             //sp will not be deleted util finally() called
         });
     }
+
+#if USE_FILE_CACHE
+    Promise
+    operator()(cached_response&& res) const
+    {
+        close_ = res.message.need_eof();
+        auto sp = std::allocate_shared<cached_response>(pool_allocator<cached_response>{}, std::move(res));
+        return async_write(stream_, sp->message).finally([sp]() {
+            //sp will not be deleted util finally() called
+        });
+    }
+#endif
+
+#if USE_SENDFILE
+    Promise
+    operator()(sendfile_response&& res) const
+    {
+        close_ = res.header.need_eof();
+        // The header is written by beast, the body by the kernel
+        auto sp = std::allocate_shared<sendfile_response>(pool_allocator<sendfile_response>{}, std::move(res));
+        Stream& stream = stream_;
+        return async_write(stream_, sp->header).then([&stream, sp]() {
+            return async_send_parts(stream, sp);
+        }).finally([sp]() {
+            //sp will not be deleted util finally() called
+        });
+    }
+#endif
 };
 
 // Handles an HTTP server connection
@@ -363,10 +1181,15 @@ do_listen(
         return fail(ec, "listen");
 
     auto doc_root_ = std::make_shared<std::string>(doc_root);
-    doWhile([acceptor, doc_root_](DeferLoop &loop){
+    std::shared_ptr<file_cache> cache;
+#if USE_FILE_CACHE
+    cache = std::make_shared<file_cache>(ioc);
+    cache->start();
+#endif
+    doWhile([acceptor, doc_root_, cache](DeferLoop &loop){
         async_accept(*acceptor).then([=](std::shared_ptr<tcp::socket> socket) {
             std::cout << "accepted" << std::endl;
-            auto session = std::make_shared<Session>(*socket, *doc_root_);
+            auto session = std::allocate_shared<Session>(pool_allocator<Session>{}, *socket, *doc_root_, cache);
             do_session(session);
         }).fail([](const boost::system::error_code err) {
         }).then(loop);
@@ -376,10 +1199,10 @@ do_listen(
 int main(int argc, char* argv[])
 {
     // Check command line arguments.
-    if (argc != 5)
+    if (argc != 5 && argc != 6)
     {
         std::cerr <<
-            "Usage: " << argv[0] << " <address> <port> <doc_root> <threads>\n" <<
+            "Usage: " << argv[0] << " <address> <port> <doc_root> <threads> [mime.types]\n" <<
             "Example:\n" <<
             "    " << argv[0] << " 0.0.0.0 8080 . 1\n";
         return EXIT_FAILURE;
@@ -389,6 +1212,13 @@ int main(int argc, char* argv[])
     std::string const doc_root = argv[3];
     auto const threads = std::max<int>(1, std::atoi(argv[4]));
 
+    // Extend the built in MIME types before any request is served
+    if(argc == 6 && !g_mime_types.load(argv[5]))
+    {
+        std::cerr << "Cannot read MIME types from " << argv[5] << "\n";
+        return EXIT_FAILURE;
+    }
+
     // The io_context is required for all I/O
     asio::io_context ioc{threads};
 
@@ -0,0 +1,171 @@
+//
+// Compares the promise adapters of add_ons/asio/io.hpp with the typed
+// adapters of add_ons/asio/typed_io.hpp and, when built as C++20, with
+// those adapters awaited from a coroutine. A request is written to one
+// end of a loopback connection and read from the other, and the time
+// and heap allocations per asynchronous operation are reported.
+//
+// Usage: asio_io_benchmark [<round trips>]
+//
+
+#include "add_ons/asio/io.hpp"
+#include "add_ons/asio/typed_io.hpp"
+#if defined(__cpp_impl_coroutine)
+#include "add_ons/asio/coroutine.hpp"
+#endif
+#include "add_ons/memory/pool_allocator.hpp"
+#include "allocation_count.hpp"
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace promise;
+using namespace pool_memory;
+namespace asio  = boost::asio;
+namespace beast = boost::beast;
+namespace http  = boost::beast::http;
+using     tcp   = boost::asio::ip::tcp;
+
+// Messages and buffers use the pool too, so that only the adapters differ
+using fields  = http::basic_fields<pool_allocator<char>>;
+using request = http::request<http::empty_body, fields>;
+using buffer  = beast::basic_flat_buffer<pool_allocator<char>>;
+
+struct connection {
+    asio::io_context ioc;
+    tcp::socket client{ioc};
+    tcp::socket server{ioc};
+    request req;
+    request received;
+    buffer buf;
+
+    connection() {
+        tcp::acceptor acceptor{ioc, tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+        client.connect(acceptor.local_endpoint());
+        acceptor.accept(server);
+        req.method(http::verb::get);
+        req.target("/comic/0");
+        req.version(11);
+    }
+};
+
+struct measurement {
+    double ns_per_op;
+    double allocations_per_op;
+};
+
+template<typename RoundTrips>
+static measurement measure(connection &conn, int round_trips, RoundTrips run) {
+    // Warm up the pools first
+    run(conn, 100);
+    conn.ioc.restart();
+
+    std::size_t const allocations_before = allocation_count();
+    auto const begin = std::chrono::steady_clock::now();
+    run(conn, round_trips);
+    auto const end = std::chrono::steady_clock::now();
+    conn.ioc.restart();
+
+    double const ops = 2.0 * round_trips;
+    return {
+        std::chrono::duration<double, std::nano>(end - begin).count() / ops,
+        (allocation_count() - allocations_before) / ops
+    };
+}
+
+// Each round trip is a promise chain over the io.hpp adapters
+static void promise_round_trips(connection &conn, int round_trips) {
+    int count = 0;
+    doWhile([&](DeferLoop &loop) {
+        promise::async_write(conn.client, conn.req).then([&]() {
+            conn.received = {};
+            return promise::async_read(conn.server, conn.buf, conn.received);
+        }).then([&]() {
+            if (++count < round_trips)
+                loop.doContinue();
+            else
+                loop.doBreak();
+        }, [&](boost::system::error_code err) {
+            std::fprintf(stderr, "round trip: %s\n", err.message().c_str());
+            loop.doBreak();
+        });
+    });
+    conn.ioc.run();
+}
+
+// Each round trip chains handlers over the typed_io.hpp adapters
+struct typed_round_trip {
+    connection &conn;
+    int remaining;
+
+    void start() {
+        typed::async_write(conn.client, conn.req).then(
+            [self = *this](boost::system::error_code err, std::size_t) mutable {
+                if (err)
+                    return self.fail(err);
+                self.conn.received = {};
+                typed::async_read(self.conn.server, self.conn.buf, self.conn.received).then(
+                    [self](boost::system::error_code err, std::size_t) mutable {
+                        if (err)
+                            return self.fail(err);
+                        if (--self.remaining > 0)
+                            self.start();
+                    });
+            });
+    }
+
+    void fail(boost::system::error_code err) {
+        std::fprintf(stderr, "round trip: %s\n", err.message().c_str());
+    }
+};
+
+static void typed_round_trips(connection &conn, int round_trips) {
+    typed_round_trip{conn, round_trips}.start();
+    conn.ioc.run();
+}
+
+#if defined(__cpp_impl_coroutine)
+// All round trips run in one coroutine
+static Promise coroutine_round_trip_loop(connection &conn, int round_trips) {
+    for (int i = 0; i < round_trips; ++i) {
+        auto [write_err, written] = co_await typed::async_write(conn.client, conn.req);
+        if (write_err) {
+            std::fprintf(stderr, "round trip: %s\n", write_err.message().c_str());
+            co_return;
+        }
+        conn.received = {};
+        auto [read_err, read] = co_await typed::async_read(conn.server, conn.buf, conn.received);
+        if (read_err) {
+            std::fprintf(stderr, "round trip: %s\n", read_err.message().c_str());
+            co_return;
+        }
+    }
+}
+
+static void coroutine_round_trips(connection &conn, int round_trips) {
+    coroutine_round_trip_loop(conn, round_trips);
+    conn.ioc.run();
+}
+#endif
+
+int main(int argc, char *argv[]) {
+    int const round_trips = argc > 1 ? std::atoi(argv[1]) : 100000;
+    connection conn;
+
+    measurement const with_promises = measure(conn, round_trips, promise_round_trips);
+    measurement const with_typed = measure(conn, round_trips, typed_round_trips);
+#if defined(__cpp_impl_coroutine)
+    measurement const with_coroutine = measure(conn, round_trips, coroutine_round_trips);
+#endif
+
+    std::printf("%-10s %12s %16s\n", "adapters", "ns/op", "allocations/op");
+    std::printf("%-10s %12.1f %16.2f\n", "io.hpp", with_promises.ns_per_op, with_promises.allocations_per_op);
+    std::printf("%-10s %12.1f %16.2f\n", "typed_io", with_typed.ns_per_op, with_typed.allocations_per_op);
+#if defined(__cpp_impl_coroutine)
+    std::printf("%-10s %12.1f %16.2f\n", "coroutine", with_coroutine.ns_per_op, with_coroutine.allocations_per_op);
+#endif
+    return 0;
+}
@@ -26,8 +26,10 @@
  */
 
 #include "add_ons/asio/timer.hpp"
+#include "add_ons/promise/combinators.hpp"
 #include <stdio.h>
 #include <boost/asio.hpp>
+#include <vector>
 
 using namespace promise;
 namespace asio = boost::asio;
@@ -83,11 +85,28 @@ void testPromiseAll(asio::io_service &io) {
     });
 }
 
+void testMapLimit(asio::io_service &io) {
+    std::vector<int> delays{800, 200, 600, 400, 1000, 300};
+
+    // At most 2 of the 6 delays are pending at any time
+    mapLimit<int>(delays.begin(), delays.end(), 2, [&io](int time_ms) {
+        return delay(io, time_ms).then([time_ms] {
+            printf("mapLimit: %d ms resolved\n", time_ms);
+            return time_ms;
+        });
+    }).then([](std::vector<int> &results) {
+        printf("mapLimit size = %d\n", (int)results.size());
+        for (size_t i = 0; i < results.size(); ++i)
+            printf("mapLimit result = %d\n", results[i]);
+    });
+}
+
 int main() {
     asio::io_service io;
 
     testPromiseRace(io);
     testPromiseAll(io);
+    testMapLimit(io);
 
     Promise timer = testTimer(io);
 
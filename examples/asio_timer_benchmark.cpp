@@ -0,0 +1,81 @@
+//
+// Compares delay(), backed by the timer wheel, with precise_delay(),
+// which uses one steady_timer per call, the way per-request timeouts
+// use them: many are started and most are cleared before they fire.
+//
+// Usage: asio_timer_benchmark [<timeouts>]
+//
+
+#include "add_ons/asio/timer.hpp"
+#include "allocation_count.hpp"
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+using namespace promise;
+namespace asio = boost::asio;
+
+struct measurement {
+    double start_ns;
+    double clear_ns;
+    double allocations_per_timeout;
+};
+
+// setTimeout() goes through delay(); this variant goes through precise_delay()
+static Promise precise_timeout(asio::io_service &io, const std::function<void(bool)> &func, uint64_t time_ms) {
+    return precise_delay(io, time_ms).then([func]() {
+        func(false);
+    }, [func]() {
+        func(true);
+    });
+}
+
+// Starts count timeouts of 5 to 30 seconds and clears them all again
+template<typename Timeout>
+static measurement measure_with(int count, Timeout set_timeout) {
+    asio::io_service io;
+    std::mt19937 random{42};
+    std::uniform_int_distribution<uint64_t> timeout_ms(5000, 30000);
+    std::vector<Promise> timeouts;
+    timeouts.reserve(count);
+
+    // Warm up the pools first
+    for (int i = 0; i < 100; ++i)
+        clearTimeout(set_timeout(io, [](bool) {}, timeout_ms(random)));
+    io.poll();
+    io.restart();
+
+    std::size_t const allocations_before = allocation_count();
+    auto const begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i)
+        timeouts.push_back(set_timeout(io, [](bool) {}, timeout_ms(random)));
+    auto const started = std::chrono::steady_clock::now();
+    for (Promise &timeout : timeouts)
+        clearTimeout(timeout);
+    io.poll();
+    auto const end = std::chrono::steady_clock::now();
+    std::size_t const allocations_after = allocation_count();
+
+    return {
+        std::chrono::duration<double, std::nano>(started - begin).count() / count,
+        std::chrono::duration<double, std::nano>(end - started).count() / count,
+        static_cast<double>(allocations_after - allocations_before) / count
+    };
+}
+
+int main(int argc, char *argv[]) {
+    int const count = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+    measurement const wheel = measure_with(count, setTimeout);
+    measurement const timers = measure_with(count, precise_timeout);
+
+    std::printf("%d timeouts\n", count);
+    std::printf("%-14s %12s %12s %16s\n", "delay", "start ns", "clear ns", "allocations");
+    std::printf("%-14s %12.1f %12.1f %16.2f\n", "timer wheel", wheel.start_ns, wheel.clear_ns, wheel.allocations_per_timeout);
+    std::printf("%-14s %12.1f %12.1f %16.2f\n", "steady_timer", timers.start_ns, timers.clear_ns, timers.allocations_per_timeout);
+    return 0;
+}
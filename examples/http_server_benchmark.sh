@@ -0,0 +1,76 @@
+#!/usr/bin/env bash
+#
+# Runs asio_http_load against each of several HTTP server commands in
+# turn and prints their throughput side by side. PORT in a command is
+# replaced by the port the server is to listen on. Each server gets a
+# warm-up run first, which is not reported. With SYSCALLS=1 the system
+# calls the server makes during the measured run are counted with perf
+# and reported per response; perf needs access to the raw_syscalls
+# tracepoint for that.
+#
+# Usage: http_server_benchmark.sh <asio_http_load> <target> <connections> <seconds> <label>=<command>...
+#
+# Example --
+#   http_server_benchmark.sh ./asio_http_load /comic/0 64 10 \
+#       "shared=./comics-server 127.0.0.1 PORT 4" \
+#       "per-core=./comics-server 127.0.0.1 PORT 4 --per-core --pin"
+#   SYSCALLS=1 http_server_benchmark.sh ./asio_http_load /comic/0 64 10 \
+#       "epoll=./comics-server 127.0.0.1 PORT 1" "io_uring=./io-uring/comics-server 127.0.0.1 PORT 1"
+#   http_server_benchmark.sh ./asio_http_load /comic/0 32 5 \
+#       "promise=./comics-server 127.0.0.1 PORT 1" "coroutine=./coroutines/comics-server 127.0.0.1 PORT 1"
+#
+set -u
+
+load=$1
+target=$2
+connections=$3
+seconds=$4
+shift 4
+port=${BENCHMARK_PORT:-18180}
+syscalls=${SYSCALLS:-0}
+counts=$(mktemp)
+pid=
+
+cleanup()
+{
+    [ -n "$pid" ] && kill "$pid" 2>/dev/null
+    wait 2>/dev/null
+    rm -f "$counts"
+}
+trap cleanup EXIT
+
+if [ "$syscalls" = 1 ] && ! command -v perf >/dev/null; then
+    echo "SYSCALLS=1 needs perf" >&2
+    exit 1
+fi
+
+printf '%-16s %14s %14s %10s' server responses/s MB/s errors
+[ "$syscalls" = 1 ] && printf ' %14s' syscalls/resp
+printf '\n'
+for server in "$@"; do
+    label=${server%%=*}
+    command=${server#*=}
+    port=$((port + 1))
+    ${command//PORT/$port} >/dev/null 2>&1 & pid=$!
+    for _ in $(seq 50); do
+        (exec 3<>"/dev/tcp/127.0.0.1/$port") 2>/dev/null && break
+        sleep 0.1
+    done
+    "$load" 127.0.0.1 "$port" "$target" "$connections" 2 >/dev/null 2>&1
+    if [ "$syscalls" = 1 ]; then
+        perf stat -e raw_syscalls:sys_enter -x, -o "$counts" -p "$pid" -- sleep "$seconds" 2>/dev/null & perf=$!
+    fi
+    result=$("$load" 127.0.0.1 "$port" "$target" "$connections" "$seconds" 2>/dev/null | tail -1)
+    read -r _ responses mbytes errors <<<"$result"
+    printf '%-16s %14s %14s %10s' "$label" "$responses" "$mbytes" "$errors"
+    if [ "$syscalls" = 1 ]; then
+        wait "$perf"
+        calls=$(grep raw_syscalls "$counts" | cut -d, -f1)
+        awk -v calls="$calls" -v rate="$responses" -v seconds="$seconds" \
+            'BEGIN { printf " %14.2f", rate > 0 ? calls / (rate * seconds) : 0 }'
+    fi
+    printf '\n'
+    kill "$pid" 2>/dev/null
+    wait "$pid" 2>/dev/null
+    pid=
+done
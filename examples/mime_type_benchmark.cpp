@@ -0,0 +1,92 @@
+//
+// Compares the perfect hash lookup of MIME types in mime_types.hpp with
+// the chain of case insensitive comparisons asio_http_server used
+// before, over paths with a mix of extensions. Both include the rfind
+// for the extension, as mime_type() does.
+//
+// Usage: mime_type_benchmark [<lookups>]
+//
+
+#include "add_ons/http/mime_types.hpp"
+#include <boost/beast/core/string.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+namespace beast = boost::beast;
+
+// The previous lookup
+static beast::string_view if_chain_mime_type(beast::string_view path) {
+    using beast::iequals;
+    auto const ext = [&path] {
+        auto const pos = path.rfind(".");
+        if(pos == beast::string_view::npos)
+            return beast::string_view{};
+        return path.substr(pos);
+    }();
+    if(iequals(ext, ".htm"))  return "text/html";
+    if(iequals(ext, ".html")) return "text/html";
+    if(iequals(ext, ".php"))  return "text/html";
+    if(iequals(ext, ".css"))  return "text/css";
+    if(iequals(ext, ".txt"))  return "text/plain";
+    if(iequals(ext, ".js"))   return "application/javascript";
+    if(iequals(ext, ".json")) return "application/json";
+    if(iequals(ext, ".xml"))  return "application/xml";
+    if(iequals(ext, ".swf"))  return "application/x-shockwave-flash";
+    if(iequals(ext, ".flv"))  return "video/x-flv";
+    if(iequals(ext, ".png"))  return "image/png";
+    if(iequals(ext, ".jpe"))  return "image/jpeg";
+    if(iequals(ext, ".jpeg")) return "image/jpeg";
+    if(iequals(ext, ".jpg"))  return "image/jpeg";
+    if(iequals(ext, ".gif"))  return "image/gif";
+    if(iequals(ext, ".bmp"))  return "image/bmp";
+    if(iequals(ext, ".ico"))  return "image/vnd.microsoft.icon";
+    if(iequals(ext, ".tiff")) return "image/tiff";
+    if(iequals(ext, ".tif"))  return "image/tiff";
+    if(iequals(ext, ".svg"))  return "image/svg+xml";
+    if(iequals(ext, ".svgz")) return "image/svg+xml";
+    return "application/text";
+}
+
+static beast::string_view perfect_hash_mime_type(beast::string_view path) {
+    static http_mime::mime_types const types;
+    auto const pos = path.rfind(".");
+    if(pos == beast::string_view::npos)
+        return "application/text";
+    auto const type = types.find(std::string_view{path.data() + pos, path.size() - pos});
+    if(type.empty())
+        return "application/text";
+    return beast::string_view{type.data(), type.size()};
+}
+
+static char const* const paths[] = {
+    "/index.html", "/css/site.css", "/js/app.js", "/img/logo.png", "/img/photo.JPG",
+    "/api/comics.json", "/favicon.ico", "/docs/readme.txt", "/img/icon.svgz", "/download/archive.zip"};
+
+// Returns the nanoseconds per lookup
+template<typename Lookup>
+static double measure(int lookups, Lookup lookup) {
+    std::size_t checksum = 0;
+    auto const begin = std::chrono::steady_clock::now();
+    for(int i = 0; i < lookups; ++i)
+        checksum += lookup(paths[i % (sizeof(paths) / sizeof(paths[0]))]).size();
+    auto const end = std::chrono::steady_clock::now();
+    // Keep the lookups from being optimized away
+    if(checksum == 0)
+        std::printf("no lookups\n");
+    return std::chrono::duration<double, std::nano>(end - begin).count() / lookups;
+}
+
+int main(int argc, char *argv[]) {
+    int const lookups = argc > 1 ? std::atoi(argv[1]) : 20000000;
+
+    double const chain = measure(lookups, if_chain_mime_type);
+    double const hash = measure(lookups, perfect_hash_mime_type);
+
+    std::printf("%d lookups over %zu paths\n", lookups, sizeof(paths) / sizeof(paths[0]));
+    std::printf("%-14s %12s\n", "lookup", "ns");
+    std::printf("%-14s %12.1f\n", "if chain", chain);
+    std::printf("%-14s %12.1f\n", "perfect hash", hash);
+    return 0;
+}
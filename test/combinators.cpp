@@ -0,0 +1,191 @@
+#include <add_ons/promise/combinators.hpp>
+
+#include <gtest/gtest.h>
+
+#include <boost/asio/error.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace promise;
+
+namespace
+{
+
+// Tasks whose promises are settled by the test, in any order
+struct ManualTasks
+{
+    std::vector<Defer> m_pending;
+    std::size_t        m_running{};
+    std::size_t        m_maxRunning{};
+    std::size_t        m_started{};
+
+    Promise start()
+    {
+        ++m_started;
+        m_maxRunning = std::max(m_maxRunning, ++m_running);
+        return newPromise([this](Defer &defer) { m_pending.push_back(defer); });
+    }
+
+    // Removes the oldest pending task, to be settled by the caller
+    Defer takeNext()
+    {
+        Defer defer = m_pending.front();
+        m_pending.erase(m_pending.begin());
+        --m_running;
+        return defer;
+    }
+
+    // Resolves the oldest pending task with value
+    void resolveNext(int value)
+    {
+        takeNext().resolve(value);
+    }
+
+    void rejectNext(boost::system::error_code err)
+    {
+        takeNext().reject(err);
+    }
+
+    void rejectNext(std::exception_ptr exception)
+    {
+        takeNext().reject(exception);
+    }
+};
+
+} // namespace
+
+TEST(Combinators, MapLimitKeepsAtMostLimitTasksPending)
+{
+    ManualTasks      tasks;
+    std::vector<int> inputs{1, 2, 3, 4, 5, 6, 7};
+    std::vector<int> results;
+
+    mapLimit<int>(inputs.begin(), inputs.end(), 3, [&tasks](int) { return tasks.start(); })
+        .then([&results](std::vector<int> &values) { results = values; });
+
+    EXPECT_EQ(3U, tasks.m_started);
+    for (int i = 0; i < 7; ++i)
+    {
+        tasks.resolveNext(inputs[i] * 10);
+    }
+
+    EXPECT_EQ(3U, tasks.m_maxRunning);
+    EXPECT_EQ(7U, tasks.m_started);
+    EXPECT_EQ((std::vector<int>{10, 20, 30, 40, 50, 60, 70}), results);
+}
+
+TEST(Combinators, MapLimitRejectsWithTheFirstErrorAndStopsStarting)
+{
+    ManualTasks               tasks;
+    std::vector<int>          inputs{1, 2, 3, 4, 5, 6};
+    boost::system::error_code rejected;
+    bool                      resolved{};
+
+    mapLimit<int>(inputs.begin(), inputs.end(), 2, [&tasks](int) { return tasks.start(); })
+        .then([&resolved](std::vector<int> &) { resolved = true; },
+              [&rejected](boost::system::error_code err) { rejected = err; });
+
+    tasks.rejectNext(boost::asio::error::connection_refused);
+    EXPECT_FALSE(rejected) << "waits for the task already started";
+    tasks.resolveNext(2);
+
+    EXPECT_FALSE(resolved);
+    EXPECT_EQ(boost::system::error_code{boost::asio::error::connection_refused}, rejected);
+    EXPECT_EQ(2U, tasks.m_started);
+}
+
+TEST(Combinators, MapLimitRejectsWithTheExceptionOfATask)
+{
+    ManualTasks        tasks;
+    std::vector<int>   inputs{1, 2};
+    std::exception_ptr rejected;
+
+    mapLimit<int>(inputs.begin(), inputs.end(), 2, [&tasks](int) { return tasks.start(); })
+        .then([](std::vector<int> &) {}, [&rejected](std::exception_ptr exception) { rejected = exception; });
+
+    tasks.rejectNext(std::make_exception_ptr(std::out_of_range("stoi")));
+    tasks.resolveNext(2);
+
+    ASSERT_TRUE(rejected);
+    EXPECT_THROW(std::rethrow_exception(rejected), std::out_of_range);
+}
+
+TEST(Combinators, AllSettledLimitReportsEveryOutcomeInInputOrder)
+{
+    ManualTasks               tasks;
+    std::vector<int>          inputs{1, 2, 3};
+    std::vector<settled<int>> results;
+
+    allSettledLimit<int>(inputs.begin(), inputs.end(), 2, [&tasks](int) { return tasks.start(); })
+        .then([&results](std::vector<settled<int>> &values) { results = values; });
+
+    tasks.resolveNext(1);
+    tasks.rejectNext(boost::asio::error::timed_out);
+    tasks.resolveNext(3);
+
+    ASSERT_EQ(3U, results.size());
+    EXPECT_TRUE(results[0].fulfilled);
+    EXPECT_EQ(1, results[0].value);
+    EXPECT_FALSE(results[1].fulfilled);
+    EXPECT_EQ(boost::system::error_code{boost::asio::error::timed_out}, results[1].error);
+    EXPECT_TRUE(results[2].fulfilled);
+    EXPECT_EQ(3, results[2].value);
+}
+
+TEST(Combinators, AllSettledLimitKeepsRejectionsOfAnyKind)
+{
+    ManualTasks               tasks;
+    std::vector<int>          inputs{1, 2, 3};
+    std::vector<settled<int>> results;
+
+    allSettledLimit<int>(inputs.begin(), inputs.end(), 3, [&tasks](int) { return tasks.start(); })
+        .then([&results](std::vector<settled<int>> &values) { results = values; });
+
+    tasks.rejectNext(std::make_exception_ptr(std::logic_error("offloaded")));
+    tasks.takeNext().reject(std::string("neither an error_code nor an exception"));
+    tasks.resolveNext(3);
+
+    ASSERT_EQ(3U, results.size());
+    EXPECT_FALSE(results[0].fulfilled);
+    EXPECT_FALSE(results[0].error);
+    EXPECT_THROW(std::rethrow_exception(results[0].exception), std::logic_error);
+    EXPECT_FALSE(results[1].fulfilled);
+    EXPECT_THROW(std::rethrow_exception(results[1].exception), std::runtime_error);
+    EXPECT_TRUE(results[2].fulfilled);
+    EXPECT_EQ(3, results[2].value);
+}
+
+TEST(Combinators, EachLimitHandlesSynchronouslySettledTasksWithoutRecursion)
+{
+    const int        count = 100000;
+    std::size_t      sum{};
+    bool             done{};
+    std::vector<int> inputs(count, 1);
+
+    eachLimit<int>(inputs.begin(), inputs.end(), 4, [](int value) { return resolve(value); },
+                   [&sum](std::size_t, settled<int> &&result)
+                   {
+                       sum += result.value;
+                       return true;
+                   })
+        .then([&done] { done = true; });
+
+    EXPECT_TRUE(done);
+    EXPECT_EQ(static_cast<std::size_t>(count), sum);
+}
+
+TEST(Combinators, EmptyRangeResolvesImmediately)
+{
+    std::vector<int> inputs;
+    bool             resolved{};
+
+    mapLimit<int>(inputs.begin(), inputs.end(), 4, [](int value) { return resolve(value); })
+        .then([&resolved](std::vector<int> &values) { resolved = values.empty(); });
+
+    EXPECT_TRUE(resolved);
+}
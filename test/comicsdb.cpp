@@ -0,0 +1,764 @@
+#include <comicsdb.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Comics = comicsdb::v2;
+
+namespace
+{
+
+Comics::Comic makeComic(const std::string &title, int issue, const std::string &inker = "George Klein")
+{
+    Comics::Comic comic;
+    comic.title = title;
+    comic.issue = issue;
+    comic.script = Comics::findPerson("Stan Lee");
+    comic.pencils = Comics::findPerson("Jack Kirby");
+    comic.inks = Comics::findPerson(inker);
+    comic.letters = Comics::findPerson("Artie Simek");
+    comic.colors = Comics::findPerson("Stan Goldberg");
+    return comic;
+}
+
+} // namespace
+
+TEST(ChangeFeed, RecordsEachChangeInOrder)
+{
+    Comics::ComicDb db;
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1));
+    updateComic(db, id, makeComic("The Fantastic Four", 1, "Dick Ayers"));
+    deleteComic(db, id);
+
+    const Comics::ChangeBatch batch = changesSince(db, 0, 100);
+
+    EXPECT_EQ(3U, batch.sequence);
+    EXPECT_FALSE(batch.resync);
+    ASSERT_EQ(3U, batch.changes.size());
+    EXPECT_EQ(Comics::Change::Kind::Create, batch.changes[0].kind);
+    EXPECT_EQ(Comics::Change::Kind::Update, batch.changes[1].kind);
+    EXPECT_EQ("Dick Ayers", batch.changes[1].comic.inks->name());
+    EXPECT_EQ(Comics::Change::Kind::Delete, batch.changes[2].kind);
+    for (std::size_t i = 0; i < batch.changes.size(); ++i)
+    {
+        EXPECT_EQ(i + 1, batch.changes[i].sequence);
+        EXPECT_EQ(id, batch.changes[i].id);
+    }
+}
+
+TEST(ChangeFeed, ReturnsOnlyChangesAfterSinceUpToTheLimit)
+{
+    Comics::ComicDb db;
+    for (int issue = 1; issue <= 5; ++issue)
+    {
+        createComic(db, makeComic("The Fantastic Four", issue));
+    }
+
+    const Comics::ChangeBatch batch = changesSince(db, 2, 2);
+    const Comics::ChangeBatch none = changesSince(db, 5, 2);
+
+    ASSERT_EQ(2U, batch.changes.size());
+    EXPECT_EQ(3U, batch.changes[0].sequence);
+    EXPECT_EQ(4U, batch.changes[1].sequence);
+    EXPECT_EQ(5U, batch.sequence);
+    EXPECT_TRUE(none.changes.empty());
+    EXPECT_FALSE(none.resync);
+}
+
+TEST(ChangeFeed, AsksForResyncOnceChangesAreDropped)
+{
+    Comics::ComicDb db;
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1));
+    for (std::size_t i = 0; i < Comics::CHANGE_LOG_CAPACITY; ++i)
+    {
+        updateComic(db, id, makeComic("The Fantastic Four", 1));
+    }
+
+    EXPECT_TRUE(changesSince(db, 0, 100).resync);
+    EXPECT_FALSE(changesSince(db, 1, 100).resync);
+}
+
+TEST(ChangeFeed, NotifiesTheListenerAfterEachCommit)
+{
+    Comics::ComicDb            db;
+    std::vector<std::uint64_t> notified;
+    setChangeListener(db, [&](std::uint64_t sequence) { notified.push_back(sequence); });
+
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1));
+    deleteComic(db, id);
+
+    EXPECT_EQ((std::vector<std::uint64_t>{1, 2}), notified);
+}
+
+TEST(ChangeFeed, TailsWritesOfManyComicsWithoutGaps)
+{
+    constexpr int            WRITERS = 8;
+    constexpr int            EDITS = 500;
+    Comics::ComicDb          db;
+    std::vector<std::size_t> ids;
+    for (int i = 0; i < WRITERS; ++i)
+    {
+        ids.push_back(createComic(db, makeComic("The Fantastic Four", 1)));
+    }
+
+    std::atomic<bool>        done{};
+    std::vector<std::thread> writers;
+    for (int i = 0; i < WRITERS; ++i)
+    {
+        writers.emplace_back(
+            [&, i]
+            {
+                for (int edit = 0; edit < EDITS; ++edit)
+                {
+                    modifyComic(db, ids[i], [](Comics::Comic &comic) { ++comic.issue; });
+                }
+            });
+    }
+    // Changes are published in sequence order, each comic's in the order written
+    std::uint64_t    since = 0;
+    std::vector<int> issues(WRITERS, 0);
+    auto             tail = [&]
+    {
+        const Comics::ChangeBatch batch = changesSince(db, since, 100);
+        ASSERT_FALSE(batch.resync);
+        for (const Comics::Change &change : batch.changes)
+        {
+            ASSERT_EQ(since + 1, change.sequence);
+            since = change.sequence;
+            int &issue = issues[change.id];
+            EXPECT_EQ(issue + 1, change.comic.issue);
+            issue = change.comic.issue;
+        }
+    };
+    std::thread tailer(
+        [&]
+        {
+            while (!done)
+            {
+                tail();
+            }
+        });
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+    done = true;
+    tailer.join();
+    for (int batch = 0; batch < WRITERS * (EDITS + 1) && since < lastSequence(db); ++batch)
+    {
+        tail();
+    }
+
+    EXPECT_EQ(static_cast<std::uint64_t>(WRITERS * (EDITS + 1)), since);
+    EXPECT_EQ(std::vector<int>(WRITERS, 1 + EDITS), issues);
+}
+
+TEST(Replication, ReplicaMirrorsThePrimary)
+{
+    Comics::ComicDb primary;
+    createComic(primary, makeComic("The Fantastic Four", 1));
+    Comics::ComicDb replica;
+    restore(replica, snapshot(primary));
+
+    const std::size_t id = createComic(primary, makeComic("The Fantastic Four", 3));
+    updateComic(primary, 0, makeComic("The Fantastic Four", 1, "Dick Ayers"));
+    deleteComic(primary, id);
+    for (const Comics::Change &change : changesSince(primary, lastSequence(replica), 100).changes)
+    {
+        applyChange(replica, change);
+    }
+
+    EXPECT_EQ(lastSequence(primary), lastSequence(replica));
+    EXPECT_EQ("Dick Ayers", readComic(replica, 0).inks->name());
+    EXPECT_THROW(readComic(replica, id), std::runtime_error);
+    // The replica's own feed carries the primary's numbering
+    EXPECT_EQ(2U, changesSince(replica, 1, 100).changes.front().sequence);
+}
+
+TEST(Replication, RejectsChangesOutOfOrder)
+{
+    Comics::ComicDb primary;
+    createComic(primary, makeComic("The Fantastic Four", 1));
+    createComic(primary, makeComic("The Fantastic Four", 3));
+    Comics::ComicDb replica;
+
+    const Comics::ChangeBatch batch = changesSince(primary, 1, 100);
+
+    EXPECT_THROW(applyChange(replica, batch.changes.front()), std::runtime_error);
+    EXPECT_EQ(0U, lastSequence(replica));
+}
+
+TEST(Replication, ReadersRunWhileTheReplicaApplies)
+{
+    Comics::ComicDb primary;
+    createComic(primary, makeComic("The Fantastic Four", 1));
+    Comics::ComicDb replica;
+    restore(replica, snapshot(primary));
+    for (int issue = 2; issue <= 5000; ++issue)
+    {
+        updateComic(primary, 0, makeComic("The Fantastic Four", issue));
+    }
+    std::atomic<bool> done{};
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.emplace_back(
+            [&]
+            {
+                int last = 1;
+                while (!done)
+                {
+                    const int issue = readComic(replica, 0).issue;
+                    EXPECT_LE(last, issue);
+                    last = issue;
+                }
+            });
+    }
+    for (const Comics::Change &change : changesSince(primary, lastSequence(replica), 10000).changes)
+    {
+        applyChange(replica, change);
+    }
+    done = true;
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(5000, readComic(replica, 0).issue);
+}
+
+TEST(Versions, EachChangeStampsTheComicWithItsSequence)
+{
+    Comics::ComicDb   db;
+    const std::size_t first = createComic(db, makeComic("The Fantastic Four", 1));
+    const std::size_t second = createComic(db, makeComic("The Fantastic Four", 3));
+    updateComic(db, first, makeComic("The Fantastic Four", 1, "Dick Ayers"));
+
+    EXPECT_EQ(3U, readVersionedComic(db, first).version);
+    EXPECT_EQ(2U, readVersionedComic(db, second).version);
+}
+
+TEST(Versions, ConditionalWritesFailOnceTheComicHasChanged)
+{
+    Comics::ComicDb     db;
+    const std::size_t   id = createComic(db, makeComic("The Fantastic Four", 1));
+    const std::uint64_t version = readVersionedComic(db, id).version;
+
+    const std::uint64_t updated =
+        updateComicIfVersion(db, id, makeComic("The Fantastic Four", 1, "Dick Ayers"), version);
+    const std::uint64_t stale =
+        updateComicIfVersion(db, id, makeComic("The Fantastic Four", 1, "Sol Brodsky"), version);
+
+    EXPECT_EQ(version + 1, updated);
+    EXPECT_EQ(Comics::NO_VERSION, stale);
+    EXPECT_EQ("Dick Ayers", readComic(db, id).inks->name());
+    EXPECT_EQ(Comics::NO_VERSION, deleteComicIfVersion(db, id, version));
+    EXPECT_EQ(updated + 1, deleteComicIfVersion(db, id, updated));
+    EXPECT_THROW(readComic(db, id), std::runtime_error);
+}
+
+TEST(Versions, DeltaHoldsOnlyTheComicsChangedSinceAVersion)
+{
+    Comics::ComicDb server;
+    for (int issue = 1; issue <= 4; ++issue)
+    {
+        createComic(server, makeComic("The Fantastic Four", issue));
+    }
+    Comics::ComicDb mirror;
+    applyDelta(mirror, changedSince(server, 0));
+
+    updateComic(server, 1, makeComic("The Fantastic Four", 2, "Dick Ayers"));
+    deleteComic(server, 3);
+    const Comics::Delta delta = changedSince(server, lastSequence(mirror));
+    applyDelta(mirror, delta);
+
+    EXPECT_EQ(6U, delta.version);
+    ASSERT_EQ(2U, delta.comics.size());
+    EXPECT_EQ(1U, delta.comics[0].id);
+    EXPECT_EQ(3U, delta.comics[1].id);
+    EXPECT_EQ(lastSequence(server), lastSequence(mirror));
+    EXPECT_EQ("Dick Ayers", readComic(mirror, 1).inks->name());
+    EXPECT_EQ(5U, readVersionedComic(mirror, 1).version);
+    EXPECT_THROW(readComic(mirror, 3), std::runtime_error);
+    EXPECT_TRUE(changesSince(mirror, 0, 100).changes.empty());
+}
+
+TEST(OptimisticConcurrency, UpdateOfAnUnknownComicThrows)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1));
+
+    EXPECT_THROW(updateComic(db, 1, makeComic("The Fantastic Four", 3)), std::runtime_error);
+    EXPECT_THROW(updateComic(db, 1000000, makeComic("The Fantastic Four", 3)), std::runtime_error);
+    EXPECT_EQ(1U, lastSequence(db));
+}
+
+TEST(OptimisticConcurrency, ConcurrentEditsAreNotLost)
+{
+    constexpr int   WRITERS = 8;
+    constexpr int   EDITS = 2000;
+    Comics::ComicDb db;
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1));
+
+    std::vector<std::thread> writers;
+    for (int i = 0; i < WRITERS; ++i)
+    {
+        writers.emplace_back(
+            [&]
+            {
+                for (int edit = 0; edit < EDITS; ++edit)
+                {
+                    modifyComic(db, id, [](Comics::Comic &comic) { ++comic.issue; });
+                }
+            });
+    }
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+
+    EXPECT_EQ(1 + WRITERS * EDITS, readComic(db, id).issue);
+    EXPECT_EQ(1U + WRITERS * EDITS, lastSequence(db));
+    EXPECT_EQ(1U + WRITERS * EDITS, writeStats(db).commits);
+    // The log holds each comic's versions in order
+    const Comics::ChangeBatch batch = changesSince(db, 1, WRITERS * EDITS);
+    for (std::size_t i = 0; i < batch.changes.size(); ++i)
+    {
+        EXPECT_EQ(static_cast<int>(i) + 2, batch.changes[i].comic.issue);
+    }
+}
+
+TEST(OptimisticConcurrency, OnlyOneConditionalUpdatePerVersionWins)
+{
+    constexpr int       WRITERS = 8;
+    Comics::ComicDb     db;
+    const std::size_t   id = createComic(db, makeComic("The Fantastic Four", 1));
+    const std::uint64_t version = readVersionedComic(db, id).version;
+
+    std::atomic<int>         wins{};
+    std::vector<std::thread> writers;
+    for (int i = 0; i < WRITERS; ++i)
+    {
+        writers.emplace_back(
+            [&, i]
+            {
+                if (updateComicIfVersion(db, id, makeComic("The Fantastic Four", 2 + i), version) !=
+                    Comics::NO_VERSION)
+                {
+                    ++wins;
+                }
+            });
+    }
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+
+    EXPECT_EQ(1, wins);
+    EXPECT_EQ(version + 1, lastSequence(db));
+}
+
+TEST(OptimisticConcurrency, ReadersSeeWholeVersionsWhileWritersRun)
+{
+    Comics::ComicDb   db;
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1, "George Klein"));
+    std::atomic<bool> done{};
+
+    std::thread writer(
+        [&]
+        {
+            for (int i = 0; i < 5000; ++i)
+            {
+                updateComic(db, id, i % 2 == 0 ? makeComic("The Fantastic Four", 3, "Sol Brodsky")
+                                               : makeComic("The Fantastic Four", 1, "George Klein"));
+            }
+            done = true;
+        });
+    int torn{};
+    while (!done)
+    {
+        const Comics::Comic comic = readComic(db, id);
+        if ((comic.issue == 1) != (comic.inks->name() == "George Klein"))
+        {
+            ++torn;
+        }
+    }
+    writer.join();
+
+    EXPECT_EQ(0, torn);
+}
+
+TEST(PinnedView, SeesTheDatabaseAsOfItsPin)
+{
+    Comics::ComicDb db;
+    for (int issue = 1; issue <= 3; ++issue)
+    {
+        createComic(db, makeComic("The Fantastic Four", issue));
+    }
+
+    const Comics::PinnedView view(db);
+    updateComic(db, 0, makeComic("The Fantastic Four", 1, "Dick Ayers"));
+    deleteComic(db, 1);
+    createComic(db, makeComic("The Fantastic Four", 4));
+
+    EXPECT_EQ(3U, view.sequence());
+    EXPECT_EQ(3U, view.size());
+    EXPECT_EQ("George Klein", view.readComic(0).inks->name());
+    EXPECT_EQ(2, view.readComic(1).issue);
+    EXPECT_THROW(view.readComic(3), std::runtime_error);
+    std::vector<std::size_t> ids;
+    view.forEachComic([&](std::size_t id, const Comics::Comic &) { ids.push_back(id); });
+    EXPECT_EQ((std::vector<std::size_t>{0, 1, 2}), ids);
+    EXPECT_EQ("Dick Ayers", readComic(db, 0).inks->name());
+    EXPECT_THROW(readComic(db, 1), std::runtime_error);
+}
+
+TEST(PinnedView, KeepsOnlyTheVersionsAViewCanSee)
+{
+    Comics::ComicDb   db;
+    const std::size_t id = createComic(db, makeComic("The Fantastic Four", 1));
+    {
+        const Comics::PinnedView view(db);
+        for (int issue = 2; issue <= 11; ++issue)
+        {
+            updateComic(db, id, makeComic("The Fantastic Four", issue));
+        }
+
+        // The versions between the pin and the newest are seen by no view
+        EXPECT_EQ(1U, historyStats(db).pinnedViews);
+        EXPECT_EQ(1U, historyStats(db).keptVersions);
+        EXPECT_EQ(1, view.readComic(id).issue);
+    }
+
+    const Comics::HistoryStats stats = historyStats(db);
+    EXPECT_EQ(0U, stats.pinnedViews);
+    EXPECT_EQ(0U, stats.keptVersions);
+    EXPECT_EQ(10U, stats.collectedVersions);
+    EXPECT_EQ(11, readComic(db, id).issue);
+}
+
+TEST(PinnedView, ManyViewsCanBeAliveAtOnce)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1));
+
+    std::vector<std::unique_ptr<Comics::PinnedView>> views;
+    for (int issue = 2; issue <= 300; ++issue)
+    {
+        views.push_back(std::make_unique<Comics::PinnedView>(db));
+        updateComic(db, 0, makeComic("The Fantastic Four", issue));
+    }
+
+    EXPECT_EQ(300, readComic(db, 0).issue);
+    EXPECT_EQ(1, views.front()->readComic(0).issue);
+    EXPECT_EQ(299, views.back()->readComic(0).issue);
+}
+
+TEST(PinnedView, ScansAreConsistentWhileWritersRun)
+{
+    constexpr int   NUM_COMICS = 50;
+    Comics::ComicDb db;
+    for (int i = 0; i < NUM_COMICS; ++i)
+    {
+        createComic(db, makeComic("The Fantastic Four", 1));
+    }
+    std::atomic<bool> done{};
+
+    // Each update adds one to an issue and one to the sequence number,
+    // so in a consistent view the issues add up to the sequence number
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 4; ++w)
+    {
+        writers.emplace_back(
+            [&, w]
+            {
+                for (int i = 0; i < 2000; ++i)
+                {
+                    modifyComic(db, (w * 7 + i) % NUM_COMICS, [](Comics::Comic &comic) { ++comic.issue; });
+                }
+            });
+    }
+    std::thread scanner(
+        [&]
+        {
+            while (!done)
+            {
+                const Comics::PinnedView view(db);
+                std::uint64_t            updates{};
+                view.forEachComic([&](std::size_t, const Comics::Comic &comic) { updates += comic.issue - 1; });
+                EXPECT_EQ(view.sequence() - NUM_COMICS, updates);
+            }
+        });
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+    done = true;
+    scanner.join();
+
+    EXPECT_EQ(0U, historyStats(db).keptVersions);
+}
+
+TEST(Transactions, CommitEveryMutationAsOneChange)
+{
+    Comics::ComicDb db;
+    for (int issue = 1; issue <= 3; ++issue)
+    {
+        createComic(db, makeComic("The Fantastic Four", issue));
+    }
+    Comics::Transaction transaction(3);
+    transaction[0].id = 0;
+    transaction[0].comic = makeComic("The Fantastic Four", 1, "Dick Ayers");
+    transaction[0].ifVersion = 1;
+    transaction[1].kind = Comics::Change::Kind::Delete;
+    transaction[1].id = 1;
+    transaction[2].kind = Comics::Change::Kind::Create;
+    transaction[2].comic = makeComic("The Fantastic Four", 4);
+
+    const Comics::TransactionResult result = commitTransaction(db, transaction);
+
+    EXPECT_EQ(4U, result.version);
+    EXPECT_EQ((std::vector<std::size_t>{0, 1, 3}), result.ids);
+    EXPECT_EQ("Dick Ayers", readComic(db, 0).inks->name());
+    EXPECT_THROW(readComic(db, 1), std::runtime_error);
+    EXPECT_EQ(4U, readVersionedComic(db, 3).version);
+    const Comics::ChangeBatch batch = changesSince(db, 3, 100);
+    ASSERT_EQ(1U, batch.changes.size());
+    EXPECT_EQ(Comics::Change::Kind::Transaction, batch.changes[0].kind);
+    ASSERT_EQ(3U, batch.changes[0].changes.size());
+    EXPECT_EQ(Comics::Change::Kind::Delete, batch.changes[0].changes[1].kind);
+    EXPECT_EQ(4U, batch.changes[0].changes[2].sequence);
+}
+
+TEST(Transactions, WriteNothingWhenAConditionFails)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1));
+    createComic(db, makeComic("The Fantastic Four", 2));
+    updateComic(db, 1, makeComic("The Fantastic Four", 2, "Dick Ayers"));
+    Comics::Transaction transaction(3);
+    transaction[0].id = 0;
+    transaction[0].comic = makeComic("The Fantastic Four", 1, "Joe Sinnott");
+    transaction[0].ifVersion = 1;
+    transaction[1].id = 1;
+    transaction[1].comic = makeComic("The Fantastic Four", 2, "Joe Sinnott");
+    transaction[1].ifVersion = 2;
+    transaction[2].kind = Comics::Change::Kind::Create;
+    transaction[2].comic = makeComic("The Fantastic Four", 3);
+
+    EXPECT_EQ(Comics::NO_VERSION, commitTransaction(db, transaction).version);
+    EXPECT_EQ("George Klein", readComic(db, 0).inks->name());
+    EXPECT_EQ(3U, lastSequence(db));
+    // The create was given no id
+    EXPECT_EQ(2U, createComic(db, makeComic("The Fantastic Four", 3)));
+    // Once written, a comic cannot be written again by the same transaction
+    transaction[1].id = 0;
+    EXPECT_THROW(commitTransaction(db, transaction), std::runtime_error);
+    // Nor can one that does not exist
+    transaction[1].id = 9;
+    EXPECT_THROW(commitTransaction(db, transaction), std::runtime_error);
+    EXPECT_EQ(4U, lastSequence(db));
+}
+
+TEST(Transactions, ReplicaAppliesTheTransaction)
+{
+    Comics::ComicDb primary;
+    createComic(primary, makeComic("The Fantastic Four", 1));
+    createComic(primary, makeComic("The Fantastic Four", 2));
+    Comics::ComicDb replica;
+    restore(replica, snapshot(primary));
+    Comics::Transaction transaction(2);
+    for (std::size_t id = 0; id < transaction.size(); ++id)
+    {
+        transaction[id].id = id;
+        transaction[id].comic = makeComic("The Fantastic Four", static_cast<int>(id) + 1, "Dick Ayers");
+    }
+
+    commitTransaction(primary, transaction);
+    for (const Comics::Change &change : changesSince(primary, lastSequence(replica), 100).changes)
+    {
+        applyChange(replica, change);
+    }
+
+    EXPECT_EQ(3U, lastSequence(replica));
+    EXPECT_EQ("Dick Ayers", readComic(replica, 0).inks->name());
+    EXPECT_EQ("Dick Ayers", readComic(replica, 1).inks->name());
+    EXPECT_EQ(3U, readVersionedComic(replica, 1).version);
+}
+
+TEST(Transactions, ViewsSeeAllOfATransactionOrNone)
+{
+    constexpr std::size_t NUM_COMICS = 20;
+    Comics::ComicDb       db;
+    for (std::size_t i = 0; i < NUM_COMICS; ++i)
+    {
+        createComic(db, makeComic("The Fantastic Four", 1));
+    }
+    std::atomic<bool> done{};
+
+    // Transactions re-credit the inker of the first half of the comics,
+    // while single writes keep the inker of the second half changing
+    std::vector<std::thread> writers;
+    for (int w = 0; w < 2; ++w)
+    {
+        writers.emplace_back(
+            [&, w]
+            {
+                const std::string inker = w == 0 ? "Dick Ayers" : "Joe Sinnott";
+                for (int i = 0; i < 500; ++i)
+                {
+                    Comics::Transaction transaction(NUM_COMICS / 2);
+                    for (std::size_t id = 0; id < transaction.size(); ++id)
+                    {
+                        transaction[id].id = id;
+                        transaction[id].comic = makeComic("The Fantastic Four", 1, inker);
+                    }
+                    commitTransaction(db, transaction);
+                    modifyComic(db, NUM_COMICS / 2 + i % (NUM_COMICS / 2),
+                                [&](Comics::Comic &comic) { comic.inks = Comics::findPerson(inker); });
+                }
+            });
+    }
+    std::thread scanner(
+        [&]
+        {
+            while (!done)
+            {
+                const Comics::PinnedView view(db);
+                for (std::size_t id = 1; id < NUM_COMICS / 2; ++id)
+                {
+                    EXPECT_EQ(view.readComic(0).inks, view.readComic(id).inks);
+                }
+            }
+        });
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+    done = true;
+    scanner.join();
+
+    EXPECT_EQ(NUM_COMICS + 2000, lastSequence(db));
+}
+
+TEST(Persons, RenameShowsInEveryComicAtOnce)
+{
+    Comics::ComicDb primary;
+    createComic(primary, makeComic("The Fantastic Four", 1, "Chic Stone"));
+    createComic(primary, makeComic("The Fantastic Four", 2, "Chic Stone"));
+    Comics::ComicDb replica;
+    restore(replica, snapshot(primary));
+    const Comics::PinnedView view(primary);
+
+    renamePerson(primary, "Chic Stone", "Charles Stone");
+
+    EXPECT_EQ("Charles Stone", readComic(primary, 0).inks->name());
+    EXPECT_EQ("Charles Stone", view.readComic(1).inks->name());
+    // The comics credit the new name, so they have new versions
+    EXPECT_EQ(3U, readVersionedComic(primary, 1).version);
+    EXPECT_FALSE(Comics::lookupPerson("Chic Stone"));
+    EXPECT_THROW(renamePerson(primary, "Charles Stone", "George Klein"), std::runtime_error);
+    const Comics::ChangeBatch batch = changesSince(primary, 2, 100);
+    ASSERT_EQ(1U, batch.changes.size());
+    EXPECT_EQ(Comics::Change::Kind::RenamePerson, batch.changes[0].kind);
+    EXPECT_EQ("Charles Stone", batch.changes[0].newName);
+    ASSERT_EQ(2U, batch.changes[0].changes.size());
+    EXPECT_EQ(1U, batch.changes[0].changes[1].id);
+    applyChange(replica, batch.changes[0]);
+    EXPECT_EQ(3U, lastSequence(replica));
+    EXPECT_EQ(3U, readVersionedComic(replica, 0).version);
+    EXPECT_EQ("Charles Stone", readComic(replica, 0).inks->name());
+}
+
+TEST(Persons, MergeCreditsBothNamesToOnePerson)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1, "Vince Colletta"));
+    createComic(db, makeComic("The Fantastic Four", 2, "Vincent Colletta"));
+    createComic(db, makeComic("The Fantastic Four", 3, "Vincent Colletta"));
+
+    mergePersons(db, "Vincent Colletta", "Vince Colletta");
+
+    EXPECT_EQ("Vince Colletta", readComic(db, 2).inks->name());
+    EXPECT_EQ(&readComic(db, 0).inks->canonical(), &Comics::findPerson("Vincent Colletta")->canonical());
+    EXPECT_EQ((std::vector<std::size_t>{0, 1, 2}), personCredits(db, "Vincent Colletta").comics);
+    // The index follows the comics written after the merge
+    updateComic(db, 1, makeComic("The Fantastic Four", 2, "Frank Giacoia"));
+    deleteComic(db, 2);
+    const Comics::PersonCredits credits = personCredits(db, "Vince Colletta");
+    EXPECT_EQ("Vince Colletta", credits.name);
+    EXPECT_EQ((std::vector<std::size_t>{0}), credits.comics);
+    EXPECT_EQ((std::vector<std::size_t>{1}), personCredits(db, "Frank Giacoia").comics);
+    EXPECT_THROW(mergePersons(db, "Vince Colletta", "Nobody At All"), std::runtime_error);
+}
+
+TEST(Persons, WritesMadeAgainstTheOldNameFail)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1, "Joe Sinnott"));
+    createComic(db, makeComic("The Fantastic Four", 2, "Dick Ayers"));
+    const Comics::VersionedComic stale = readVersionedComic(db, 0);
+
+    renamePerson(db, "Joe Sinnott", "Joseph Sinnott");
+
+    // A client still holding the old name cannot write it back
+    EXPECT_EQ(Comics::NO_VERSION,
+              updateComicIfVersion(db, 0, makeComic("The Fantastic Four", 1, "Joe Sinnott"), stale.version));
+    EXPECT_EQ("Joseph Sinnott", readComic(db, 0).inks->name());
+    const Comics::Delta delta = changedSince(db, 2);
+    ASSERT_EQ(1U, delta.comics.size());
+    EXPECT_EQ(0U, delta.comics[0].id);
+    EXPECT_EQ(3U, delta.comics[0].version);
+}
+
+TEST(Persons, MergedPersonsFollowLaterMergesAndRenames)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1, "Sol Brodsky"));
+    createComic(db, makeComic("The Fantastic Four", 2, "Solomon Brodsky"));
+    createComic(db, makeComic("The Fantastic Four", 3, "S. Brodsky"));
+
+    mergePersons(db, "S. Brodsky", "Solomon Brodsky");
+    mergePersons(db, "Solomon Brodsky", "Sol Brodsky");
+    renamePerson(db, "S. Brodsky", "Sol B. Brodsky");
+
+    for (std::size_t id = 0; id < 3; ++id)
+    {
+        EXPECT_EQ("Sol B. Brodsky", readComic(db, id).inks->name());
+    }
+    EXPECT_EQ((std::vector<std::size_t>{0, 1, 2}), personCredits(db, "Sol B. Brodsky").comics);
+    EXPECT_EQ(6U, lastSequence(db));
+}
+
+TEST(Persons, ReadersSeeWholeNamesWhileRenamesRun)
+{
+    Comics::ComicDb db;
+    createComic(db, makeComic("The Fantastic Four", 1, "Mike Esposito"));
+    std::atomic<bool> done{};
+
+    std::thread reader(
+        [&]
+        {
+            while (!done)
+            {
+                const std::string name = readComic(db, 0).inks->name();
+                EXPECT_TRUE(name == "Mike Esposito" || name == "Mickey Demeo") << name;
+            }
+        });
+    for (int i = 0; i < 500; ++i)
+    {
+        renamePerson(db, "Mike Esposito", "Mickey Demeo");
+        renamePerson(db, "Mickey Demeo", "Mike Esposito");
+    }
+    done = true;
+    reader.join();
+
+    EXPECT_EQ("Mike Esposito", readComic(db, 0).inks->name());
+}
@@ -0,0 +1,105 @@
+#include <add_ons/asio/coroutine.hpp>
+
+#include <gtest/gtest.h>
+
+#include <boost/asio/error.hpp>
+
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+using namespace promise;
+
+namespace
+{
+
+// Awaits count promises that have already resolved; each would nest
+// another resume inside await_suspend if the awaiter suspended for them
+Promise sumResolved(int count, int &sum)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        sum += co_await as_awaitable<int>(promise::resolve(1));
+    }
+}
+
+// Awaits promise, recording what co_await threw
+Promise awaitRejected(Promise promise, std::string &caught)
+{
+    try
+    {
+        co_await promise;
+        caught = "nothing";
+    }
+    catch (const boost::system::system_error &)
+    {
+        caught = "system_error";
+    }
+    catch (const rejected_promise &)
+    {
+        caught = "rejected_promise";
+    }
+    catch (const std::logic_error &error)
+    {
+        caught = error.what();
+    }
+}
+
+Promise awaitValue(Promise promise, std::optional<int> &value)
+{
+    value = co_await as_awaitable<int>(promise);
+}
+
+} // namespace
+
+TEST(Coroutine, SettledPromisesDoNotSuspend)
+{
+    int  sum{};
+    bool finished{};
+
+    sumResolved(100000, sum).then([&finished] { finished = true; });
+
+    EXPECT_TRUE(finished);
+    EXPECT_EQ(100000, sum);
+}
+
+TEST(Coroutine, PendingPromisesResumeWhenResolved)
+{
+    std::optional<Defer> defer;
+    std::optional<int>   value;
+
+    awaitValue(newPromise([&defer](Defer &d) { defer = d; }), value);
+    EXPECT_FALSE(value);
+    defer->resolve(7);
+
+    EXPECT_EQ(7, value);
+}
+
+TEST(Coroutine, ErrorCodeRejectionsThrowSystemError)
+{
+    std::string caught;
+
+    awaitRejected(promise::reject(boost::system::error_code(boost::asio::error::eof)), caught);
+
+    EXPECT_EQ("system_error", caught);
+}
+
+TEST(Coroutine, ExceptionRejectionsAreRethrown)
+{
+    std::optional<Defer> defer;
+    std::string          caught;
+
+    awaitRejected(newPromise([&defer](Defer &d) { defer = d; }), caught);
+    defer->reject(std::make_exception_ptr(std::logic_error("offloaded")));
+
+    EXPECT_EQ("offloaded", caught);
+}
+
+TEST(Coroutine, OtherRejectionsThrowRejectedPromise)
+{
+    std::string caught;
+
+    awaitRejected(promise::reject(42), caught);
+
+    EXPECT_EQ("rejected_promise", caught);
+}
@@ -0,0 +1,69 @@
+#include <add_ons/http/encoding.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <string>
+
+namespace zlib = boost::beast::zlib;
+
+namespace
+{
+
+// Returns the data of a gzip member, inflated from the deflate stream
+// between its ten byte header and eight byte trailer
+std::string gunzip(const std::string &member)
+{
+    const std::string    deflated = member.substr(10, member.size() - 18);
+    std::string          out(1 << 16, '\0');
+    zlib::inflate_stream stream;
+    stream.reset(15);
+    zlib::z_params zs;
+    zs.next_in = deflated.data();
+    zs.avail_in = deflated.size();
+    zs.next_out = &out[0];
+    zs.avail_out = out.size();
+    boost::beast::error_code ec;
+    stream.write(zs, zlib::Flush::finish, ec);
+    EXPECT_EQ(zlib::error::end_of_stream, ec);
+    out.resize(zs.total_out);
+    return out;
+}
+
+} // namespace
+
+TEST(HttpEncoding, GzipRoundTrips)
+{
+    std::string data;
+    for (int i = 0; i < 1000; ++i)
+    {
+        data += "{\"title\":\"The Fantastic Four\",\"issue\":" + std::to_string(i) + "},";
+    }
+    boost::beast::error_code ec;
+
+    const std::string member = http_encoding::gzip(data, ec);
+
+    ASSERT_FALSE(ec);
+    EXPECT_EQ("\x1f\x8b", member.substr(0, 2));
+    EXPECT_LT(member.size(), data.size());
+    EXPECT_EQ(data, gunzip(member));
+}
+
+TEST(HttpEncoding, GzipOfNothingIsAValidMember)
+{
+    boost::beast::error_code ec;
+
+    const std::string member = http_encoding::gzip("", ec);
+
+    ASSERT_FALSE(ec);
+    EXPECT_EQ("", gunzip(member));
+}
+
+TEST(HttpEncoding, AcceptsEncodingHonoursQValuesAndWildcards)
+{
+    EXPECT_EQ(1.0, http_encoding::accepts_encoding("gzip, br", "gzip"));
+    EXPECT_EQ(0.5, http_encoding::accepts_encoding("br;q=1, gzip;q=0.5", "gzip"));
+    EXPECT_EQ(0.0, http_encoding::accepts_encoding("gzip;q=0", "gzip"));
+    EXPECT_EQ(0.2, http_encoding::accepts_encoding("br, *;q=0.2", "gzip"));
+    EXPECT_EQ(0.0, http_encoding::accepts_encoding("br", "gzip"));
+}
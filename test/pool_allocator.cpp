@@ -0,0 +1,129 @@
+#include <add_ons/memory/pool_allocator.hpp>
+#include <allocation_count.hpp>
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace http = boost::beast::http;
+
+namespace
+{
+
+// Counts the heap allocations made while in scope
+class AllocationCounter
+{
+public:
+    AllocationCounter() :
+        m_start(allocation_count())
+    {
+    }
+
+    std::size_t count() const
+    {
+        return allocation_count() - m_start;
+    }
+
+private:
+    std::size_t m_start;
+};
+
+struct Connection
+{
+    std::string                                                        m_name;
+    boost::beast::basic_flat_buffer<pool_memory::pool_allocator<char>> m_buffer;
+};
+
+using Response = http::response<http::empty_body>;
+
+// The objects the server creates per connection and per request, with
+// the connection's input buffer filled once; no sockets or parsing
+void createConnectionObjects()
+{
+    auto connection =
+        std::allocate_shared<Connection>(pool_memory::pool_allocator<Connection>{});
+    auto input = connection->m_buffer.prepare(4096);
+    connection->m_buffer.commit(boost::asio::buffer_size(input));
+    connection->m_buffer.consume(connection->m_buffer.size());
+    auto response = std::allocate_shared<Response>(pool_memory::pool_allocator<Response>{});
+}
+
+// Returns the heap deallocations made by running the function on a
+// thread of its own, its exit included
+std::size_t deallocationsOnThread(const std::function<void()> &function)
+{
+    const std::size_t start = deallocation_count();
+    std::thread(function).join();
+    return deallocation_count() - start;
+}
+
+} // namespace
+
+TEST(PoolAllocator, ReusesReleasedBlocks)
+{
+    pool_memory::pool_allocator<int> alloc;
+    int                             *first = alloc.allocate(10);
+    alloc.deallocate(first, 10);
+
+    int *second = alloc.allocate(10);
+
+    EXPECT_EQ(first, second);
+    alloc.deallocate(second, 10);
+}
+
+TEST(PoolAllocator, SizeClassesAreSeparate)
+{
+    pool_memory::pool_allocator<char> alloc;
+    char                             *small = alloc.allocate(16);
+    alloc.deallocate(small, 16);
+
+    char *large = alloc.allocate(1024);
+
+    EXPECT_NE(small, large);
+    alloc.deallocate(large, 1024);
+}
+
+TEST(PoolAllocator, OversizedBlocksBypassThePool)
+{
+    pool_memory::pool_allocator<char> alloc;
+    constexpr std::size_t             size = 1024 * 1024;
+    char                             *block = alloc.allocate(size);
+    alloc.deallocate(block, size);
+    AllocationCounter counter;
+
+    block = alloc.allocate(size);
+    alloc.deallocate(block, size);
+
+    EXPECT_EQ(1U, counter.count());
+}
+
+TEST(PoolAllocator, RecycledConnectionObjectsDoNotAllocate)
+{
+    createConnectionObjects();
+    AllocationCounter counter;
+
+    for (int i = 0; i < 100; ++i)
+    {
+        createConnectionObjects();
+    }
+
+    EXPECT_EQ(0U, counter.count());
+}
+
+TEST(PoolAllocator, ThreadsThatOnlyReleaseBlocksReturnThemOnExit)
+{
+    pool_memory::pool_allocator<char> alloc;
+    char                             *block = alloc.allocate(64);
+    const std::size_t                 idle = deallocationsOnThread([] {});
+
+    const std::size_t releasing = deallocationsOnThread([&] { alloc.deallocate(block, 64); });
+
+    // The block is cached on the releasing thread and freed when it exits
+    EXPECT_EQ(idle + 1, releasing);
+}
@@ -0,0 +1,73 @@
+#include <replication.h>
+
+#include <boost/asio/io_context.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+
+namespace asio = boost::asio;
+
+using comicsServer::ChangeFeed;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+TEST(ChangeFeed, WaitWakesOnTheNextChange)
+{
+    asio::io_context ioc;
+    ChangeFeed       feed;
+    bool             woken = false;
+    feed.wait(ioc.get_executor(), 0, milliseconds(10000)).then([&] { woken = true; });
+
+    ioc.poll();
+    EXPECT_FALSE(woken);
+
+    const auto begin = steady_clock::now();
+    feed.notify(1);
+    ioc.run();
+
+    EXPECT_TRUE(woken);
+    EXPECT_LT(steady_clock::now() - begin, milliseconds(5000));
+}
+
+TEST(ChangeFeed, WaitResolvesAtTheTimeoutWithoutAChange)
+{
+    asio::io_context ioc;
+    ChangeFeed       feed;
+    bool             woken = false;
+    const auto       begin = steady_clock::now();
+    feed.wait(ioc.get_executor(), 0, milliseconds(50)).then([&] { woken = true; });
+
+    ioc.run();
+
+    EXPECT_TRUE(woken);
+    EXPECT_GE(steady_clock::now() - begin, milliseconds(50));
+}
+
+TEST(ChangeFeed, WaitResolvesRightAwayWhenAChangeIsAlreadyCommitted)
+{
+    asio::io_context ioc;
+    ChangeFeed       feed;
+    bool             woken = false;
+    feed.notify(5);
+    feed.wait(ioc.get_executor(), 3, milliseconds(10000)).then([&] { woken = true; });
+
+    ioc.poll();
+
+    EXPECT_TRUE(woken);
+}
+
+TEST(ChangeFeed, WaitIgnoresChangesItHasSeen)
+{
+    asio::io_context ioc;
+    ChangeFeed       feed;
+    bool             woken = false;
+    feed.notify(5);
+    const auto begin = steady_clock::now();
+    feed.wait(ioc.get_executor(), 5, milliseconds(50)).then([&] { woken = true; });
+
+    ioc.run();
+
+    EXPECT_TRUE(woken);
+    EXPECT_GE(steady_clock::now() - begin, milliseconds(50));
+}
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+#
+# Runs a primary comics-server, a replica of it and a replica of the
+# replica as separate processes, then checks that a write to the primary
+# reaches both replicas through the change feed.
+#
+# Usage: replication.sh <comics-server> [<base port>]
+#
+set -u
+
+server=$1
+base=${2:-18080}
+primary=$base
+replica=$((base + 1))
+chained=$((base + 2))
+pids=()
+
+cleanup()
+{
+    kill "${pids[@]}" 2>/dev/null
+    wait 2>/dev/null
+}
+trap cleanup EXIT
+
+fail()
+{
+    echo "FAILED: $*" >&2
+    exit 1
+}
+
+# Polls url until its body contains text, for up to ten seconds
+waitFor()
+{
+    local url=$1 text=$2
+    for _ in $(seq 100); do
+        if curl -s "$url" | grep -q "$text"; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+"$server" 127.0.0.1 "$primary" 1 & pids+=($!)
+waitFor "http://127.0.0.1:$primary/metrics/replication" '"role":"primary"' || fail "primary did not start"
+"$server" 127.0.0.1 "$replica" 1 --replica-of "127.0.0.1:$primary" & pids+=($!)
+"$server" 127.0.0.1 "$chained" 1 --replica-of "127.0.0.1:$replica" & pids+=($!)
+
+comic='{"title":"The Replicated Four","issue":1,"script":"Stan Lee","pencils":"Jack Kirby","inks":"George Klein","letters":"Artie Simek","colors":"Stan Goldberg"}'
+curl -s -X PUT -H 'Content-Type: application/json' -d "$comic" "http://127.0.0.1:$primary/comic/0" >/dev/null \
+    || fail "write to the primary"
+
+waitFor "http://127.0.0.1:$replica/comic/0" 'The Replicated Four' || fail "replica did not apply the change"
+waitFor "http://127.0.0.1:$chained/comic/0" 'The Replicated Four' || fail "chained replica did not apply the change"
+waitFor "http://127.0.0.1:$replica/metrics/replication" '"lagSequences":0' || fail "replica reports lag"
+
+inked=${comic/George Klein/Joe Sinnott}
+transaction='{"mutations":[{"kind":"update","id":0,"comic":'$inked'},{"kind":"create","comic":'$inked'}]}'
+curl -s -X POST -H 'Content-Type: application/json' -d "$transaction" "http://127.0.0.1:$primary/transaction" \
+    | grep -q '"ids":\[0,' || fail "transaction on the primary"
+waitFor "http://127.0.0.1:$chained/comic/0" 'Joe Sinnott' || fail "chained replica did not apply the transaction"
+
+curl -s -X POST -H 'Content-Type: application/json' -d '{"name":"Joe Sinnott","newName":"Joseph Sinnott"}' \
+    "http://127.0.0.1:$primary/person/rename" | grep -q '"comics":\[0,' || fail "rename on the primary"
+waitFor "http://127.0.0.1:$chained/person?name=Joseph%20Sinnott" '"comics":\[0,' \
+    || fail "chained replica did not apply the rename"
+
+status=$(curl -s -o /dev/null -w '%{http_code}' -X DELETE "http://127.0.0.1:$replica/comic/0")
+[ "$status" = 405 ] || fail "replica accepted a write, status $status"
+
+echo "PASSED"
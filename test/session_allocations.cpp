@@ -0,0 +1,142 @@
+#include <add_ons/asio/typed_io.hpp>
+#include <add_ons/memory/pool_allocator.hpp>
+#include <allocation_count.hpp>
+#include <response.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+
+#include <gtest/gtest.h>
+
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace typed = promise::typed;
+
+using comicsServer::ContentType;
+using comicsServer::Response;
+using tcp = asio::ip::tcp;
+
+namespace
+{
+
+const std::string REQUEST = "GET /comic/0 HTTP/1.1\r\n"
+                            "Host: localhost\r\n"
+                            "User-Agent: session-allocations\r\n"
+                            "\r\n";
+const std::string BODY = R"({"title":"The Fantastic Four","issue":1,"script":"Stan Lee",)"
+                         R"("pencils":"Jack Kirby","inks":"George Klein","letters":"Artie Simek",)"
+                         R"("colors":"Stan Goldberg"})";
+
+// The server end of a loopback connection, handling requests the way
+// comics-server's coroutine sessions do: the header and the body are
+// read with the typed adapters into the session's pooled buffer, a
+// Response is written as gathered buffers, and the next request is read
+// from the write's completion handler.
+struct Session
+{
+    explicit Session(asio::io_context &ioc) :
+        m_socket(ioc)
+    {
+    }
+
+    void handleRequests()
+    {
+        m_parser.emplace();
+        typed::async_read_header(m_socket, m_buffer, *m_parser)
+            .then(
+                [this](boost::system::error_code err, std::size_t)
+                {
+                    if (err)
+                    {
+                        return;
+                    }
+                    typed::async_read(m_socket, m_buffer, *m_parser)
+                        .then(
+                            [this](boost::system::error_code err, std::size_t)
+                            {
+                                ASSERT_FALSE(err);
+                                m_req = m_parser->release();
+                                m_res.emplace(ContentType::Json, m_req.version(), m_req.keep_alive());
+                                m_res->body() = BODY;
+                                typed::async_write_buffers(m_socket, m_res->buffers())
+                                    .then(
+                                        [this](boost::system::error_code err, std::size_t)
+                                        {
+                                            ASSERT_FALSE(err);
+                                            handleRequests();
+                                        });
+                            });
+                });
+    }
+
+    tcp::socket                                                 m_socket;
+    beast::basic_flat_buffer<pool_memory::pool_allocator<char>> m_buffer;
+    std::optional<http::request_parser<http::string_body>>      m_parser;
+    http::request<http::string_body>                            m_req;
+    std::optional<Response>                                     m_res;
+};
+
+// Sends requests over a loopback connection and returns the heap
+// allocations made per request once the pools have warmed up. The
+// client sends each request once the previous response has arrived,
+// from a thread of its own that reads and writes synchronously into
+// fixed storage, so that the allocations counted are the server's.
+std::size_t allocationsPerRequest(int requests)
+{
+    asio::io_context ioc;
+    tcp::acceptor    acceptor{ioc, tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+    tcp::socket      client{ioc};
+    Session          session{ioc};
+    client.connect(acceptor.local_endpoint());
+    acceptor.accept(session.m_socket);
+    session.handleRequests();
+
+    // Every response is the same size; measure it from one built here
+    Response expected{ContentType::Json, 11, true};
+    expected.body() = BODY;
+    const std::size_t responseSize = asio::buffer_size(expected.buffers());
+
+    std::size_t allocations{};
+    std::thread clientThread(
+        [&]
+        {
+            std::vector<char> response(responseSize);
+            auto              roundTrips = [&](int count)
+            {
+                for (int i = 0; i < count; ++i)
+                {
+                    asio::write(client, asio::buffer(REQUEST));
+                    asio::read(client, asio::buffer(response));
+                }
+            };
+            roundTrips(10);
+            const std::size_t start = allocation_count();
+            roundTrips(requests);
+            allocations = allocation_count() - start;
+            client.shutdown(tcp::socket::shutdown_send);
+        });
+    ioc.run();
+    clientThread.join();
+    return allocations / requests;
+}
+
+} // namespace
+
+TEST(SessionAllocations, RequestsAllocateOnlyForTheParsedMessageAndTheBody)
+{
+    // The request parser keeps the Host and User-Agent fields in a
+    // std::allocator basic_fields, one allocation each, and copies the
+    // target into its own storage; the response body is copied into the
+    // Response. Sockets, buffers and handlers come from the pools.
+    EXPECT_EQ(4U, allocationsPerRequest(100));
+}
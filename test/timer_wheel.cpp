@@ -0,0 +1,142 @@
+#include <add_ons/asio/timer_wheel.hpp>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using promise::detail::hierarchical_wheel;
+using promise::detail::wheel_entry;
+
+namespace
+{
+
+struct Timer : wheel_entry
+{
+    std::uint64_t m_firedAt{};
+    bool          m_fired{};
+};
+
+// Advances the wheel one tick at a time, recording when each entry fires
+void advanceTo(hierarchical_wheel &wheel, std::uint64_t now)
+{
+    while (wheel.next_tick() <= now)
+    {
+        const std::uint64_t tick = wheel.next_tick();
+        wheel.advance(tick,
+                      [tick](wheel_entry *entry)
+                      {
+                          Timer *timer = static_cast<Timer *>(entry);
+                          timer->m_fired = true;
+                          timer->m_firedAt = tick;
+                      });
+    }
+}
+
+} // namespace
+
+TEST(TimerWheel, ExpiresOnTheDueTick)
+{
+    hierarchical_wheel wheel{10};
+    Timer              soon;
+    Timer              later;
+    Timer              muchLater;
+    wheel.insert(&soon, 12);
+    wheel.insert(&later, 10 + 5000);
+    wheel.insert(&muchLater, 10 + 300000);
+
+    advanceTo(wheel, 10 + 300000);
+
+    EXPECT_EQ(12U, soon.m_firedAt);
+    EXPECT_EQ(5010U, later.m_firedAt);
+    EXPECT_EQ(300010U, muchLater.m_firedAt);
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, EntriesBeyondTheSpanWaitForTheirTick)
+{
+    hierarchical_wheel  wheel{0};
+    Timer               timer;
+    const std::uint64_t due = hierarchical_wheel::span * 2 + 7;
+    wheel.insert(&timer, due);
+
+    wheel.advance(due - 1, [](wheel_entry *) { FAIL() << "expired early"; });
+    advanceTo(wheel, due);
+
+    EXPECT_TRUE(timer.m_fired);
+    EXPECT_EQ(due, timer.m_firedAt);
+}
+
+TEST(TimerWheel, RemovedEntriesDoNotExpire)
+{
+    hierarchical_wheel wheel{0};
+    Timer              timer;
+    wheel.insert(&timer, 100);
+
+    wheel.remove(&timer);
+    advanceTo(wheel, 200);
+
+    EXPECT_FALSE(timer.m_fired);
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST(TimerWheel, PastDueEntriesExpireOnTheNextTick)
+{
+    hierarchical_wheel wheel{50};
+    Timer              timer;
+    wheel.insert(&timer, 10);
+
+    advanceTo(wheel, 50);
+
+    EXPECT_EQ(50U, timer.m_firedAt);
+}
+
+TEST(TimerWheel, NextEventIsNoLaterThanTheEarliestExpiry)
+{
+    hierarchical_wheel wheel{3};
+    Timer              timer;
+    wheel.insert(&timer, 40);
+
+    EXPECT_EQ(40U, wheel.next_event());
+    wheel.remove(&timer);
+    EXPECT_EQ(64U, wheel.next_event());
+}
+
+TEST(TimerWheel, MatchesTheDueTicksUnderRandomLoad)
+{
+    std::mt19937_64            random{42};
+    hierarchical_wheel         wheel{0};
+    std::vector<Timer>         timers(2000);
+    std::vector<std::uint64_t> expected(timers.size());
+    std::vector<bool>          removed(timers.size());
+    std::uint64_t              now = 0;
+
+    for (std::size_t i = 0; i < timers.size(); ++i)
+    {
+        // Mostly short delays, as for timeouts, with some far beyond the wheel's span
+        const std::uint64_t range = random() % 4 == 0 ? 64 : random() % 10 == 0 ? 40000000 : 400000;
+        const std::uint64_t due = now + random() % range;
+        expected[i] = std::max(due, wheel.next_tick());
+        wheel.insert(&timers[i], due);
+        if (random() % 5 == 0)
+        {
+            wheel.remove(&timers[i]);
+            removed[i] = true;
+        }
+        now += random() % 300;
+        advanceTo(wheel, now);
+    }
+    advanceTo(wheel, now + 40000000);
+
+    for (std::size_t i = 0; i < timers.size(); ++i)
+    {
+        EXPECT_EQ(!removed[i], timers[i].m_fired);
+        if (!removed[i])
+        {
+            EXPECT_EQ(expected[i], timers[i].m_firedAt);
+        }
+    }
+    EXPECT_TRUE(wheel.empty());
+}
@@ -0,0 +1,35 @@
+#include <add_ons/asio/typed_io.hpp>
+
+#include <boost/asio/bind_executor.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+
+#include <gtest/gtest.h>
+
+namespace asio = boost::asio;
+
+using promise::typed::pooled_handler;
+
+TEST(TypedIo, PooledHandlerKeepsTheExecutorOfTheHandler)
+{
+    asio::io_context ioc;
+    auto             strand = asio::make_strand(ioc);
+    auto             handler = asio::bind_executor(strand, [] {});
+    const pooled_handler<decltype(handler)> pooled{handler};
+
+    EXPECT_TRUE(asio::get_associated_executor(pooled, ioc.get_executor()) == strand);
+}
+
+TEST(TypedIo, PooledHandlerRunsOnTheExecutorOfTheHandler)
+{
+    asio::io_context ioc;
+    auto             strand = asio::make_strand(ioc);
+    bool             onStrand = false;
+    auto             handler = asio::bind_executor(strand, [&] { onStrand = strand.running_in_this_thread(); });
+
+    asio::post(ioc, pooled_handler<decltype(handler)>{handler});
+    ioc.run();
+
+    EXPECT_TRUE(onStrand);
+}
@@ -0,0 +1,101 @@
+#include <add_ons/thread/work_stealing_pool.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using promise::work_stealing_pool;
+
+namespace
+{
+
+// Spins until pred holds or a generous timeout passes
+template <typename Pred>
+bool waitFor(Pred pred)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!pred())
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+        std::this_thread::yield();
+    }
+    return true;
+}
+
+} // namespace
+
+TEST(WorkStealingPool, RunsEveryPostedTask)
+{
+    work_stealing_pool pool{4};
+    std::atomic<int>   count{};
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        pool.post([&count] { ++count; });
+    }
+
+    EXPECT_TRUE(waitFor([&] { return count == 10000; }));
+    EXPECT_TRUE(waitFor([&] { return pool.statistics().executed == 10000U; }));
+    EXPECT_EQ(0U, pool.statistics().queued);
+}
+
+TEST(WorkStealingPool, IdleWorkersStealFromABusyWorker)
+{
+    work_stealing_pool pool{4};
+    std::atomic<int>   count{};
+    std::atomic<bool>  release{};
+
+    // Tasks posted from a worker go onto its own queue, which it cannot
+    // take from while it blocks, so the other workers have to steal them
+    pool.post(
+        [&]
+        {
+            for (int i = 0; i < 100; ++i)
+            {
+                pool.post([&count] { ++count; });
+            }
+            waitFor([&] { return release.load(); });
+        });
+
+    EXPECT_TRUE(waitFor([&] { return count == 100; }));
+    release = true;
+    EXPECT_TRUE(waitFor([&] { return pool.statistics().executed == 101U; }));
+    // The outer task may itself have been stolen by a worker other than the one it was posted to
+    EXPECT_LE(100U, pool.statistics().stolen);
+}
+
+TEST(WorkStealingPool, ReportsQueueDepths)
+{
+    work_stealing_pool pool{2};
+    std::atomic<int>   blocked{};
+    std::atomic<bool>  release{};
+
+    // Occupy both workers, then queue more tasks behind them
+    for (int i = 0; i < 2; ++i)
+    {
+        pool.post(
+            [&]
+            {
+                ++blocked;
+                waitFor([&] { return release.load(); });
+            });
+    }
+    ASSERT_TRUE(waitFor([&] { return blocked == 2; }));
+    for (int i = 0; i < 6; ++i)
+    {
+        pool.post([] {});
+    }
+
+    const work_stealing_pool::stats stats = pool.statistics();
+    EXPECT_EQ(2U, stats.threads);
+    EXPECT_EQ(6U, stats.queued);
+    EXPECT_LE(6U, stats.high_water);
+    ASSERT_EQ(2U, stats.queue_depths.size());
+    EXPECT_EQ(6U, stats.queue_depths[0] + stats.queue_depths[1]);
+
+    release = true;
+    EXPECT_TRUE(waitFor([&] { return pool.statistics().queued == 0U; }));
+}